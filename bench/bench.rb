@@ -0,0 +1,199 @@
+# Benchmarks for the hot paths in ext/. Runs headless, so it works on
+# machines without a display.
+#
+#   ruby bench/bench.rb [--filter REGEX] [--save-baseline] [--threshold PERCENT]
+#
+# Results are written to bench/results.json. Unless --save-baseline is
+# given they are compared against bench/baseline.json, and the exit status
+# is non-zero if anything got slower by more than the threshold (15% by
+# default).
+#
+# Timings only mean anything next to others from the same machine, so no
+# baseline is checked in. CI should make its own on the same runner: check
+# out the base commit and run `rake bench:baseline`, then check out the
+# change and run `rake bench`. Without a baseline the results are only
+# printed.
+#
+# Besides the benchmarks of single operations, frame/scene times whole
+# frames of the main loop, update, draw and present, over a small game.
+
+ROOT = File.expand_path(File.dirname(__FILE__) + "/..")
+
+require ROOT + "/lib/Rug"
+require ROOT + "/bench/harness"
+
+include Rug
+
+filter = nil
+save_baseline = false
+threshold = 15.0
+
+args = ARGV.dup
+until args.empty?
+  case args.shift
+  when "--filter" then filter = Regexp.new(args.shift)
+  when "--save-baseline" then save_baseline = true
+  when "--threshold" then threshold = args.shift.to_f
+  end
+end
+
+# the font is loaded from the working directory
+Dir.chdir ROOT
+
+class BenchBody
+  include Physics::Body
+
+  def initialize x, y, vx = 0.0, vy = 0.0
+    super x, y, vx, vy, 1.0
+  end
+
+  # bounce off the edges of the window
+  def collide other
+    case other
+    when :left, :right
+      revert_position
+      self.vx = -vx
+    when :top, :bottom
+      revert_position
+      self.vy = -vy
+    end
+  end
+end
+
+SCENE = "frame/scene"
+SCENE_FRAMES = 300
+
+scene = filter.nil? || SCENE =~ filter
+
+Rug.conf do
+  headless true
+  frames(scene ? SCENE_FRAMES : 1)
+  gui false
+  width 800
+  height 600
+end
+
+Rug.load do
+  srand 42
+
+  small = Image.new 32, 32
+  small.fill_circle 16, 16, 15
+  large = Image.new 128, 128
+  large.fill_circle 64, 64, 60
+  sprite = Image.new ROOT + "/examples/side-scroller/bear_idle.png"
+  layer = Layer.new
+
+  [["32", small], ["128", large]].each do |size, image|
+    Bench.run("blit_image/screen/#{size}", filter) { image.draw 100, 100 }
+    Bench.run("blit_image/layer/#{size}", filter) { image.draw 100, 100, layer }
+  end
+  Bench.run("blit_image/screen/sprite", filter) { sprite.draw 100, 100 }
+
+  graphics = Graphics.new
+  Bench.run("text/fast", filter) { graphics.fast_text 10, 10, "The quick brown fox" }
+  Bench.run("text/nice", filter) { graphics.text 10, 10, "The quick brown fox" }
+
+  Bench.run("image/flip_h/128", filter) { large.flip_h }
+  Bench.run("image/flip_v/128", filter) { large.flip_v }
+  Bench.run("image/rotate/128", filter) { large.rotate 33 }
+  Bench.run("image/scale/128", filter) { large.scale 1.5 }
+
+  canvas = Image.new 800, 600
+  rects = (1..1000).map { [rand(780), rand(580)] }.map { |x, y| [x, y, x + 16, y + 16] }.flatten
+  circles = (1..1000).map { [rand(800), rand(600), 8] }.flatten
+  packed_rects = rects.pack("s*")
+  packed_circles = circles.pack("s*")
+  Bench.run("primitives/fill_rect/1000", filter) { rects.each_slice(4) { |l, t, r, b| canvas.fill_rect l, t, r, b } }
+  Bench.run("primitives/fill_rects/1000", filter) { canvas.fill_rects packed_rects }
+  Bench.run("primitives/fill_circle/1000", filter) { circles.each_slice(3) { |x, y, r| canvas.fill_circle x, y, r } }
+  Bench.run("primitives/fill_circles/1000", filter) { canvas.fill_circles packed_circles }
+
+  # handlers can't be taken away, so go up in number of them
+  handlers = 0
+  [1, 10].each do |count|
+    (count - handlers).times { Rug.keydown { |key| key } }
+    handlers = count
+
+    Bench.run("events/dispatch/#{count}_handlers", filter) do
+      Rug.send :push_event, :keydown, Key::Space
+      Rug.send :pump_events
+    end
+  end
+
+  [100, 1000, 5000].each do |count|
+    world = Physics::World.new
+    world.collide_with_window = false
+
+    # keep the density about the same at every size
+    side = Math.sqrt(count) * 40
+    bodies = (1..count).map do
+      body = BenchBody.new rand * side, rand * side
+      body.shape = Physics::Rectangle.new 16, 16
+      world << body
+      body
+    end
+
+    i = 0
+    Bench.run("physics/check_for_collision/#{count}", filter) do
+      world.check_for_collision bodies[i % count]
+      i += 1
+    end
+  end
+
+  if scene
+    # a small game: bouncing bodies with sprites, a particle system and
+    # some text, which every frame of the loop below updates and draws
+    world = Physics::World.new
+    bouncers = (1..200).map do
+      body = BenchBody.new rand(700), rand(500), rand(200) - 100, rand(200) - 100
+      body.shape = Physics::Rectangle.new 32, 32
+      world << body
+      body
+    end
+
+    sparks = ParticleSystem.new
+    sparks.gravity = 300
+    sparks.emitter :x => 400, :y => 300, :rate => 2000, :angle => -90, :spread => 90,
+      :speed => 50..200, :life => 200..800, :colour => Colour::Yellow
+
+    Rug.update do |dt|
+      world.update dt
+      sparks.update dt
+    end
+
+    Rug.draw do
+      bouncers.each { |b| small.draw b.x.to_i, b.y.to_i }
+      sparks.draw
+      fast_text 10, 10, "The quick brown fox"
+    end
+
+    # the loop starts as soon as this block returns
+    $scene_start = Bench.now
+    $scene_allocs = Bench.allocated
+  end
+end
+
+Rug.start
+
+if scene
+  allocs = $scene_allocs && (Bench.allocated - $scene_allocs).to_f / SCENE_FRAMES
+  Bench.record SCENE, Bench.now - $scene_start, SCENE_FRAMES, allocs
+end
+
+Bench.save ROOT + "/bench/results.json"
+
+baseline = ROOT + "/bench/baseline.json"
+if save_baseline
+  Bench.save baseline
+  puts "Saved baseline to #{baseline}"
+elsif not File.exist? baseline
+  puts "\nNo baseline to compare with, make one with: rake bench:baseline"
+else
+  puts
+  slower = Bench.regressions baseline, threshold
+  unless slower.empty?
+    puts "\nSlower than the baseline by more than #{threshold}%:"
+    slower.each { |name| puts "  #{name}" }
+    exit 1
+  end
+end
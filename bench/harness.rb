@@ -0,0 +1,89 @@
+require 'json'
+
+# A small benchmark harness. Each benchmark is a block that does one
+# operation; it is run enough times to take a measurable amount of time and
+# the best of a few rounds is kept, to cut down on noise from the machine.
+module Bench
+  ROUNDS = 3
+  MIN_TIME = 0.2 # seconds per round
+
+  @results = {}
+
+  class << self
+    attr_reader :results
+
+    def now
+      if defined? Process::CLOCK_MONOTONIC
+        Process.clock_gettime Process::CLOCK_MONOTONIC
+      else
+        Time.now.to_f
+      end
+    end
+
+    def allocated
+      GC.stat[:total_allocated_objects] if GC.respond_to? :stat
+    end
+
+    # Times _block_, which does one operation each time it is called.
+    def run name, filter = nil, &block
+      return if filter and name !~ filter
+
+      # warm up, and find out how many calls fill a round
+      block.call
+      iterations = 1
+      loop do
+        start = now
+        iterations.times(&block)
+        break if now - start >= MIN_TIME / 10
+        iterations *= 2
+      end
+      iterations *= 10
+
+      best = nil
+      allocs = nil
+      ROUNDS.times do
+        before = allocated
+        start = now
+        iterations.times(&block)
+        elapsed = now - start
+
+        best = elapsed if best.nil? or elapsed < best
+        allocs = (allocated - before).to_f / iterations if before
+      end
+
+      record name, best, iterations, allocs
+    end
+
+    # Stores a result that was timed some other way, such as frames of the
+    # main loop. _elapsed_ is the seconds that _iterations_ operations took.
+    def record name, elapsed, iterations, allocs = nil
+      @results[name] = {
+        "ns_per_op" => (elapsed * 1e9 / iterations).round(1),
+        "allocs_per_op" => allocs && allocs.round(2),
+        "iterations" => iterations
+      }
+
+      printf "%-45s %12.1f ns/op %10s allocs/op\n", name, @results[name]["ns_per_op"],
+        allocs ? allocs.round(2) : "-"
+    end
+
+    def save filename
+      File.open(filename, "w") { |f| f.write JSON.pretty_generate(@results) }
+    end
+
+    # Compares the results against a saved baseline and returns the names of
+    # the benchmarks that got slower by more than _threshold_ percent.
+    def regressions baseline_file, threshold
+      baseline = JSON.parse File.read(baseline_file)
+
+      @results.keys.sort.select do |name|
+        old = baseline[name]
+        next false if old.nil?
+
+        change = (@results[name]["ns_per_op"] - old["ns_per_op"]) / old["ns_per_op"] * 100
+        printf "%-45s %+7.1f%%\n", name, change
+        change > threshold
+      end
+    end
+  end
+end
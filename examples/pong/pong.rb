@@ -25,7 +25,7 @@ class Paddle < AnimatedBody
     # Stop the paddles when they bump into the top or the bottom.
     case other
     when :top, :bottom
-      @vy = 0
+      self.vy = 0
       revert_position
     end
   end
@@ -47,7 +47,7 @@ class Ball < AnimatedBody
     # the object contacts the edge of the screen.
     case other
     when :top, :bottom
-      @vy = -@vy
+      self.vy = -vy
       revert_position
     when :left
       $score2 += 1
@@ -57,7 +57,7 @@ class Ball < AnimatedBody
       reset
     else
       # Hit something else, which is a paddle
-      @vx = -@vx
+      self.vx = -vx
       revert_position
     end
   end
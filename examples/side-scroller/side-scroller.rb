@@ -30,7 +30,7 @@ class Bear < AnimatedBody
   def collide other
     # if we've bumped into a platform, stop moving
     revert_position :y
-    @vy = 0
+    self.vy = 0
     @in_air = false
   end
 
@@ -38,10 +38,10 @@ class Bear < AnimatedBody
     case dir
     when :left, :right
       @facing = dir
-      @vx = dir == :left ? -BEAR_SPEED : BEAR_SPEED
+      self.vx = dir == :left ? -BEAR_SPEED : BEAR_SPEED
       set_animation :walking
     else
-      @vx = 0.0
+      self.vx = 0.0
       @facing = nil
       set_animation :idle
     end
@@ -0,0 +1,346 @@
+#include "animation.h"
+#include "image.h"
+#include "atlas.h"
+#include "conf.h"
+
+#include <vector>
+
+using namespace std;
+
+VALUE cRugAnimation;
+
+extern SDL_Surface * mainWnd;
+
+typedef struct {
+  VALUE name, image;
+  vector<SDL_Rect> frames; // relative to the image or atlas region
+  vector<Uint32> timing;
+  Uint32 length; // sum of the timing, for skipping whole loops
+} RugFrameset;
+
+typedef struct {
+  vector<RugFrameset> framesets;
+  int current;       // index into framesets, -1 until one is added
+  int frame;
+  Uint32 elapsed;    // milliseconds spent on the current frame so far
+  Uint32 lastTicks;
+  size_t slot;       // where this is in liveAnimations
+} RugAnimation;
+
+// Every animation that hasn't been garbage collected, so the main loop
+// can advance them all without calling into Ruby
+static vector<RugAnimation *> liveAnimations;
+
+static void mark_animation(void * vp){
+  RugAnimation * anim = (RugAnimation *)vp;
+  for (size_t i = 0; i < anim->framesets.size(); i++){
+    rb_gc_mark(anim->framesets[i].name);
+    rb_gc_mark(anim->framesets[i].image);
+  }
+}
+
+static void unload_animation(void * vp){
+  RugAnimation * anim = (RugAnimation *)vp;
+
+  RugAnimation * last = liveAnimations.back();
+  liveAnimations[anim->slot] = last;
+  last->slot = anim->slot;
+  liveAnimations.pop_back();
+
+  delete anim;
+}
+
+static VALUE RugAnimationAlloc(VALUE klass){
+  RugAnimation * anim = new RugAnimation;
+  anim->current = -1;
+  anim->frame = 0;
+  anim->elapsed = 0;
+  anim->lastTicks = RugGetTicks();
+  anim->slot = liveAnimations.size();
+  liveAnimations.push_back(anim);
+
+  return Data_Wrap_Struct(klass, mark_animation, unload_animation, anim);
+}
+
+static RugAnimation * GetAnimation(VALUE self){
+  RugAnimation * anim;
+  Data_Get_Struct(self, RugAnimation, anim);
+  return anim;
+}
+
+static RugFrameset & CurrentFrameset(RugAnimation * anim){
+  if (anim->current < 0){
+    rb_raise(rb_eRuntimeError, "No default animation set!");
+  }
+  return anim->framesets[anim->current];
+}
+
+// Steps through as many frames as _dt_ covers. Whole loops are skipped
+// first, so a long pause costs no more than a short one.
+static void Advance(RugAnimation * anim, Uint32 dt){
+  if (anim->current < 0){
+    return;
+  }
+
+  RugFrameset & fs = anim->framesets[anim->current];
+  Uint32 elapsed = anim->elapsed + dt;
+  if (elapsed >= fs.length){
+    elapsed %= fs.length;
+  }
+
+  while (elapsed >= fs.timing[anim->frame]){
+    elapsed -= fs.timing[anim->frame];
+    anim->frame = (anim->frame + 1) % fs.frames.size();
+  }
+  anim->elapsed = elapsed;
+}
+
+void AdvanceAnimations(Uint32 now){
+  for (size_t i = 0; i < liveAnimations.size(); i++){
+    RugAnimation * anim = liveAnimations[i];
+
+    // time can go backwards when a replay starts
+    if ((Sint32)(now - anim->lastTicks) > 0){
+      Advance(anim, now - anim->lastTicks);
+    }
+    anim->lastTicks = now;
+  }
+}
+
+// Gets the surface that a Rug::Image or Rug::Atlas::Region draws from and
+// the part of it that it covers
+static void ImageSource(VALUE image, SDL_Surface ** surface, SDL_Rect * area){
+  if (rb_obj_is_kind_of(image, cRugImage)){
+    RugImage * img;
+    Data_Get_Struct(image, RugImage, img);
+
+    *surface = img->image;
+    area->x = area->y = 0;
+    area->w = img->image->w;
+    area->h = img->image->h;
+  }else if (rb_obj_is_kind_of(image, cRugAtlasRegion)){
+    AtlasRegionSource(image, surface, area);
+  }else{
+    rb_raise(rb_eTypeError, "frameset images must be a Rug::Image or a Rug::Atlas::Region");
+  }
+}
+
+static void FrameSource(VALUE image, const SDL_Rect & frame, SDL_Surface ** surface, SDL_Rect * src){
+  SDL_Rect area;
+  ImageSource(image, surface, &area);
+
+  *src = frame;
+  src->x += area.x;
+  src->y += area.y;
+}
+
+void AnimationSource(VALUE animation, SDL_Surface ** surface, SDL_Rect * src){
+  RugAnimation * anim = GetAnimation(animation);
+  RugFrameset & fs = CurrentFrameset(anim);
+
+  FrameSource(fs.image, fs.frames[anim->frame], surface, src);
+}
+
+/*
+ * Adds a frameset. Rug::Animation.new calls this for each entry it is
+ * given, and the first one added is shown until animation= is called.
+ *
+ * _name_: What the frameset is called, for animation=
+ * _image_: A strip of frames side by side, all the same width, either a
+ *          Rug::Image or a Rug::Atlas::Region
+ * _timing_: An array with how many milliseconds to show each frame for
+ */
+static VALUE RugAnimationAddFrameset(VALUE self, VALUE name, VALUE image, VALUE timing){
+  Check_Type(timing, T_ARRAY);
+
+  int count = RARRAY_LEN(timing);
+  if (count == 0){
+    rb_raise(rb_eArgError, "a frameset needs at least one frame");
+  }
+
+  SDL_Surface * surface;
+  SDL_Rect area;
+  ImageSource(image, &surface, &area);
+
+  RugFrameset fs;
+  fs.name = name;
+  fs.image = image;
+  fs.length = 0;
+
+  int frameWidth = area.w / count;
+  for (int i = 0; i < count; i++){
+    SDL_Rect rect;
+    rect.x = frameWidth * i;
+    rect.y = 0;
+    rect.w = frameWidth;
+    rect.h = area.h;
+    fs.frames.push_back(rect);
+
+    // a frame has to last for some time or advancing would never stop
+    int ms = NUM2INT(rb_ary_entry(timing, i));
+    fs.timing.push_back(ms < 1 ? 1 : ms);
+    fs.length += fs.timing.back();
+  }
+
+  RugAnimation * anim = GetAnimation(self);
+  anim->framesets.push_back(fs);
+  if (anim->current < 0){
+    anim->current = 0;
+  }
+
+  return self;
+}
+
+/*
+ * Switches to the frameset called _which_, starting from its first frame.
+ */
+static VALUE RugAnimationSetAnimation(VALUE self, VALUE which){
+  RugAnimation * anim = GetAnimation(self);
+
+  for (size_t i = 0; i < anim->framesets.size(); i++){
+    if (rb_equal(anim->framesets[i].name, which)){
+      anim->current = i;
+      anim->frame = 0;
+      anim->elapsed = 0;
+      return which;
+    }
+  }
+
+  VALUE desc = rb_inspect(which);
+  rb_raise(rb_eRuntimeError, "No frameset named %s!", StringValueCStr(desc));
+  return Qnil;
+}
+
+/*
+ * Gets the name of the frameset being shown.
+ */
+static VALUE RugAnimationGetAnimation(VALUE self){
+  return CurrentFrameset(GetAnimation(self)).name;
+}
+
+/*
+ * Gets the index of the frame being shown.
+ */
+static VALUE RugAnimationGetFrame(VALUE self){
+  return INT2FIX(GetAnimation(self)->frame);
+}
+
+/*
+ * Jumps to frame _frame_ of the current frameset.
+ */
+static VALUE RugAnimationSetFrame(VALUE self, VALUE rframe){
+  RugAnimation * anim = GetAnimation(self);
+  int count = CurrentFrameset(anim).frames.size();
+  int frame = NUM2INT(rframe) % count;
+
+  anim->frame = frame < 0 ? frame + count : frame;
+  anim->elapsed = 0;
+
+  return rframe;
+}
+
+/*
+ * Moves the animation on by _ms_ milliseconds. Animations are advanced by
+ * the main loop on their own, so this is only needed when running without
+ * Rug.start.
+ */
+static VALUE RugAnimationAdvance(VALUE self, VALUE ms){
+  int dt = NUM2INT(ms);
+  if (dt > 0){
+    Advance(GetAnimation(self), dt);
+  }
+  return self;
+}
+
+/*
+ * Does nothing, since the main loop advances every animation. It's kept so
+ * that animations and images can be updated the same way.
+ */
+static VALUE RugAnimationUpdate(int argc, VALUE * argv, VALUE self){
+  return Qnil;
+}
+
+/*
+ * Gets the part of the surface being drawn from for the current frame as
+ * [x, y, width, height]. For a frameset packed in a Rug::Atlas this is
+ * where the frame is on the atlas page.
+ */
+static VALUE RugAnimationSourceRect(VALUE self){
+  SDL_Surface * surface;
+  SDL_Rect src;
+  AnimationSource(self, &surface, &src);
+
+  return rb_ary_new3(4, INT2FIX(src.x), INT2FIX(src.y), INT2FIX(src.w), INT2FIX(src.h));
+}
+
+/*
+ * Gets the image of the frameset being shown.
+ */
+static VALUE RugAnimationImage(VALUE self){
+  return CurrentFrameset(GetAnimation(self)).image;
+}
+
+/*
+ * Gets the width of a frame.
+ */
+static VALUE RugAnimationWidth(VALUE self){
+  RugFrameset & fs = CurrentFrameset(GetAnimation(self));
+  return INT2FIX(fs.frames[0].w);
+}
+
+/*
+ * Gets the height of a frame.
+ */
+static VALUE RugAnimationHeight(VALUE self){
+  RugFrameset & fs = CurrentFrameset(GetAnimation(self));
+  return INT2FIX(fs.frames[0].h);
+}
+
+/*
+ * Draws the current frame at _x_, _y_, on _layer_ if one is given. If a
+ * block is passed, it is given the frameset's image and the image it
+ * returns is drawn instead, so the frame can be flipped or tinted.
+ */
+static VALUE RugAnimationDraw(int argc, VALUE * argv, VALUE self){
+  VALUE x, y, layer;
+  rb_scan_args(argc, argv, "21", &x, &y, &layer);
+
+  if (mainWnd == NULL){
+    return self;
+  }
+
+  // the block gets the frameset's image and can hand back another one of
+  // the same layout, such as a flipped copy
+  VALUE image = CurrentFrameset(GetAnimation(self)).image;
+  if (rb_block_given_p()){
+    image = rb_yield(image);
+  }
+
+  // the block could have added framesets, so look the frame up afterwards
+  RugAnimation * anim = GetAnimation(self);
+  SDL_Surface * surface;
+  SDL_Rect src;
+  FrameSource(image, CurrentFrameset(anim).frames[anim->frame], &surface, &src);
+
+  DrawSurface(surface, &src, NUM2INT(x), NUM2INT(y), layer);
+
+  return self;
+}
+
+void LoadAnimation(VALUE mRug){
+  cRugAnimation = rb_define_class_under(mRug, "Animation", rb_cObject);
+  rb_define_alloc_func(cRugAnimation, RugAnimationAlloc);
+
+  rb_define_method(cRugAnimation, "add_frameset", (VALUE (*)(...))RugAnimationAddFrameset, 3);
+  rb_define_method(cRugAnimation, "animation=", (VALUE (*)(...))RugAnimationSetAnimation, 1);
+  rb_define_method(cRugAnimation, "animation", (VALUE (*)(...))RugAnimationGetAnimation, 0);
+  rb_define_method(cRugAnimation, "frame", (VALUE (*)(...))RugAnimationGetFrame, 0);
+  rb_define_method(cRugAnimation, "frame=", (VALUE (*)(...))RugAnimationSetFrame, 1);
+  rb_define_method(cRugAnimation, "advance", (VALUE (*)(...))RugAnimationAdvance, 1);
+  rb_define_method(cRugAnimation, "update", (VALUE (*)(...))RugAnimationUpdate, -1);
+  rb_define_method(cRugAnimation, "source_rect", (VALUE (*)(...))RugAnimationSourceRect, 0);
+  rb_define_method(cRugAnimation, "image", (VALUE (*)(...))RugAnimationImage, 0);
+  rb_define_method(cRugAnimation, "width", (VALUE (*)(...))RugAnimationWidth, 0);
+  rb_define_method(cRugAnimation, "height", (VALUE (*)(...))RugAnimationHeight, 0);
+  rb_define_method(cRugAnimation, "draw", (VALUE (*)(...))RugAnimationDraw, -1);
+}
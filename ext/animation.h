@@ -0,0 +1,17 @@
+#ifndef RUG_ANIMATION_H
+#define RUG_ANIMATION_H
+
+#include "ruby.h"
+#include <SDL/SDL.h>
+
+void LoadAnimation(VALUE);
+
+// Moves every live Rug::Animation on to where it should be at _now_. This
+// is called once a frame from the main loop.
+void AdvanceAnimations(Uint32 now);
+
+// Gets the surface and the part of it showing for the current frame of an
+// animation, so it can be drawn without going back through Ruby
+void AnimationSource(VALUE animation, SDL_Surface ** surface, SDL_Rect * src);
+
+#endif //RUG_ANIMATION_H
@@ -0,0 +1,543 @@
+#include "defs.h"
+#include "atlas.h"
+#include "image.h"
+#include "compositor.h"
+#include "binio.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+VALUE cRugAtlas, cRugAtlasRegion;
+
+extern SDL_Surface * mainWnd;
+
+static const Uint32 ATLAS_MAGIC   = 0x54414752; // "RGAT"
+static const Uint32 ATLAS_VERSION = 1;
+
+// Keeps a page under 256MB, and everything on it in reach of an SDL_Rect
+static const int MAX_PAGE_SIZE = 8192;
+
+// One segment of the top edge of the packed area of a page
+typedef struct {
+  int x, y, w;
+} SkylineNode;
+
+typedef struct {
+  string name;
+  int page;
+  SDL_Rect rect;
+} RugAtlasEntry;
+
+typedef struct {
+  int pageSize;
+  vector<SDL_Surface *> pages;
+  vector< vector<SkylineNode> > skylines;
+  vector<RugAtlasEntry> entries;
+  map<string, int> names;
+  VALUE regions; // Hash of name => Region, so they are only made once
+} RugAtlas;
+
+typedef struct {
+  VALUE atlas;
+  int entry;
+} RugAtlasRegion;
+
+static void mark_atlas(void * vp){
+  rb_gc_mark(((RugAtlas *)vp)->regions);
+}
+
+static void unload_atlas(void * vp){
+  RugAtlas * atlas = (RugAtlas *)vp;
+  for (size_t i = 0; i < atlas->pages.size(); i++){
+    SDL_FreeSurface(atlas->pages[i]);
+  }
+  delete atlas;
+}
+
+static void mark_atlas_region(void * vp){
+  rb_gc_mark(((RugAtlasRegion *)vp)->atlas);
+}
+
+static void unload_atlas_region(void * vp){
+  delete (RugAtlasRegion *)vp;
+}
+
+static RugAtlas * NewAtlas(int pageSize){
+  RugAtlas * atlas = new RugAtlas;
+  atlas->pageSize = pageSize;
+  atlas->regions = rb_hash_new();
+  return atlas;
+}
+
+static SDL_Surface * NewPage(int size){
+  SDL_Surface * page = SDL_CreateRGBSurface(SDL_SWSURFACE, size, size, 32,
+      RED_MASK, GREEN_MASK, BLUE_MASK, ALPHA_MASK);
+  if (page == NULL){
+    rb_raise(rb_eRuntimeError, "Unable to create atlas page: %s", SDL_GetError());
+  }
+  SDL_FillRect(page, NULL, SDL_MapRGBA(page->format, 0, 0, 0, 0));
+  return ConvertToDisplay(page);
+}
+
+// Adds a page to the atlas. Loaded pages are already full.
+static void AddPage(RugAtlas * atlas, SDL_Surface * page, bool full){
+  SkylineNode node;
+  node.x = 0;
+  node.y = full ? atlas->pageSize : 0;
+  node.w = atlas->pageSize;
+
+  atlas->pages.push_back(page);
+  atlas->skylines.push_back(vector<SkylineNode>(1, node));
+}
+
+// Gets the y position that a w by h rectangle would sit at if its left
+// edge is at the start of skyline node i, or -1 if it doesn't fit
+static int SkylineFit(vector<SkylineNode> & skyline, size_t i, int w, int h, int size){
+  if (skyline[i].x + w > size){
+    return -1;
+  }
+
+  int y = skyline[i].y;
+  int widthLeft = w;
+  for (size_t j = i; widthLeft > 0 && j < skyline.size(); j++){
+    if (skyline[j].y > y){
+      y = skyline[j].y;
+    }
+    if (y + h > size){
+      return -1;
+    }
+    widthLeft -= skyline[j].w;
+  }
+
+  return y;
+}
+
+// Finds the lowest spot for a w by h rectangle on the page and raises
+// the skyline over it. Returns false if it doesn't fit.
+static bool SkylinePack(vector<SkylineNode> & skyline, int w, int h, int size, SDL_Rect & rect){
+  int bestBottom = size + 1, bestWidth = size + 1;
+  int best = -1, bestY = 0;
+
+  for (size_t i = 0; i < skyline.size(); i++){
+    int y = SkylineFit(skyline, i, w, h, size);
+    if (y < 0){
+      continue;
+    }
+
+    if (y + h < bestBottom || (y + h == bestBottom && skyline[i].w < bestWidth)){
+      best = i;
+      bestY = y;
+      bestBottom = y + h;
+      bestWidth = skyline[i].w;
+    }
+  }
+
+  if (best < 0){
+    return false;
+  }
+
+  rect.x = skyline[best].x;
+  rect.y = bestY;
+  rect.w = w;
+  rect.h = h;
+
+  SkylineNode node;
+  node.x = rect.x;
+  node.y = bestY + h;
+  node.w = w;
+  skyline.insert(skyline.begin() + best, node);
+
+  // the new node covers up the start of the nodes after it
+  for (size_t i = best + 1; i < skyline.size(); i++){
+    int edge = skyline[i - 1].x + skyline[i - 1].w;
+    if (skyline[i].x >= edge){
+      break;
+    }
+
+    int shrink = edge - skyline[i].x;
+    skyline[i].x += shrink;
+    skyline[i].w -= shrink;
+
+    if (skyline[i].w > 0){
+      break;
+    }
+    skyline.erase(skyline.begin() + i);
+    i--;
+  }
+
+  // join up neighbours at the same height
+  for (size_t i = 0; i + 1 < skyline.size(); i++){
+    if (skyline[i].y == skyline[i + 1].y){
+      skyline[i].w += skyline[i + 1].w;
+      skyline.erase(skyline.begin() + i + 1);
+      i--;
+    }
+  }
+
+  return true;
+}
+
+// Copies the pixels of a surface, including alpha, into the page
+static void CopyIntoPage(SDL_Surface * surface, SDL_Surface * page, SDL_Rect & at){
+  Uint32 flags = surface->flags & SDL_SRCALPHA;
+  Uint8 alpha = surface->format->alpha;
+
+  SDL_SetAlpha(surface, 0, alpha);
+
+  SDL_Rect dst = at;
+  SDL_BlitSurface(surface, NULL, page, &dst);
+
+  SDL_SetAlpha(surface, flags, alpha);
+}
+
+static VALUE WrapRegion(VALUE self, RugAtlas * atlas, int entry){
+  VALUE name = rb_str_new2(atlas->entries[entry].name.c_str());
+
+  RugAtlasRegion * region = new RugAtlasRegion;
+  region->atlas = self;
+  region->entry = entry;
+
+  VALUE res = Data_Wrap_Struct(cRugAtlasRegion, mark_atlas_region, unload_atlas_region, region);
+  rb_hash_aset(atlas->regions, name, res);
+
+  return res;
+}
+
+static void AddEntry(RugAtlas * atlas, const string & name, int page, SDL_Rect & rect){
+  RugAtlasEntry entry;
+  entry.name = name;
+  entry.page = page;
+  entry.rect = rect;
+
+  atlas->names[name] = atlas->entries.size();
+  atlas->entries.push_back(entry);
+}
+
+/*
+ * Creates an empty texture atlas. Images added to it are packed onto
+ * square pages that are _page_size_ pixels across (1024 by default), so
+ * that lots of small images end up in a few big surfaces.
+ */
+static VALUE RugCreateAtlas(int argc, VALUE * argv, VALUE klass){
+  VALUE pageSize;
+  rb_scan_args(argc, argv, "01", &pageSize);
+
+  int size = (pageSize == Qnil) ? 1024 : NUM2INT(pageSize);
+  if (size <= 0 || size > MAX_PAGE_SIZE){
+    rb_raise(rb_eArgError, "page size must be from 1 to %d", MAX_PAGE_SIZE);
+  }
+
+  return Data_Wrap_Struct(cRugAtlas, mark_atlas, unload_atlas, NewAtlas(size));
+}
+
+/*
+ * Packs _image_ into the atlas under _name_ and returns a region for it.
+ * The region can be drawn the same way as an image, so it can be used in
+ * place of one, for example as the image of an animation frameset.
+ *
+ * Usage:
+ *
+ *    atlas = Rug::Atlas.new
+ *    walk = atlas.add :bear_walk, Rug::Image.new("bear_walk.png")
+ *    walk.draw 10, 10
+ */
+static VALUE RugAtlasAdd(VALUE self, VALUE rname, VALUE rimage){
+  RugAtlas * atlas;
+  Data_Get_Struct(self, RugAtlas, atlas);
+
+  if (!rb_obj_is_kind_of(rimage, cRugImage)){
+    rb_raise(rb_eTypeError, "only a Rug::Image can be added to an atlas");
+  }
+
+  RugImage * image;
+  Data_Get_Struct(rimage, RugImage, image);
+
+  VALUE nameStr = rb_funcall(rname, rb_intern("to_s"), 0);
+  string name = STR2CSTR(nameStr);
+  if (atlas->names.find(name) != atlas->names.end()){
+    rb_raise(rb_eArgError, "there is already an image named %s in the atlas", name.c_str());
+  }
+
+  int w = image->image->w, h = image->image->h;
+  if (w > atlas->pageSize || h > atlas->pageSize){
+    rb_raise(rb_eArgError, "image is too big for a %dx%d atlas page", atlas->pageSize, atlas->pageSize);
+  }
+
+  SDL_Rect rect;
+  size_t page;
+  for (page = 0; page < atlas->pages.size(); page++){
+    if (SkylinePack(atlas->skylines[page], w, h, atlas->pageSize, rect)){
+      break;
+    }
+  }
+
+  if (page == atlas->pages.size()){
+    AddPage(atlas, NewPage(atlas->pageSize), false);
+    SkylinePack(atlas->skylines[page], w, h, atlas->pageSize, rect);
+  }
+
+  // the page might be waiting to be drawn
+  FlushComposite();
+  CopyIntoPage(image->image, atlas->pages[page], rect);
+  AddEntry(atlas, name, page, rect);
+
+  return WrapRegion(self, atlas, atlas->entries.size() - 1);
+}
+
+/*
+ * Gets the region named _name_, or nil if there isn't one.
+ */
+static VALUE RugAtlasGet(VALUE self, VALUE name){
+  RugAtlas * atlas;
+  Data_Get_Struct(self, RugAtlas, atlas);
+  return rb_hash_aref(atlas->regions, rb_funcall(name, rb_intern("to_s"), 0));
+}
+
+/*
+ * Gets the number of pages in the atlas.
+ */
+static VALUE RugAtlasPages(VALUE self){
+  RugAtlas * atlas;
+  Data_Get_Struct(self, RugAtlas, atlas);
+  return INT2FIX(atlas->pages.size());
+}
+
+/*
+ * Saves the packed pages and the table of regions to _filename_, so the
+ * atlas can be loaded later with Rug::Atlas.load instead of being packed
+ * again.
+ */
+static VALUE RugAtlasSave(VALUE self, VALUE filename){
+  RugAtlas * atlas;
+  Data_Get_Struct(self, RugAtlas, atlas);
+
+  FILE * f = fopen(STR2CSTR(filename), "wb");
+  if (f == NULL){
+    rb_raise(rb_eIOError, "Unable to save atlas: %s", STR2CSTR(filename));
+  }
+
+  WriteUint32(f, ATLAS_MAGIC);
+  WriteUint32(f, ATLAS_VERSION);
+  WriteUint32(f, atlas->pageSize);
+  WriteUint32(f, atlas->pages.size());
+  WriteUint32(f, atlas->entries.size());
+
+  // pixels are written as RGBA bytes whatever the format of the page
+  vector<Uint8> row(atlas->pageSize * 4);
+  for (size_t p = 0; p < atlas->pages.size(); p++){
+    SDL_Surface * page = atlas->pages[p];
+    if (SDL_MUSTLOCK(page)) SDL_LockSurface(page);
+
+    for (int y = 0; y < page->h; y++){
+      Uint32 * pixels = (Uint32 *)((Uint8 *)page->pixels + y * page->pitch);
+      for (int x = 0; x < page->w; x++){
+        SDL_GetRGBA(pixels[x], page->format, &row[x * 4], &row[x * 4 + 1], &row[x * 4 + 2], &row[x * 4 + 3]);
+      }
+      fwrite(&row[0], 1, row.size(), f);
+    }
+
+    if (SDL_MUSTLOCK(page)) SDL_UnlockSurface(page);
+  }
+
+  for (size_t i = 0; i < atlas->entries.size(); i++){
+    RugAtlasEntry & entry = atlas->entries[i];
+    WriteUint32(f, entry.name.size());
+    fwrite(entry.name.data(), 1, entry.name.size(), f);
+    WriteUint32(f, entry.page);
+    WriteUint32(f, entry.rect.x);
+    WriteUint32(f, entry.rect.y);
+    WriteUint32(f, entry.rect.w);
+    WriteUint32(f, entry.rect.h);
+  }
+
+  fclose(f);
+
+  return self;
+}
+
+/*
+ * Loads an atlas that was saved with Rug::Atlas#save. Images can still be
+ * added to it, they go on new pages.
+ */
+static VALUE RugAtlasLoad(VALUE klass, VALUE filename){
+  FILE * f = fopen(STR2CSTR(filename), "rb");
+  if (f == NULL){
+    rb_raise(rb_eIOError, "Unable to load atlas: %s", STR2CSTR(filename));
+  }
+
+  Uint32 magic, version, pageSize, numPages, numEntries;
+  if (!ReadUint32(f, magic) || !ReadUint32(f, version) || magic != ATLAS_MAGIC || version != ATLAS_VERSION ||
+      !ReadUint32(f, pageSize) || !ReadUint32(f, numPages) || !ReadUint32(f, numEntries)){
+    fclose(f);
+    rb_raise(rb_eIOError, "Not a Rug atlas: %s", STR2CSTR(filename));
+  }
+
+  if (pageSize == 0 || pageSize > (Uint32)MAX_PAGE_SIZE){
+    fclose(f);
+    rb_raise(rb_eIOError, "Atlas page size %u is out of range: %s", pageSize, STR2CSTR(filename));
+  }
+
+  RugAtlas * atlas = NewAtlas(pageSize);
+  VALUE self = Data_Wrap_Struct(cRugAtlas, mark_atlas, unload_atlas, atlas);
+
+  bool ok = true;
+  for (Uint32 p = 0; p < numPages && ok; p++){
+    SDL_Surface * page = SDL_CreateRGBSurface(SDL_SWSURFACE, pageSize, pageSize, 32,
+        RED_MASK, GREEN_MASK, BLUE_MASK, ALPHA_MASK);
+    if (page == NULL){
+      fclose(f);
+      rb_raise(rb_eRuntimeError, "Unable to create atlas page: %s", SDL_GetError());
+    }
+
+    vector<Uint8> row(pageSize * 4);
+    for (int y = 0; y < page->h && ok; y++){
+      ok = fread(&row[0], 1, row.size(), f) == row.size();
+
+      Uint32 * pixels = (Uint32 *)((Uint8 *)page->pixels + y * page->pitch);
+      for (int x = 0; x < page->w; x++){
+        pixels[x] = SDL_MapRGBA(page->format, row[x * 4], row[x * 4 + 1], row[x * 4 + 2], row[x * 4 + 3]);
+      }
+    }
+
+    AddPage(atlas, ConvertToDisplay(page), true);
+  }
+
+  for (Uint32 i = 0; i < numEntries && ok; i++){
+    Uint32 length, page, x, y, w, h;
+    ok = ReadUint32(f, length) && length < 4096;
+    if (!ok){
+      break;
+    }
+
+    string name(length, ' ');
+    ok = fread(&name[0], 1, length, f) == length &&
+      ReadUint32(f, page) && ReadUint32(f, x) && ReadUint32(f, y) && ReadUint32(f, w) && ReadUint32(f, h) &&
+      page < numPages && x < pageSize && y < pageSize && w <= pageSize - x && h <= pageSize - y;
+
+    if (ok){
+      SDL_Rect rect;
+      rect.x = x; rect.y = y; rect.w = w; rect.h = h;
+      AddEntry(atlas, name, page, rect);
+      WrapRegion(self, atlas, atlas->entries.size() - 1);
+    }
+  }
+
+  fclose(f);
+
+  if (!ok){
+    rb_raise(rb_eIOError, "Atlas is truncated or corrupt: %s", STR2CSTR(filename));
+  }
+
+  return self;
+}
+
+static RugAtlasEntry & GetRegionEntry(VALUE self, SDL_Surface ** page){
+  RugAtlasRegion * region;
+  Data_Get_Struct(self, RugAtlasRegion, region);
+
+  RugAtlas * atlas;
+  Data_Get_Struct(region->atlas, RugAtlas, atlas);
+
+  RugAtlasEntry & entry = atlas->entries[region->entry];
+  if (page != NULL){
+    *page = atlas->pages[entry.page];
+  }
+  return entry;
+}
+
+void AtlasRegionSource(VALUE region, SDL_Surface ** page, SDL_Rect * rect){
+  *rect = GetRegionEntry(region, page).rect;
+}
+
+/*
+ * Gets the width of the region in pixels.
+ */
+static VALUE RugAtlasRegionWidth(VALUE self){
+  return INT2FIX(GetRegionEntry(self, NULL).rect.w);
+}
+
+/*
+ * Gets the height of the region in pixels.
+ */
+static VALUE RugAtlasRegionHeight(VALUE self){
+  return INT2FIX(GetRegionEntry(self, NULL).rect.h);
+}
+
+/*
+ * Gets the name the region was added with.
+ */
+static VALUE RugAtlasRegionName(VALUE self){
+  return rb_str_new2(GetRegionEntry(self, NULL).name.c_str());
+}
+
+/*
+ * Draws the region, taking the same arguments as Rug::Image#draw. The
+ * source position and size are relative to the region, and are cut off
+ * at its edges.
+ */
+static VALUE RugAtlasRegionDraw(int argc, VALUE * argv, VALUE self){
+  if (mainWnd == NULL){
+    return self;
+  }
+
+  VALUE sx, sy, x, y, width, height, targetLayer;
+  rb_scan_args(argc, argv, "25", &x, &y, &width, &height, &sx, &sy, &targetLayer);
+
+  // if the width is not a number, assume it is a layer
+  if (TYPE(width) != T_FIXNUM && TYPE(width) != T_BIGNUM){
+    targetLayer = width;
+    width = Qnil;
+  }
+
+  SDL_Surface * page;
+  RugAtlasEntry & entry = GetRegionEntry(self, &page);
+
+  SDL_Rect src = entry.rect;
+
+  if (width != Qnil){
+    int w = FIX2INT(width);
+    int h = (height != Qnil) ? FIX2INT(height) : w;
+    int left = (sx != Qnil) ? FIX2INT(sx) : 0;
+    int top  = (sy != Qnil) ? FIX2INT(sy) : 0;
+
+    // keep the source inside the region
+    if (left < 0) { w += left; left = 0; }
+    if (top < 0)  { h += top;  top = 0; }
+    if (left + w > entry.rect.w) w = entry.rect.w - left;
+    if (top + h > entry.rect.h)  h = entry.rect.h - top;
+    if (w <= 0 || h <= 0){
+      return self;
+    }
+
+    src.x += left;
+    src.y += top;
+    src.w = w;
+    src.h = h;
+  }
+
+  DrawSurface(page, &src, FIX2INT(x), FIX2INT(y), targetLayer);
+
+  return self;
+}
+
+void LoadAtlas(VALUE mRug){
+  cRugAtlas = rb_define_class_under(mRug, "Atlas", rb_cObject);
+  cRugAtlasRegion = rb_define_class_under(cRugAtlas, "Region", rb_cObject);
+
+  rb_define_singleton_method(cRugAtlas, "new",  (VALUE (*)(...))RugCreateAtlas, -1);
+  rb_define_singleton_method(cRugAtlas, "load", (VALUE (*)(...))RugAtlasLoad,    1);
+  rb_define_method(cRugAtlas, "add",   (VALUE (*)(...))RugAtlasAdd,   2);
+  rb_define_method(cRugAtlas, "[]",    (VALUE (*)(...))RugAtlasGet,   1);
+  rb_define_method(cRugAtlas, "pages", (VALUE (*)(...))RugAtlasPages, 0);
+  rb_define_method(cRugAtlas, "save",  (VALUE (*)(...))RugAtlasSave,  1);
+
+  rb_define_method(cRugAtlasRegion, "draw",   (VALUE (*)(...))RugAtlasRegionDraw,   -1);
+  rb_define_method(cRugAtlasRegion, "width",  (VALUE (*)(...))RugAtlasRegionWidth,   0);
+  rb_define_method(cRugAtlasRegion, "height", (VALUE (*)(...))RugAtlasRegionHeight,  0);
+  rb_define_method(cRugAtlasRegion, "name",   (VALUE (*)(...))RugAtlasRegionName,    0);
+}
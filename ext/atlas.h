@@ -0,0 +1,15 @@
+#ifndef RUG_ATLAS_H
+#define RUG_ATLAS_H
+
+#include "ruby.h"
+
+#include <SDL/SDL.h>
+
+extern VALUE cRugAtlasRegion;
+
+void LoadAtlas(VALUE);
+
+// Gets the page a Rug::Atlas::Region is on and where it is on the page
+void AtlasRegionSource(VALUE region, SDL_Surface ** page, SDL_Rect * rect);
+
+#endif //RUG_ATLAS_H
@@ -0,0 +1,187 @@
+#include "batch.h"
+#include "colour.h"
+
+#include <SDL/SDL_gfxPrimitives.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+using namespace std;
+
+// Pulls the numbers out of an Array or a String of packed int16s
+static void ReadShapes(VALUE shapes, int perShape, vector<Sint16> & out){
+  if (TYPE(shapes) == T_STRING){
+    long n = RSTRING_LEN(shapes) / sizeof(Sint16);
+    out.resize(n);
+    if (n > 0){
+      memcpy(&out[0], RSTRING_PTR(shapes), n * sizeof(Sint16));
+    }
+  }else{
+    Check_Type(shapes, T_ARRAY);
+    long n = RARRAY_LEN(shapes);
+    out.resize(n);
+    for (long i = 0; i < n; i++){
+      out[i] = NUM2INT(rb_ary_entry(shapes, i));
+    }
+  }
+
+  if (out.size() % perShape != 0){
+    rb_raise(rb_eArgError, "shapes need %d numbers each, got %ld numbers", perShape, (long)out.size());
+  }
+}
+
+// Fills in one gfx colour per shape
+static void ReadColours(VALUE colours, size_t count, Uint32 colour, vector<Uint32> & out){
+  out.assign(count, colour);
+
+  if (colours == Qnil){
+    return;
+  }else if (TYPE(colours) == T_STRING){
+    size_t n = RSTRING_LEN(colours) / sizeof(Uint32);
+    if (n < count){
+      rb_raise(rb_eArgError, "need %ld colours, got %ld", (long)count, (long)n);
+    }
+    if (count > 0){
+      memcpy(&out[0], RSTRING_PTR(colours), count * sizeof(Uint32));
+    }
+  }else if (TYPE(colours) == T_ARRAY){
+    if ((size_t)RARRAY_LEN(colours) < count){
+      rb_raise(rb_eArgError, "need %ld colours, got %ld", (long)count, (long)RARRAY_LEN(colours));
+    }
+    for (size_t i = 0; i < count; i++){
+      out[i] = ColourToGfx(rb_ary_entry(colours, i));
+    }
+  }else{
+    out.assign(count, ColourToGfx(colours));
+  }
+}
+
+static inline bool Opaque(Uint32 colour){
+  return (colour & 0xFF) == 0xFF;
+}
+
+// Fills a rectangle, cut down to the clip rectangle in ints first so a
+// wide one doesn't wrap when it goes into an SDL_Rect
+static void FillClipped(SDL_Surface * surface, int l, int t, int w, int h, Uint32 mapped){
+  const SDL_Rect & clip = surface->clip_rect;
+  int r = min(l + w, clip.x + clip.w), b = min(t + h, clip.y + clip.h);
+  l = max(l, (int)clip.x);
+  t = max(t, (int)clip.y);
+  if (r <= l || b <= t){
+    return;
+  }
+
+  SDL_Rect rect;
+  rect.x = l;
+  rect.y = t;
+  rect.w = r - l;
+  rect.h = b - t;
+  SDL_FillRect(surface, &rect, mapped);
+}
+
+// A horizontal run of pixels from x0 to x1 inclusive. Opaque runs are
+// written straight in, others go through gfx so they blend.
+static inline void Span(SDL_Surface * surface, int x0, int x1, int y, Uint32 colour, Uint32 mapped){
+  const SDL_Rect & clip = surface->clip_rect;
+  x0 = max(x0, (int)clip.x);
+  x1 = min(x1, clip.x + clip.w - 1);
+  if (x1 < x0 || y < clip.y || y >= clip.y + clip.h){
+    return;
+  }
+
+  if (Opaque(colour)){
+    FillClipped(surface, x0, y, x1 - x0 + 1, 1, mapped);
+  }else{
+    hlineColor(surface, x0, x1, y, colour);
+  }
+}
+
+// Shapes are _l_, _t_, _r_, _b_ like Rug::Image#fill_rect.
+void BatchFillRects(SDL_Surface * surface, VALUE shapes, VALUE colours, Uint32 colour){
+  vector<Sint16> s;
+  vector<Uint32> c;
+  ReadShapes(shapes, 4, s);
+  ReadColours(colours, s.size() / 4, colour, c);
+
+  for (size_t i = 0; i < c.size(); i++){
+    Sint16 * r = &s[i * 4];
+    int l = min(r[0], r[2]), t = min(r[1], r[3]);
+    int w = abs(r[2] - r[0]) + 1, h = abs(r[3] - r[1]) + 1;
+
+    if (Opaque(c[i])){
+      FillClipped(surface, l, t, w, h, MapGfxColour(surface->format, c[i]));
+    }else{
+      boxColor(surface, r[0], r[1], r[2], r[3], c[i]);
+    }
+  }
+}
+
+// Shapes are _l_, _t_, _r_, _b_ like Rug::Image#draw_rect.
+void BatchDrawRects(SDL_Surface * surface, VALUE shapes, VALUE colours, Uint32 colour){
+  vector<Sint16> s;
+  vector<Uint32> c;
+  ReadShapes(shapes, 4, s);
+  ReadColours(colours, s.size() / 4, colour, c);
+
+  for (size_t i = 0; i < c.size(); i++){
+    Sint16 * r = &s[i * 4];
+    rectangleColor(surface, r[0], r[1], r[2], r[3], c[i]);
+  }
+}
+
+// Shapes are _x_, _y_, _r_ like Rug::Image#fill_circle. Each is filled a
+// row at a time.
+void BatchFillCircles(SDL_Surface * surface, VALUE shapes, VALUE colours, Uint32 colour){
+  vector<Sint16> s;
+  vector<Uint32> c;
+  ReadShapes(shapes, 3, s);
+  ReadColours(colours, s.size() / 3, colour, c);
+
+  SDL_Rect clip;
+  SDL_GetClipRect(surface, &clip);
+
+  for (size_t i = 0; i < c.size(); i++){
+    int x = s[i * 3], y = s[i * 3 + 1], r = s[i * 3 + 2];
+    if (r < 0){
+      continue;
+    }
+
+    Uint32 mapped = MapGfxColour(surface->format, c[i]);
+    int top = max(y - r, (int)clip.y), bottom = min(y + r, clip.y + clip.h - 1);
+    for (int py = top; py <= bottom; py++){
+      int dy = py - y;
+      int dx = (int)sqrt((double)(r * r - dy * dy));
+      Span(surface, x - dx, x + dx, py, c[i], mapped);
+    }
+  }
+}
+
+// Shapes are _x_, _y_, _r_ like Rug::Image#draw_circle.
+void BatchDrawCircles(SDL_Surface * surface, VALUE shapes, VALUE colours, Uint32 colour){
+  vector<Sint16> s;
+  vector<Uint32> c;
+  ReadShapes(shapes, 3, s);
+  ReadColours(colours, s.size() / 3, colour, c);
+
+  for (size_t i = 0; i < c.size(); i++){
+    circleColor(surface, s[i * 3], s[i * 3 + 1], s[i * 3 + 2], c[i]);
+  }
+}
+
+// Shapes are _x1_, _y1_, _x2_, _y2_.
+void BatchDrawLines(SDL_Surface * surface, VALUE shapes, VALUE colours, Uint32 colour){
+  vector<Sint16> s;
+  vector<Uint32> c;
+  ReadShapes(shapes, 4, s);
+  ReadColours(colours, s.size() / 4, colour, c);
+
+  for (size_t i = 0; i < c.size(); i++){
+    Sint16 * l = &s[i * 4];
+    if (l[1] == l[3]){
+      Uint32 mapped = MapGfxColour(surface->format, c[i]);
+      Span(surface, min(l[0], l[2]), max(l[0], l[2]), l[1], c[i], mapped);
+    }else{
+      lineColor(surface, l[0], l[1], l[2], l[3], c[i]);
+    }
+  }
+}
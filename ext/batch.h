@@ -0,0 +1,17 @@
+#ifndef RUG_BATCH_H
+#define RUG_BATCH_H
+
+#include "ruby.h"
+#include <SDL/SDL.h>
+
+// Draw many shapes onto a surface in one go. The shapes are a flat Array
+// of numbers or a String of packed native int16s, and the colours are nil
+// for the given default, one gfx colour for all of them, or an Array or
+// packed uint32 String with one colour per shape.
+void BatchFillRects(SDL_Surface *, VALUE shapes, VALUE colours, Uint32 colour);
+void BatchDrawRects(SDL_Surface *, VALUE shapes, VALUE colours, Uint32 colour);
+void BatchFillCircles(SDL_Surface *, VALUE shapes, VALUE colours, Uint32 colour);
+void BatchDrawCircles(SDL_Surface *, VALUE shapes, VALUE colours, Uint32 colour);
+void BatchDrawLines(SDL_Surface *, VALUE shapes, VALUE colours, Uint32 colour);
+
+#endif //RUG_BATCH_H
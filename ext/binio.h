@@ -0,0 +1,23 @@
+#ifndef RUG_BINIO_H
+#define RUG_BINIO_H
+
+#include <stdio.h>
+#include <SDL/SDL.h>
+
+// Files Rug writes store numbers as little endian 32 bit ints
+
+static inline void WriteUint32(FILE * f, Uint32 v){
+  Uint8 bytes[4] = { (Uint8)v, (Uint8)(v >> 8), (Uint8)(v >> 16), (Uint8)(v >> 24) };
+  fwrite(bytes, 1, 4, f);
+}
+
+static inline bool ReadUint32(FILE * f, Uint32 & v){
+  Uint8 bytes[4];
+  if (fread(bytes, 1, 4, f) != 4){
+    return false;
+  }
+  v = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((Uint32)bytes[3] << 24);
+  return true;
+}
+
+#endif //RUG_BINIO_H
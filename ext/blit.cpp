@@ -0,0 +1,319 @@
+#include "blit.h"
+#include "cpu.h"
+
+#include <SDL/SDL_gfxBlitFunc.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifdef RUG_HAVE_AVX2_KERNEL
+#include <immintrin.h>
+#endif
+
+// The kernels give exactly what SDL_gfxBlitRGBA does. SDL_gfx first runs
+// the source alpha through a table, sA = sqrt(255 * a), then for each
+// colour channel works out
+//
+//   d = d + ((s - d) * sA >> 8)
+//
+// in unsigned ints and sets dA to dA | sA. Where s < d the sum wraps and
+// leaves bit 24 set, which is still there in the pixel if that channel is
+// in the lowest byte of the target. Pixels with no source alpha come out
+// as they were, so the kernels leave them alone.
+typedef struct {
+  int srcShift[3], dstShift[3]; // red, green and blue
+  int srcAlpha, dstAlpha;
+  int lowChannel;               // the colour in the target's lowest byte, or -1
+  Uint32 dstRGBMask;
+} BlendFormat;
+
+typedef void (*BlendRowFunc)(const Uint32 * src, Uint32 * dst, int w, const BlendFormat &);
+
+// GFX_ALPHA_ADJUST_ARRAY from SDL_gfxBlitFunc.c
+static const Uint32 AlphaAdjust[256] = {
+    0,  15,  22,  27,  31,  35,  39,  42,  45,  47,  50,  52,  55,  57,  59,  61,
+   63,  65,  67,  69,  71,  73,  74,  76,  78,  79,  81,  82,  84,  85,  87,  88,
+   90,  91,  93,  94,  95,  97,  98,  99, 100, 102, 103, 104, 105, 107, 108, 109,
+  110, 111, 112, 114, 115, 116, 117, 118, 119, 120, 121, 122, 123, 124, 125, 126,
+  127, 128, 129, 130, 131, 132, 133, 134, 135, 136, 137, 138, 139, 140, 141, 141,
+  142, 143, 144, 145, 146, 147, 148, 148, 149, 150, 151, 152, 153, 153, 154, 155,
+  156, 157, 158, 158, 159, 160, 161, 162, 162, 163, 164, 165, 165, 166, 167, 168,
+  168, 169, 170, 171, 171, 172, 173, 174, 174, 175, 176, 177, 177, 178, 179, 179,
+  180, 181, 182, 182, 183, 184, 184, 185, 186, 186, 187, 188, 188, 189, 190, 190,
+  191, 192, 192, 193, 194, 194, 195, 196, 196, 197, 198, 198, 199, 200, 200, 201,
+  201, 202, 203, 203, 204, 205, 205, 206, 206, 207, 208, 208, 209, 210, 210, 211,
+  211, 212, 213, 213, 214, 214, 215, 216, 216, 217, 217, 218, 218, 219, 220, 220,
+  221, 221, 222, 222, 223, 224, 224, 225, 225, 226, 226, 227, 228, 228, 229, 229,
+  230, 230, 231, 231, 232, 233, 233, 234, 234, 235, 235, 236, 236, 237, 237, 238,
+  238, 239, 240, 240, 241, 241, 242, 242, 243, 243, 244, 244, 245, 245, 246, 246,
+  247, 247, 248, 248, 249, 249, 250, 250, 251, 251, 252, 252, 253, 253, 254, 255,
+};
+
+static inline Uint32 BlendPixel(Uint32 s, Uint32 d, const BlendFormat & f){
+  unsigned a = AlphaAdjust[(s >> f.srcAlpha) & 0xFF];
+  if (a == 0){
+    return d;
+  }
+
+  Uint32 res = 0;
+  for (int i = 0; i < 3; i++){
+    unsigned sc = (s >> f.srcShift[i]) & 0xFF;
+    unsigned dc = (d >> f.dstShift[i]) & 0xFF;
+    res |= (dc + (((sc - dc) * a) >> 8)) << f.dstShift[i];
+  }
+
+  return res | ((((d >> f.dstAlpha) & 0xFF) | a) << f.dstAlpha);
+}
+
+static void BlendRow(const Uint32 * src, Uint32 * dst, int w, const BlendFormat & f){
+  for (int x = 0; x < w; x++){
+    dst[x] = BlendPixel(src[x], dst[x], f);
+  }
+}
+
+#if defined(__SSE2__)
+// Blends 16 bit lanes. d + ((s - d) * a >> 8) is the same as
+// (d * (256 - a) + s * a) >> 8, which is never more than 255 * 256, so it
+// fits without going through 32 bits. The bit SDL_gfx carries into bit 24
+// is put back by the caller.
+static inline __m128i BlendLanes(__m128i s, __m128i d, __m128i a){
+  __m128i keep = _mm_mullo_epi16(d, _mm_sub_epi16(_mm_set1_epi16(256), a));
+  return _mm_srli_epi16(_mm_add_epi16(keep, _mm_mullo_epi16(s, a)), 8);
+}
+
+static inline __m128i Channel(__m128i v, int from, int to){
+  __m128i c = _mm_and_si128(_mm_srl_epi32(v, _mm_cvtsi32_si128(from)), _mm_set1_epi32(0xFF));
+  return _mm_sll_epi32(c, _mm_cvtsi32_si128(to));
+}
+
+static void BlendRowSSE2(const Uint32 * src, Uint32 * dst, int w, const BlendFormat & f){
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i rgbMask = _mm_set1_epi32(f.dstRGBMask);
+  const __m128i carry = _mm_set1_epi32(0x01000000);
+
+  int x = 0;
+  for (; x + 4 <= w; x += 4){
+    __m128i s = _mm_loadu_si128((const __m128i *)(src + x));
+    __m128i d = _mm_loadu_si128((const __m128i *)(dst + x));
+
+    __m128i a = Channel(s, f.srcAlpha, 0);
+    __m128i skip = _mm_cmpeq_epi32(a, zero);
+    if (_mm_movemask_epi8(skip) == 0xFFFF){
+      continue;
+    }
+
+    // SSE2 can't gather, so the table is looked up a pixel at a time
+    Uint32 alpha[4];
+    _mm_storeu_si128((__m128i *)alpha, a);
+    a = _mm_setr_epi32(AlphaAdjust[alpha[0]], AlphaAdjust[alpha[1]], AlphaAdjust[alpha[2]], AlphaAdjust[alpha[3]]);
+
+    // move the source colours to where they are in the target
+    __m128i sd = _mm_or_si128(_mm_or_si128(
+        Channel(s, f.srcShift[0], f.dstShift[0]),
+        Channel(s, f.srcShift[1], f.dstShift[1])),
+        Channel(s, f.srcShift[2], f.dstShift[2]));
+
+    // the alpha in every byte of the pixel
+    __m128i aa = _mm_or_si128(a, _mm_slli_epi32(a, 8));
+    aa = _mm_or_si128(aa, _mm_slli_epi32(aa, 16));
+
+    __m128i lo = BlendLanes(_mm_unpacklo_epi8(sd, zero), _mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(aa, zero));
+    __m128i hi = BlendLanes(_mm_unpackhi_epi8(sd, zero), _mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(aa, zero));
+
+    __m128i res = _mm_and_si128(_mm_packus_epi16(lo, hi), rgbMask);
+    res = _mm_or_si128(res, _mm_sll_epi32(_mm_or_si128(Channel(d, f.dstAlpha, 0), a), _mm_cvtsi32_si128(f.dstAlpha)));
+    if (f.lowChannel >= 0){
+      __m128i below = _mm_cmplt_epi32(Channel(s, f.srcShift[f.lowChannel], 0), Channel(d, 0, 0));
+      res = _mm_or_si128(res, _mm_and_si128(below, carry));
+    }
+
+    res = _mm_or_si128(_mm_and_si128(skip, d), _mm_andnot_si128(skip, res));
+    _mm_storeu_si128((__m128i *)(dst + x), res);
+  }
+
+  BlendRow(src + x, dst + x, w - x, f);
+}
+#endif
+
+#ifdef RUG_HAVE_AVX2_KERNEL
+__attribute__((target("avx2")))
+static inline __m256i BlendLanesAVX2(__m256i s, __m256i d, __m256i a){
+  __m256i keep = _mm256_mullo_epi16(d, _mm256_sub_epi16(_mm256_set1_epi16(256), a));
+  return _mm256_srli_epi16(_mm256_add_epi16(keep, _mm256_mullo_epi16(s, a)), 8);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i ChannelAVX2(__m256i v, int from, int to){
+  __m256i c = _mm256_and_si256(_mm256_srl_epi32(v, _mm_cvtsi32_si128(from)), _mm256_set1_epi32(0xFF));
+  return _mm256_sll_epi32(c, _mm_cvtsi32_si128(to));
+}
+
+__attribute__((target("avx2")))
+static void BlendRowAVX2(const Uint32 * src, Uint32 * dst, int w, const BlendFormat & f){
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i rgbMask = _mm256_set1_epi32(f.dstRGBMask);
+  const __m256i carry = _mm256_set1_epi32(0x01000000);
+
+  int x = 0;
+  for (; x + 8 <= w; x += 8){
+    __m256i s = _mm256_loadu_si256((const __m256i *)(src + x));
+    __m256i d = _mm256_loadu_si256((const __m256i *)(dst + x));
+
+    __m256i a = ChannelAVX2(s, f.srcAlpha, 0);
+    __m256i skip = _mm256_cmpeq_epi32(a, zero);
+    if (_mm256_movemask_epi8(skip) == -1){
+      continue;
+    }
+
+    a = _mm256_i32gather_epi32((const int *)AlphaAdjust, a, 4);
+
+    __m256i sd = _mm256_or_si256(_mm256_or_si256(
+        ChannelAVX2(s, f.srcShift[0], f.dstShift[0]),
+        ChannelAVX2(s, f.srcShift[1], f.dstShift[1])),
+        ChannelAVX2(s, f.srcShift[2], f.dstShift[2]));
+
+    __m256i aa = _mm256_or_si256(a, _mm256_slli_epi32(a, 8));
+    aa = _mm256_or_si256(aa, _mm256_slli_epi32(aa, 16));
+
+    // unpacking and packing both work within 128 bit lanes, so the
+    // pixels end up back where they started
+    __m256i lo = BlendLanesAVX2(_mm256_unpacklo_epi8(sd, zero), _mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi8(aa, zero));
+    __m256i hi = BlendLanesAVX2(_mm256_unpackhi_epi8(sd, zero), _mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi8(aa, zero));
+
+    __m256i res = _mm256_and_si256(_mm256_packus_epi16(lo, hi), rgbMask);
+    res = _mm256_or_si256(res, _mm256_sll_epi32(_mm256_or_si256(ChannelAVX2(d, f.dstAlpha, 0), a), _mm_cvtsi32_si128(f.dstAlpha)));
+    if (f.lowChannel >= 0){
+      __m256i below = _mm256_cmpgt_epi32(ChannelAVX2(d, 0, 0), ChannelAVX2(s, f.srcShift[f.lowChannel], 0));
+      res = _mm256_or_si256(res, _mm256_and_si256(below, carry));
+    }
+
+    res = _mm256_blendv_epi8(res, d, skip);
+    _mm256_storeu_si256((__m256i *)(dst + x), res);
+  }
+
+  BlendRow(src + x, dst + x, w - x, f);
+}
+#endif
+
+static BlendRowFunc GetBlendRow(){
+#ifdef RUG_HAVE_AVX2_KERNEL
+  if (CpuHasAVX2()){
+    return BlendRowAVX2;
+  }
+#endif
+#if defined(__SSE2__)
+  return BlendRowSSE2;
+#else
+  return BlendRow;
+#endif
+}
+
+// The kernels only handle 32 bit pixels with whole bytes for channels
+static bool ByteChannel(Uint32 mask, int shift, int loss){
+  return mask == (Uint32)0xFF << shift && loss == 0 && shift % 8 == 0;
+}
+
+// Opaque targets are left to SDL_gfx, which writes a pixel's unused byte
+static bool GetBlendFormat(SDL_Surface * src, SDL_Surface * dst, BlendFormat & f){
+  SDL_PixelFormat * s = src->format;
+  SDL_PixelFormat * d = dst->format;
+
+  if (s->BytesPerPixel != 4 || d->BytesPerPixel != 4 || s->Amask == 0 || d->Amask == 0){
+    return false;
+  }
+
+  if (!ByteChannel(s->Rmask, s->Rshift, s->Rloss) || !ByteChannel(s->Gmask, s->Gshift, s->Gloss) ||
+      !ByteChannel(s->Bmask, s->Bshift, s->Bloss) || !ByteChannel(s->Amask, s->Ashift, s->Aloss) ||
+      !ByteChannel(d->Rmask, d->Rshift, d->Rloss) || !ByteChannel(d->Gmask, d->Gshift, d->Gloss) ||
+      !ByteChannel(d->Bmask, d->Bshift, d->Bloss) || !ByteChannel(d->Amask, d->Ashift, d->Aloss)){
+    return false;
+  }
+
+  f.srcShift[0] = s->Rshift; f.srcShift[1] = s->Gshift; f.srcShift[2] = s->Bshift;
+  f.dstShift[0] = d->Rshift; f.dstShift[1] = d->Gshift; f.dstShift[2] = d->Bshift;
+  f.srcAlpha = s->Ashift;
+  f.dstAlpha = d->Ashift;
+  f.dstRGBMask = d->Rmask | d->Gmask | d->Bmask;
+
+  f.lowChannel = -1;
+  for (int i = 0; i < 3; i++){
+    if (f.dstShift[i] == 0){
+      f.lowChannel = i;
+    }
+  }
+
+  return true;
+}
+
+bool ClipBlit(SDL_Surface * src, SDL_Rect * srcRect, SDL_Surface * dst, SDL_Rect * dstRect,
+    SDL_Rect & from, SDL_Rect & to){
+  int sx = 0, sy = 0, w = src->w, h = src->h;
+  if (srcRect != NULL){
+    sx = srcRect->x;
+    sy = srcRect->y;
+    w = srcRect->w;
+    h = srcRect->h;
+  }
+
+  int dx = dstRect ? dstRect->x : 0;
+  int dy = dstRect ? dstRect->y : 0;
+
+  // clip to the source surface
+  if (sx < 0) { w += sx; dx -= sx; sx = 0; }
+  if (sy < 0) { h += sy; dy -= sy; sy = 0; }
+  if (sx + w > src->w) w = src->w - sx;
+  if (sy + h > src->h) h = src->h - sy;
+
+  // clip to the target's clip rectangle
+  SDL_Rect & clip = dst->clip_rect;
+  if (dx < clip.x) { int d = clip.x - dx; w -= d; sx += d; dx = clip.x; }
+  if (dy < clip.y) { int d = clip.y - dy; h -= d; sy += d; dy = clip.y; }
+  if (dx + w > clip.x + clip.w) w = clip.x + clip.w - dx;
+  if (dy + h > clip.y + clip.h) h = clip.y + clip.h - dy;
+
+  if (w <= 0 || h <= 0){
+    return false;
+  }
+
+  from.x = sx; from.y = sy; from.w = w; from.h = h;
+  to.x = dx;   to.y = dy;   to.w = w;   to.h = h;
+  return true;
+}
+
+int BlendBlit(SDL_Surface * src, SDL_Rect * srcRect, SDL_Surface * dst, SDL_Rect * dstRect){
+  BlendFormat format;
+  if (!GetBlendFormat(src, dst, format)){
+    return SDL_gfxBlitRGBA(src, srcRect, dst, dstRect);
+  }
+
+  SDL_Rect from, to;
+  if (!ClipBlit(src, srcRect, dst, dstRect, from, to)){
+    if (dstRect != NULL){
+      dstRect->w = dstRect->h = 0;
+    }
+    return 0;
+  }
+
+  static BlendRowFunc blendRow = GetBlendRow();
+
+  if (SDL_MUSTLOCK(src)) SDL_LockSurface(src);
+  if (SDL_MUSTLOCK(dst)) SDL_LockSurface(dst);
+
+  Uint8 * srcRow = (Uint8 *)src->pixels + from.y * src->pitch + from.x * 4;
+  Uint8 * dstRow = (Uint8 *)dst->pixels + to.y * dst->pitch + to.x * 4;
+  for (int y = 0; y < to.h; y++){
+    blendRow((const Uint32 *)srcRow, (Uint32 *)dstRow, to.w, format);
+    srcRow += src->pitch;
+    dstRow += dst->pitch;
+  }
+
+  if (SDL_MUSTLOCK(dst)) SDL_UnlockSurface(dst);
+  if (SDL_MUSTLOCK(src)) SDL_UnlockSurface(src);
+
+  if (dstRect != NULL){
+    *dstRect = to;
+  }
+
+  return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef RUG_BLIT_H
+#define RUG_BLIT_H
+
+#include <SDL/SDL.h>
+
+// Blends src over dst by the source alpha. It takes the same arguments as
+// SDL_gfxBlitRGBA and gives exactly the same pixels, using SIMD kernels
+// for 32 bit surfaces with alpha and handing anything else on to it.
+// test/blit_test.cpp checks the two match.
+int BlendBlit(SDL_Surface * src, SDL_Rect * srcRect, SDL_Surface * dst, SDL_Rect * dstRect);
+
+// Clips a blit the same way SDL_BlitSurface does, into from and to.
+// Returns false if there is nothing left to draw.
+bool ClipBlit(SDL_Surface * src, SDL_Rect * srcRect, SDL_Surface * dst, SDL_Rect * dstRect,
+    SDL_Rect & from, SDL_Rect & to);
+
+#endif //RUG_BLIT_H
@@ -0,0 +1,306 @@
+#include "bodies.h"
+
+#include <vector>
+
+using namespace std;
+
+VALUE cRugBodyStore, mRugNativeBody;
+
+// Body state for a whole world, one array per field so that stepping every
+// body is a single pass with no Ruby Floats made along the way
+typedef struct {
+  vector<double> x, y, vx, vy, mass, lastX, lastY;
+  vector<VALUE> bodies;
+} RugBodyStore;
+
+static ID idStore, idSlot;
+static ID idX, idY, idVX, idVY, idMass, idLastX, idLastY;
+
+static void mark_body_store(void * vp){
+  RugBodyStore * store = (RugBodyStore *)vp;
+  for (size_t i = 0; i < store->bodies.size(); i++){
+    rb_gc_mark(store->bodies[i]);
+  }
+}
+
+static void unload_body_store(void * vp){
+  delete (RugBodyStore *)vp;
+}
+
+static RugBodyStore * GetBodyStore(VALUE self){
+  RugBodyStore * store;
+  Data_Get_Struct(self, RugBodyStore, store);
+  return store;
+}
+
+static double IvarToDouble(VALUE obj, ID id){
+  VALUE v = rb_ivar_get(obj, id);
+  return v == Qnil ? 0.0 : NUM2DBL(v);
+}
+
+/*
+ * Creates an empty body store. Rug::Physics::World makes one of these when
+ * it is created with native set, there shouldn't be any need to make one
+ * by hand.
+ */
+static VALUE RugCreateBodyStore(VALUE klass){
+  RugBodyStore * store = new RugBodyStore;
+  return Data_Wrap_Struct(cRugBodyStore, mark_body_store, unload_body_store, store);
+}
+
+/*
+ * Moves a body's position, velocity and mass into the store and extends
+ * it with Rug::Physics::NativeBody so its accessors use the store.
+ */
+static VALUE RugBodyStoreAdd(VALUE self, VALUE body){
+  RugBodyStore * store = GetBodyStore(self);
+
+  if (rb_ivar_get(body, idStore) == self){
+    return body;
+  }
+
+  int slot = store->bodies.size();
+  store->bodies.push_back(body);
+  store->x.push_back(IvarToDouble(body, idX));
+  store->y.push_back(IvarToDouble(body, idY));
+  store->vx.push_back(IvarToDouble(body, idVX));
+  store->vy.push_back(IvarToDouble(body, idVY));
+  store->mass.push_back(IvarToDouble(body, idMass));
+  store->lastX.push_back(store->x.back());
+  store->lastY.push_back(store->y.back());
+
+  rb_ivar_set(body, idStore, self);
+  rb_ivar_set(body, idSlot, INT2FIX(slot));
+  rb_extend_object(body, mRugNativeBody);
+
+  return body;
+}
+
+/*
+ * Takes a body out of the store. Its state is copied back into its
+ * instance variables, so it carries on working as a plain Body.
+ */
+static VALUE RugBodyStoreRemove(VALUE self, VALUE body){
+  RugBodyStore * store = GetBodyStore(self);
+
+  if (rb_ivar_get(body, idStore) != self){
+    return Qnil;
+  }
+
+  int slot = FIX2INT(rb_ivar_get(body, idSlot));
+  rb_ivar_set(body, idX, rb_float_new(store->x[slot]));
+  rb_ivar_set(body, idY, rb_float_new(store->y[slot]));
+  rb_ivar_set(body, idVX, rb_float_new(store->vx[slot]));
+  rb_ivar_set(body, idVY, rb_float_new(store->vy[slot]));
+  rb_ivar_set(body, idMass, rb_float_new(store->mass[slot]));
+  rb_ivar_set(body, idLastX, rb_float_new(store->lastX[slot]));
+  rb_ivar_set(body, idLastY, rb_float_new(store->lastY[slot]));
+  rb_ivar_set(body, idStore, Qnil);
+
+  // the last body fills the hole
+  int last = store->bodies.size() - 1;
+  if (slot != last){
+    store->bodies[slot] = store->bodies[last];
+    store->x[slot] = store->x[last];
+    store->y[slot] = store->y[last];
+    store->vx[slot] = store->vx[last];
+    store->vy[slot] = store->vy[last];
+    store->mass[slot] = store->mass[last];
+    store->lastX[slot] = store->lastX[last];
+    store->lastY[slot] = store->lastY[last];
+    rb_ivar_set(store->bodies[slot], idSlot, INT2FIX(slot));
+  }
+
+  store->bodies.pop_back();
+  store->x.pop_back();
+  store->y.pop_back();
+  store->vx.pop_back();
+  store->vy.pop_back();
+  store->mass.pop_back();
+  store->lastX.pop_back();
+  store->lastY.pop_back();
+
+  return body;
+}
+
+/*
+ * Moves every body along by its velocity for _dt_ milliseconds,
+ * remembering where it was for revert_position.
+ */
+static VALUE RugBodyStoreIntegrate(VALUE self, VALUE rdt){
+  RugBodyStore * store = GetBodyStore(self);
+  double dt = NUM2DBL(rdt) / 1000.0;
+
+  size_t n = store->bodies.size();
+  if (n == 0){
+    return self;
+  }
+
+  double * x = &store->x[0], * y = &store->y[0];
+  double * vx = &store->vx[0], * vy = &store->vy[0];
+  double * lastX = &store->lastX[0], * lastY = &store->lastY[0];
+
+  for (size_t i = 0; i < n; i++){
+    lastX[i] = x[i];
+    lastY[i] = y[i];
+    x[i] += vx[i] * dt;
+    y[i] += vy[i] * dt;
+  }
+
+  return self;
+}
+
+/*
+ * Accelerates every body with mass downwards by _gravity_ for _dt_
+ * milliseconds. Massless bodies aren't affected, like Body#apply_force.
+ */
+static VALUE RugBodyStoreApplyGravity(VALUE self, VALUE gravity, VALUE rdt){
+  RugBodyStore * store = GetBodyStore(self);
+  double dv = NUM2DBL(gravity) * NUM2DBL(rdt) / 1000.0;
+
+  size_t n = store->bodies.size();
+  for (size_t i = 0; i < n; i++){
+    if (store->mass[i] != 0){
+      store->vy[i] += dv;
+    }
+  }
+
+  return self;
+}
+
+/*
+ * Gets the number of bodies in the store.
+ */
+static VALUE RugBodyStoreSize(VALUE self){
+  return INT2FIX(GetBodyStore(self)->bodies.size());
+}
+
+// Finds the store and slot of a native body, or returns NULL if it has been
+// taken out of its store and uses its instance variables again
+static RugBodyStore * BodySlot(VALUE body, int & slot){
+  VALUE store = rb_ivar_get(body, idStore);
+  if (store == Qnil){
+    return NULL;
+  }
+
+  slot = FIX2INT(rb_ivar_get(body, idSlot));
+  return GetBodyStore(store);
+}
+
+#define NATIVE_BODY_FIELD(name, field, id)                         \
+  static VALUE RugNativeBodyGet##name(VALUE self){                 \
+    int slot;                                                      \
+    RugBodyStore * store = BodySlot(self, slot);                   \
+    if (store == NULL){                                            \
+      return rb_ivar_get(self, id);                                \
+    }                                                              \
+    return rb_float_new(store->field[slot]);                       \
+  }                                                                \
+  static VALUE RugNativeBodySet##name(VALUE self, VALUE value){     \
+    int slot;                                                      \
+    RugBodyStore * store = BodySlot(self, slot);                   \
+    if (store == NULL){                                            \
+      return rb_ivar_set(self, id, value);                         \
+    }                                                              \
+    store->field[slot] = NUM2DBL(value);                           \
+    return value;                                                  \
+  }
+
+NATIVE_BODY_FIELD(X, x, idX)
+NATIVE_BODY_FIELD(Y, y, idY)
+NATIVE_BODY_FIELD(VX, vx, idVX)
+NATIVE_BODY_FIELD(VY, vy, idVY)
+NATIVE_BODY_FIELD(Mass, mass, idMass)
+
+/*
+ * Gets where the body was before the world last moved it.
+ */
+static VALUE RugNativeBodyGetLastX(VALUE self){
+  int slot;
+  RugBodyStore * store = BodySlot(self, slot);
+  return store ? rb_float_new(store->lastX[slot]) : rb_ivar_get(self, idLastX);
+}
+
+/*
+ * Gets where the body was before the world last moved it.
+ */
+static VALUE RugNativeBodyGetLastY(VALUE self){
+  int slot;
+  RugBodyStore * store = BodySlot(self, slot);
+  return store ? rb_float_new(store->lastY[slot]) : rb_ivar_get(self, idLastY);
+}
+
+/*
+ * Bodies in a native world are moved by the world before their update
+ * is called, so this only checks for collisions.
+ */
+static VALUE RugNativeBodyUpdateBody(VALUE self, VALUE dt){
+  int slot;
+  if (BodySlot(self, slot) == NULL){
+    return rb_call_super(1, &dt);
+  }
+
+  VALUE world = rb_ivar_get(self, rb_intern("@world"));
+  return rb_funcall(world, rb_intern("check_for_collision"), 1, self);
+}
+
+/*
+ * Same as Body#apply_force.
+ */
+static VALUE RugNativeBodyApplyForce(VALUE self, VALUE fx, VALUE fy){
+  int slot;
+  RugBodyStore * store = BodySlot(self, slot);
+  if (store == NULL){
+    VALUE args[2] = {fx, fy};
+    return rb_call_super(2, args);
+  }
+
+  double mass = store->mass[slot];
+  if (mass != 0){
+    store->vx[slot] += NUM2DBL(fx) / mass;
+    store->vy[slot] += NUM2DBL(fy) / mass;
+  }
+
+  return Qnil;
+}
+
+void LoadBodies(VALUE mRug){
+  VALUE mPhysics = rb_define_module_under(mRug, "Physics");
+
+  idStore = rb_intern("@body_store");
+  idSlot = rb_intern("@body_slot");
+  idX = rb_intern("@x");
+  idY = rb_intern("@y");
+  idVX = rb_intern("@vx");
+  idVY = rb_intern("@vy");
+  idMass = rb_intern("@mass");
+  idLastX = rb_intern("@last_x");
+  idLastY = rb_intern("@last_y");
+
+  cRugBodyStore = rb_define_class_under(mPhysics, "BodyStore", rb_cObject);
+
+  rb_define_singleton_method(cRugBodyStore, "new", (VALUE (*)(...))RugCreateBodyStore, 0);
+  rb_define_method(cRugBodyStore, "add",           (VALUE (*)(...))RugBodyStoreAdd,          1);
+  rb_define_method(cRugBodyStore, "remove",        (VALUE (*)(...))RugBodyStoreRemove,       1);
+  rb_define_method(cRugBodyStore, "integrate",     (VALUE (*)(...))RugBodyStoreIntegrate,    1);
+  rb_define_method(cRugBodyStore, "apply_gravity", (VALUE (*)(...))RugBodyStoreApplyGravity, 2);
+  rb_define_method(cRugBodyStore, "size",          (VALUE (*)(...))RugBodyStoreSize,         0);
+
+  mRugNativeBody = rb_define_module_under(mPhysics, "NativeBody");
+
+  rb_define_method(mRugNativeBody, "x",      (VALUE (*)(...))RugNativeBodyGetX,        0);
+  rb_define_method(mRugNativeBody, "x=",     (VALUE (*)(...))RugNativeBodySetX,        1);
+  rb_define_method(mRugNativeBody, "y",      (VALUE (*)(...))RugNativeBodyGetY,        0);
+  rb_define_method(mRugNativeBody, "y=",     (VALUE (*)(...))RugNativeBodySetY,        1);
+  rb_define_method(mRugNativeBody, "vx",     (VALUE (*)(...))RugNativeBodyGetVX,       0);
+  rb_define_method(mRugNativeBody, "vx=",    (VALUE (*)(...))RugNativeBodySetVX,       1);
+  rb_define_method(mRugNativeBody, "vy",     (VALUE (*)(...))RugNativeBodyGetVY,       0);
+  rb_define_method(mRugNativeBody, "vy=",    (VALUE (*)(...))RugNativeBodySetVY,       1);
+  rb_define_method(mRugNativeBody, "mass",   (VALUE (*)(...))RugNativeBodyGetMass,     0);
+  rb_define_method(mRugNativeBody, "mass=",  (VALUE (*)(...))RugNativeBodySetMass,     1);
+  rb_define_method(mRugNativeBody, "last_x", (VALUE (*)(...))RugNativeBodyGetLastX,    0);
+  rb_define_method(mRugNativeBody, "last_y", (VALUE (*)(...))RugNativeBodyGetLastY,    0);
+
+  rb_define_method(mRugNativeBody, "update_body", (VALUE (*)(...))RugNativeBodyUpdateBody,  1);
+  rb_define_method(mRugNativeBody, "apply_force", (VALUE (*)(...))RugNativeBodyApplyForce,  2);
+}
@@ -0,0 +1,8 @@
+#ifndef RUG_BODIES_H
+#define RUG_BODIES_H
+
+#include "ruby.h"
+
+void LoadBodies(VALUE);
+
+#endif //RUG_BODIES_H
@@ -0,0 +1,427 @@
+#include "chunked.h"
+#include "image.h"
+#include "binio.h"
+
+#include <SDL/SDL.h>
+#include <SDL/SDL_image.h>
+#include <stdio.h>
+#include <limits.h>
+#include <algorithm>
+#include <list>
+#include <vector>
+
+using namespace std;
+
+VALUE cRugChunkedImage;
+
+extern SDL_Surface * mainWnd;
+
+static const Uint32 CHUNK_MAGIC   = 0x4b434752; // "RGCK"
+static const Uint32 CHUNK_VERSION = 2;
+static const long CHUNK_HEADER_SIZE = 6 * 4;
+
+// Version 1 files have no flags, and are read as having alpha
+static const long CHUNK_V1_HEADER_SIZE = 5 * 4;
+
+// Set in the header if the image had no alpha or colour key
+static const Uint32 CHUNK_OPAQUE = 1;
+
+// Limits on what a chunk file can say, so that nothing worked out from
+// its header can overflow
+static const Uint32 MAX_CHUNK_SIZE = 4096;
+static const Uint32 MAX_IMAGE_SIZE = 1 << 20;
+static const Uint64 MAX_CHUNKS = 1 << 20;
+
+// At most this many chunks that aren't visible yet are read per draw
+static const int PREFETCH_PER_DRAW = 2;
+
+// Chunks are stored as RGBA bytes, which is this on the surface
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+#define CHUNK_RGB_MASKS  0x000000FF, 0x0000FF00, 0x00FF0000
+#define CHUNK_ALPHA_MASK 0xFF000000
+#else
+#define CHUNK_RGB_MASKS  0xFF000000, 0x00FF0000, 0x0000FF00
+#define CHUNK_ALPHA_MASK 0x000000FF
+#endif
+
+typedef struct {
+  SDL_Surface * surface; // NULL if it isn't in memory
+  list<int>::iterator lru;
+  unsigned long lastDrawn;
+} RugChunk;
+
+// Every chunk in the file takes up chunkSize * chunkSize pixels, even
+// the ones on the right and bottom edges, so they can be found without
+// an index
+typedef struct {
+  FILE * file;
+  long headerSize;
+  bool opaque;
+  int width, height, chunkSize;
+  int chunksAcross, chunksDown;
+
+  vector<RugChunk> chunks;
+  list<int> resident; // most recently used first
+  long residentBytes, budget;
+
+  unsigned long draws;
+  int lastLeft, lastTop;
+} RugChunkedImage;
+
+static void FreeChunk(RugChunkedImage * image, int index){
+  RugChunk & chunk = image->chunks[index];
+  image->residentBytes -= (long)chunk.surface->pitch * chunk.surface->h;
+  SDL_FreeSurface(chunk.surface);
+  chunk.surface = NULL;
+  image->resident.erase(chunk.lru);
+}
+
+static void unload_chunked_image(void * vp){
+  RugChunkedImage * image = (RugChunkedImage *)vp;
+  while (!image->resident.empty()){
+    FreeChunk(image, image->resident.front());
+  }
+  if (image->file != NULL){
+    fclose(image->file);
+  }
+  delete image;
+}
+
+static int ChunkWidth(RugChunkedImage * image, int cx){
+  return min(image->chunkSize, image->width - cx * image->chunkSize);
+}
+
+static int ChunkHeight(RugChunkedImage * image, int cy){
+  return min(image->chunkSize, image->height - cy * image->chunkSize);
+}
+
+// Reads a chunk from the file if it isn't in memory already, and throws
+// away the least recently used chunks that weren't drawn this time if
+// that goes over the budget
+static SDL_Surface * PageIn(RugChunkedImage * image, int index){
+  RugChunk & chunk = image->chunks[index];
+  chunk.lastDrawn = image->draws;
+
+  if (chunk.surface != NULL){
+    image->resident.splice(image->resident.begin(), image->resident, chunk.lru);
+    return chunk.surface;
+  }
+
+  int cx = index % image->chunksAcross, cy = index / image->chunksAcross;
+  int w = ChunkWidth(image, cx), h = ChunkHeight(image, cy);
+
+  // the alpha bytes of an opaque image are left out, so the chunk is
+  // converted to the screen's format without alpha
+  SDL_Surface * surface = SDL_CreateRGBSurface(SDL_SWSURFACE, w, h, 32, CHUNK_RGB_MASKS,
+      image->opaque ? 0 : CHUNK_ALPHA_MASK);
+  if (surface == NULL){
+    return NULL;
+  }
+
+  long rowBytes = (long)image->chunkSize * 4;
+  long offset = image->headerSize + (long)index * rowBytes * image->chunkSize;
+
+  bool ok = fseek(image->file, offset, SEEK_SET) == 0;
+  for (int y = 0; y < h && ok; y++){
+    ok = fread((Uint8 *)surface->pixels + y * surface->pitch, 4, w, image->file) == (size_t)w &&
+      (w == image->chunkSize || fseek(image->file, rowBytes - w * 4, SEEK_CUR) == 0);
+  }
+
+  if (!ok){
+    SDL_FreeSurface(surface);
+    return NULL;
+  }
+
+  chunk.surface = ConvertToDisplay(surface);
+  image->resident.push_front(index);
+  chunk.lru = image->resident.begin();
+  image->residentBytes += (long)chunk.surface->pitch * chunk.surface->h;
+
+  while (image->residentBytes > image->budget){
+    int oldest = image->resident.back();
+    if (image->chunks[oldest].lastDrawn == image->draws){
+      break;
+    }
+    FreeChunk(image, oldest);
+  }
+
+  return chunk.surface;
+}
+
+/*
+ * Cuts the image in _filename_ up into _chunk_size_ square chunks (256
+ * by default) and saves them to _chunk_filename_, which can then be
+ * opened with Rug::ChunkedImage.new. This only needs doing once, when the
+ * image changes.
+ */
+static VALUE RugChunkedImageBuild(int argc, VALUE * argv, VALUE klass){
+  VALUE filename, chunkFilename, rchunkSize;
+  rb_scan_args(argc, argv, "21", &filename, &chunkFilename, &rchunkSize);
+
+  int chunkSize = (rchunkSize == Qnil) ? 256 : NUM2INT(rchunkSize);
+  if (chunkSize <= 0 || chunkSize > (int)MAX_CHUNK_SIZE){
+    rb_raise(rb_eArgError, "chunk size must be from 1 to %d", (int)MAX_CHUNK_SIZE);
+  }
+
+  SDL_Surface * source = IMG_Load(STR2CSTR(filename));
+  if (source == NULL){
+    rb_raise(rb_eIOError, "Unable to load image: %s", STR2CSTR(filename));
+  }
+
+  FILE * f = fopen(STR2CSTR(chunkFilename), "wb");
+  if (f == NULL){
+    SDL_FreeSurface(source);
+    rb_raise(rb_eIOError, "Unable to save chunks: %s", STR2CSTR(chunkFilename));
+  }
+
+  bool opaque = source->format->Amask == 0 && !(source->flags & SDL_SRCCOLORKEY);
+
+  WriteUint32(f, CHUNK_MAGIC);
+  WriteUint32(f, CHUNK_VERSION);
+  WriteUint32(f, source->w);
+  WriteUint32(f, source->h);
+  WriteUint32(f, chunkSize);
+  WriteUint32(f, opaque ? CHUNK_OPAQUE : 0);
+
+  // copy the pixels as they are, including alpha
+  SDL_SetAlpha(source, 0, 255);
+
+  SDL_Surface * chunk = SDL_CreateRGBSurface(SDL_SWSURFACE, chunkSize, chunkSize, 32, CHUNK_RGB_MASKS, CHUNK_ALPHA_MASK);
+
+  for (int cy = 0; cy * chunkSize < source->h; cy++){
+    for (int cx = 0; cx * chunkSize < source->w; cx++){
+      SDL_FillRect(chunk, NULL, 0);
+
+      SDL_Rect src;
+      src.x = cx * chunkSize;
+      src.y = cy * chunkSize;
+      src.w = src.h = chunkSize;
+      SDL_BlitSurface(source, &src, chunk, NULL);
+
+      for (int y = 0; y < chunkSize; y++){
+        fwrite((Uint8 *)chunk->pixels + y * chunk->pitch, 4, chunkSize, f);
+      }
+    }
+  }
+
+  SDL_FreeSurface(chunk);
+  SDL_FreeSurface(source);
+  fclose(f);
+
+  return Qnil;
+}
+
+/*
+ * Opens an image that was cut up with Rug::ChunkedImage.build. Only the
+ * chunks that are drawn are read from the disk, along with a couple of
+ * chunks ahead in the direction the view is moving. When the chunks in
+ * memory take up more than _budget_ megabytes (64 by default), the ones
+ * that haven't been drawn for longest are thrown away again.
+ *
+ * Chunks are read while drawing, so a frame that needs chunks that aren't
+ * in memory waits for the disk. Prefetching ahead keeps that rare when
+ * scrolling steadily.
+ *
+ * It draws like a Rug::Layer, so it can be the background of a
+ * Rug::ScrollView.
+ *
+ * Usage:
+ *
+ *    Rug::ChunkedImage.build "level1.png", "level1.chunks" unless File.exist? "level1.chunks"
+ *    view = Rug::ScrollView.new Rug::ChunkedImage.new("level1.chunks")
+ */
+static VALUE RugCreateChunkedImage(int argc, VALUE * argv, VALUE klass){
+  VALUE filename, budget;
+  rb_scan_args(argc, argv, "11", &filename, &budget);
+
+  FILE * f = fopen(STR2CSTR(filename), "rb");
+  if (f == NULL){
+    rb_raise(rb_eIOError, "Unable to load chunks: %s", STR2CSTR(filename));
+  }
+
+  Uint32 magic, version, width, height, chunkSize, flags = 0;
+  if (!ReadUint32(f, magic) || !ReadUint32(f, version) || magic != CHUNK_MAGIC ||
+      (version != 1 && version != CHUNK_VERSION) ||
+      !ReadUint32(f, width) || !ReadUint32(f, height) || !ReadUint32(f, chunkSize) || chunkSize == 0 ||
+      (version == CHUNK_VERSION && !ReadUint32(f, flags))){
+    fclose(f);
+    rb_raise(rb_eIOError, "Not a Rug chunked image: %s", STR2CSTR(filename));
+  }
+
+  // worked out in 64 bits, so a bad header can't wrap around
+  Uint64 chunksAcross = ((Uint64)width + chunkSize - 1) / chunkSize;
+  Uint64 chunksDown = ((Uint64)height + chunkSize - 1) / chunkSize;
+
+  if (width > MAX_IMAGE_SIZE || height > MAX_IMAGE_SIZE || chunkSize > MAX_CHUNK_SIZE ||
+      chunksAcross * chunksDown > MAX_CHUNKS ||
+      chunksAcross * chunksDown * chunkSize * chunkSize * 4 > (Uint64)(LONG_MAX - CHUNK_HEADER_SIZE)){
+    fclose(f);
+    rb_raise(rb_eIOError, "Chunked image is too big: %s", STR2CSTR(filename));
+  }
+
+  long budgetMB = (budget == Qnil) ? 64 : NUM2LONG(budget);
+  if (budgetMB < 0){
+    fclose(f);
+    rb_raise(rb_eArgError, "the budget can't be negative");
+  }
+
+  RugChunkedImage * image = new RugChunkedImage;
+  image->file = f;
+  image->headerSize = (version == 1) ? CHUNK_V1_HEADER_SIZE : CHUNK_HEADER_SIZE;
+  image->opaque = (flags & CHUNK_OPAQUE) != 0;
+  image->width = width;
+  image->height = height;
+  image->chunkSize = chunkSize;
+  image->chunksAcross = chunksAcross;
+  image->chunksDown = chunksDown;
+  image->residentBytes = 0;
+  image->budget = min(budgetMB, LONG_MAX / (1024 * 1024)) * 1024 * 1024;
+  image->draws = 0;
+  image->lastLeft = image->lastTop = 0;
+
+  RugChunk empty;
+  empty.surface = NULL;
+  empty.lastDrawn = 0;
+  image->chunks.resize(image->chunksAcross * image->chunksDown, empty);
+
+  return Data_Wrap_Struct(cRugChunkedImage, NULL, unload_chunked_image, image);
+}
+
+// Reads chunks just outside the view on the side it is moving towards
+static void Prefetch(RugChunkedImage * image, int firstCol, int lastCol, int firstRow, int lastRow, int dx, int dy){
+  int budget = PREFETCH_PER_DRAW;
+
+  int col = (dx > 0) ? lastCol + 1 : firstCol - 1;
+  if (dx != 0 && col >= 0 && col < image->chunksAcross){
+    for (int row = firstRow; row <= lastRow && budget > 0; row++){
+      int index = row * image->chunksAcross + col;
+      if (image->chunks[index].surface == NULL){
+        PageIn(image, index);
+        budget--;
+      }
+    }
+  }
+
+  int row = (dy > 0) ? lastRow + 1 : firstRow - 1;
+  if (dy != 0 && row >= 0 && row < image->chunksDown){
+    for (int col = firstCol; col <= lastCol && budget > 0; col++){
+      int index = row * image->chunksAcross + col;
+      if (image->chunks[index].surface == NULL){
+        PageIn(image, index);
+        budget--;
+      }
+    }
+  }
+}
+
+/*
+ * Draws the image, taking the same arguments as Rug::Layer#draw.
+ */
+static VALUE RugChunkedImageDraw(int argc, VALUE * argv, VALUE self){
+  if (mainWnd == NULL){
+    return Qnil;
+  }
+
+  VALUE x, y, width, height, sx, sy, targetLayer;
+  rb_scan_args(argc, argv, "07", &x, &y, &width, &height, &sx, &sy, &targetLayer);
+
+  if (TYPE(width) != T_FIXNUM && TYPE(width) != T_BIGNUM){
+    targetLayer = width;
+    width = Qnil;
+  }
+
+  RugChunkedImage * image;
+  Data_Get_Struct(self, RugChunkedImage, image);
+
+  int dstX = (x == Qnil) ? 0 : NUM2INT(x);
+  int dstY = (y == Qnil) ? 0 : NUM2INT(y);
+  int left = 0, top = 0, w = image->width, h = image->height;
+
+  if (width != Qnil){
+    left = (sx == Qnil) ? 0 : NUM2INT(sx);
+    top  = (sy == Qnil) ? 0 : NUM2INT(sy);
+    w = NUM2INT(width);
+    h = (height == Qnil) ? w : NUM2INT(height);
+  }
+
+  // keep to the image
+  if (left < 0) { w += left; dstX -= left; left = 0; }
+  if (top < 0)  { h += top;  dstY -= top;  top = 0; }
+  w = min(w, image->width - left);
+  h = min(h, image->height - top);
+  if (w <= 0 || h <= 0){
+    return Qnil;
+  }
+
+  image->draws++;
+
+  int size = image->chunkSize;
+  int firstCol = left / size, lastCol = (left + w - 1) / size;
+  int firstRow = top / size,  lastRow = (top + h - 1) / size;
+
+  for (int row = firstRow; row <= lastRow; row++){
+    for (int col = firstCol; col <= lastCol; col++){
+      SDL_Surface * chunk = PageIn(image, row * image->chunksAcross + col);
+      if (chunk == NULL){
+        continue;
+      }
+
+      // the part of this chunk that is in view
+      int x0 = max(left, col * size), x1 = min(left + w, col * size + chunk->w);
+      int y0 = max(top, row * size),  y1 = min(top + h, row * size + chunk->h);
+
+      SDL_Rect src;
+      src.x = x0 - col * size;
+      src.y = y0 - row * size;
+      src.w = x1 - x0;
+      src.h = y1 - y0;
+
+      DrawSurface(chunk, &src, dstX + x0 - left, dstY + y0 - top, targetLayer);
+    }
+  }
+
+  Prefetch(image, firstCol, lastCol, firstRow, lastRow, left - image->lastLeft, top - image->lastTop);
+  image->lastLeft = left;
+  image->lastTop = top;
+
+  return Qnil;
+}
+
+/*
+ * Gets the width of the image.
+ */
+static VALUE RugChunkedImageWidth(VALUE self){
+  RugChunkedImage * image;
+  Data_Get_Struct(self, RugChunkedImage, image);
+  return INT2FIX(image->width);
+}
+
+/*
+ * Gets the height of the image.
+ */
+static VALUE RugChunkedImageHeight(VALUE self){
+  RugChunkedImage * image;
+  Data_Get_Struct(self, RugChunkedImage, image);
+  return INT2FIX(image->height);
+}
+
+/*
+ * Gets the number of bytes of chunks that are in memory.
+ */
+static VALUE RugChunkedImageResident(VALUE self){
+  RugChunkedImage * image;
+  Data_Get_Struct(self, RugChunkedImage, image);
+  return LONG2NUM(image->residentBytes);
+}
+
+void LoadChunkedImage(VALUE mRug){
+  cRugChunkedImage = rb_define_class_under(mRug, "ChunkedImage", rb_cObject);
+
+  rb_define_singleton_method(cRugChunkedImage, "new",   (VALUE (*)(...))RugCreateChunkedImage, -1);
+  rb_define_singleton_method(cRugChunkedImage, "build", (VALUE (*)(...))RugChunkedImageBuild,  -1);
+
+  rb_define_method(cRugChunkedImage, "draw",           (VALUE (*)(...))RugChunkedImageDraw,    -1);
+  rb_define_method(cRugChunkedImage, "width",          (VALUE (*)(...))RugChunkedImageWidth,    0);
+  rb_define_method(cRugChunkedImage, "height",         (VALUE (*)(...))RugChunkedImageHeight,   0);
+  rb_define_method(cRugChunkedImage, "resident_bytes", (VALUE (*)(...))RugChunkedImageResident, 0);
+}
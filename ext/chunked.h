@@ -0,0 +1,8 @@
+#ifndef RUG_CHUNKED_H
+#define RUG_CHUNKED_H
+
+#include "ruby.h"
+
+void LoadChunkedImage(VALUE);
+
+#endif //RUG_CHUNKED_H
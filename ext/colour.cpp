@@ -0,0 +1,302 @@
+#include "colour.h"
+
+#include <stdio.h>
+
+VALUE cRugColour;
+
+// A colour is just its packed 0xRRGGBBAA value, so reading it from C is
+// one pointer dereference instead of four instance variable lookups
+typedef struct {
+  Uint32 rgba;
+} RugColour;
+
+static void unload_colour(void * vp){
+  free(vp);
+}
+
+static VALUE RugColourAlloc(VALUE klass){
+  RugColour * colour = ALLOC(RugColour);
+  colour->rgba = GfxColour(0, 0, 0, 255);
+  return Data_Wrap_Struct(klass, NULL, unload_colour, colour);
+}
+
+static VALUE NewColour(Uint32 rgba){
+  VALUE rColour = RugColourAlloc(cRugColour);
+  RugColour * colour;
+  Data_Get_Struct(rColour, RugColour, colour);
+  colour->rgba = rgba;
+  return rColour;
+}
+
+static inline bool IsColour(VALUE obj){
+  return TYPE(obj) == T_DATA && RDATA(obj)->dfree == unload_colour;
+}
+
+static inline Uint32 GetRGBA(VALUE self){
+  RugColour * colour;
+  Data_Get_Struct(self, RugColour, colour);
+  return colour->rgba;
+}
+
+static inline Uint8 Channel(Uint32 rgba, int shift){
+  return (rgba >> shift) & 0xFF;
+}
+
+static inline Uint8 Clamp(double v){
+  return v <= 0.0 ? 0 : (v >= 255.0 ? 255 : (Uint8)(v + 0.5));
+}
+
+Uint32 ColourToGfx(VALUE colour){
+  if (IsColour(colour)){
+    return GetRGBA(colour);
+  }else if (FIXNUM_P(colour) || TYPE(colour) == T_BIGNUM){
+    return NUM2UINT(colour);
+  }
+
+  rb_raise(rb_eTypeError, "expected a Rug::Colour or a number, got %s", rb_obj_classname(colour));
+  return 0;
+}
+
+// Conversions are keyed on the masks rather than the format pointer, since
+// a freed surface's format can be reused for a different one. Paletted
+// formats depend on the palette as well and aren't cached.
+typedef struct {
+  Uint32 rgba;
+  Uint32 rmask, gmask, bmask, amask;
+  Uint32 pixel;
+  bool used;
+} MappedColour;
+
+static const int MAPPED_CACHE_SIZE = 64;
+static MappedColour mappedCache[MAPPED_CACHE_SIZE];
+
+Uint32 MapGfxColour(SDL_PixelFormat * format, Uint32 rgba){
+  if (format->palette != NULL){
+    return SDL_MapRGBA(format, Channel(rgba, 24), Channel(rgba, 16), Channel(rgba, 8), Channel(rgba, 0));
+  }
+
+  Uint32 hash = (rgba * 2654435761u) ^ format->Rmask ^ (format->Amask >> 7);
+  MappedColour & m = mappedCache[(hash >> 8) % MAPPED_CACHE_SIZE];
+
+  if (!m.used || m.rgba != rgba || m.rmask != format->Rmask || m.gmask != format->Gmask ||
+      m.bmask != format->Bmask || m.amask != format->Amask){
+    m.rgba = rgba;
+    m.rmask = format->Rmask;
+    m.gmask = format->Gmask;
+    m.bmask = format->Bmask;
+    m.amask = format->Amask;
+    m.pixel = SDL_MapRGBA(format, Channel(rgba, 24), Channel(rgba, 16), Channel(rgba, 8), Channel(rgba, 0));
+    m.used = true;
+  }
+
+  return m.pixel;
+}
+
+/*
+ * Creates a new colour. Each channel is from 0 to 255.
+ *
+ * _r_, _g_, _b_: The red, green and blue channels
+ * _a_: Optional. The alpha channel, 255 (opaque) by default
+ */
+static VALUE RugColourInit(int argc, VALUE * argv, VALUE self){
+  VALUE r, g, b, a;
+  rb_scan_args(argc, argv, "31", &r, &g, &b, &a);
+
+  RugColour * colour;
+  Data_Get_Struct(self, RugColour, colour);
+  colour->rgba = GfxColour(NUM2INT(r), NUM2INT(g), NUM2INT(b), a == Qnil ? 255 : NUM2INT(a));
+
+  return self;
+}
+
+static VALUE RugColourInitCopy(VALUE self, VALUE other){
+  RugColour * colour;
+  Data_Get_Struct(self, RugColour, colour);
+  colour->rgba = ColourToGfx(other);
+  return self;
+}
+
+/*
+ * Creates a colour from a packed 0xRRGGBBAA number.
+ */
+static VALUE RugColourFromInt(VALUE klass, VALUE rgba){
+  return NewColour(NUM2UINT(rgba));
+}
+
+static VALUE SetChannel(VALUE self, int shift, VALUE value){
+  rb_check_frozen(self);
+
+  RugColour * colour;
+  Data_Get_Struct(self, RugColour, colour);
+  colour->rgba = (colour->rgba & ~(0xFFu << shift)) | ((Uint32)(NUM2INT(value) & 0xFF) << shift);
+
+  return value;
+}
+
+/*
+ * Gets the red channel.
+ */
+static VALUE RugColourR(VALUE self){
+  return INT2FIX(Channel(GetRGBA(self), 24));
+}
+
+/*
+ * Gets the green channel.
+ */
+static VALUE RugColourG(VALUE self){
+  return INT2FIX(Channel(GetRGBA(self), 16));
+}
+
+/*
+ * Gets the blue channel.
+ */
+static VALUE RugColourB(VALUE self){
+  return INT2FIX(Channel(GetRGBA(self), 8));
+}
+
+/*
+ * Gets the alpha channel.
+ */
+static VALUE RugColourA(VALUE self){
+  return INT2FIX(Channel(GetRGBA(self), 0));
+}
+
+/*
+ * Sets the red channel.
+ */
+static VALUE RugColourSetR(VALUE self, VALUE value){
+  return SetChannel(self, 24, value);
+}
+
+/*
+ * Sets the green channel.
+ */
+static VALUE RugColourSetG(VALUE self, VALUE value){
+  return SetChannel(self, 16, value);
+}
+
+/*
+ * Sets the blue channel.
+ */
+static VALUE RugColourSetB(VALUE self, VALUE value){
+  return SetChannel(self, 8, value);
+}
+
+/*
+ * Sets the alpha channel.
+ */
+static VALUE RugColourSetA(VALUE self, VALUE value){
+  return SetChannel(self, 0, value);
+}
+
+/*
+ * Gets the colour packed as a 0xRRGGBBAA number, which every method that
+ * takes a colour also accepts.
+ */
+static VALUE RugColourToInt(VALUE self){
+  return UINT2NUM(GetRGBA(self));
+}
+
+/*
+ * Gets a colour partway between this one and _other_, including alpha.
+ *
+ * _t_: 0.0 gives this colour, 1.0 gives _other_
+ */
+static VALUE RugColourLerp(VALUE self, VALUE other, VALUE rt){
+  Uint32 a = GetRGBA(self), b = ColourToGfx(other);
+  double t = NUM2DBL(rt);
+  t = t < 0.0 ? 0.0 : (t > 1.0 ? 1.0 : t);
+
+  Uint32 rgba = 0;
+  for (int shift = 0; shift < 32; shift += 8){
+    double from = Channel(a, shift), to = Channel(b, shift);
+    rgba |= (Uint32)Clamp(from + (to - from) * t) << shift;
+  }
+
+  return NewColour(rgba);
+}
+
+/*
+ * Multiplies the colour, for tinting. Multiplying by another colour
+ * multiplies each channel, so white leaves a colour as it is. Multiplying
+ * by a number scales red, green and blue, leaving alpha alone.
+ */
+static VALUE RugColourMultiply(VALUE self, VALUE other){
+  Uint32 a = GetRGBA(self);
+  Uint32 rgba = 0;
+
+  if (IsColour(other)){
+    Uint32 b = GetRGBA(other);
+    for (int shift = 0; shift < 32; shift += 8){
+      rgba |= (Uint32)((Channel(a, shift) * Channel(b, shift) + 127) / 255) << shift;
+    }
+  }else{
+    double s = NUM2DBL(other);
+    for (int shift = 8; shift < 32; shift += 8){
+      rgba |= (Uint32)Clamp(Channel(a, shift) * s) << shift;
+    }
+    rgba |= Channel(a, 0);
+  }
+
+  return NewColour(rgba);
+}
+
+static VALUE RugColourEqual(VALUE self, VALUE other){
+  return (IsColour(other) && GetRGBA(self) == GetRGBA(other)) ? Qtrue : Qfalse;
+}
+
+static VALUE RugColourHash(VALUE self){
+  return UINT2NUM(GetRGBA(self));
+}
+
+static VALUE RugColourInspect(VALUE self){
+  Uint32 rgba = GetRGBA(self);
+  char buf[64];
+  snprintf(buf, sizeof(buf), "#<Rug::Colour %d, %d, %d, %d>",
+           Channel(rgba, 24), Channel(rgba, 16), Channel(rgba, 8), Channel(rgba, 0));
+  return rb_str_new2(buf);
+}
+
+static void DefineColour(const char * name, Uint8 r, Uint8 g, Uint8 b, Uint8 a){
+  rb_define_const(cRugColour, name, rb_obj_freeze(NewColour(GfxColour(r, g, b, a))));
+}
+
+void LoadColour(VALUE mRug){
+  cRugColour = rb_define_class_under(mRug, "Colour", rb_cObject);
+  rb_define_alloc_func(cRugColour, RugColourAlloc);
+
+  rb_define_singleton_method(cRugColour, "from_i", (VALUE (*)(...))RugColourFromInt, 1);
+
+  rb_define_method(cRugColour, "initialize", (VALUE (*)(...))RugColourInit, -1);
+  rb_define_method(cRugColour, "initialize_copy", (VALUE (*)(...))RugColourInitCopy, 1);
+
+  rb_define_method(cRugColour, "r", (VALUE (*)(...))RugColourR, 0);
+  rb_define_method(cRugColour, "g", (VALUE (*)(...))RugColourG, 0);
+  rb_define_method(cRugColour, "b", (VALUE (*)(...))RugColourB, 0);
+  rb_define_method(cRugColour, "a", (VALUE (*)(...))RugColourA, 0);
+  rb_define_method(cRugColour, "r=", (VALUE (*)(...))RugColourSetR, 1);
+  rb_define_method(cRugColour, "g=", (VALUE (*)(...))RugColourSetG, 1);
+  rb_define_method(cRugColour, "b=", (VALUE (*)(...))RugColourSetB, 1);
+  rb_define_method(cRugColour, "a=", (VALUE (*)(...))RugColourSetA, 1);
+
+  rb_define_method(cRugColour, "to_i", (VALUE (*)(...))RugColourToInt, 0);
+  rb_define_method(cRugColour, "lerp", (VALUE (*)(...))RugColourLerp, 2);
+  rb_define_method(cRugColour, "*", (VALUE (*)(...))RugColourMultiply, 1);
+
+  rb_define_method(cRugColour, "==", (VALUE (*)(...))RugColourEqual, 1);
+  rb_define_method(cRugColour, "eql?", (VALUE (*)(...))RugColourEqual, 1);
+  rb_define_method(cRugColour, "hash", (VALUE (*)(...))RugColourHash, 0);
+  rb_define_method(cRugColour, "inspect", (VALUE (*)(...))RugColourInspect, 0);
+  rb_define_method(cRugColour, "to_s", (VALUE (*)(...))RugColourInspect, 0);
+
+  // the constants are frozen so they can be shared without being changed
+  DefineColour("Red",           255,   0,   0, 255);
+  DefineColour("Blue",            0,   0, 255, 255);
+  DefineColour("Green",           0, 255,   0, 255);
+  DefineColour("Black",           0,   0,   0, 255);
+  DefineColour("White",         255, 255, 255, 255);
+  DefineColour("Cyan",            0, 255, 255, 255);
+  DefineColour("Magenta",       255,   0, 255, 255);
+  DefineColour("Yellow",        255, 255,   0, 255);
+  DefineColour("Transparent",     0,   0,   0,   0);
+}
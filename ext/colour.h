@@ -0,0 +1,24 @@
+#ifndef RUG_COLOUR_H
+#define RUG_COLOUR_H
+
+#include "ruby.h"
+#include <SDL/SDL.h>
+
+extern VALUE cRugColour;
+
+void LoadColour(VALUE);
+
+// Colours are passed around in the 0xRRGGBBAA format that SDL_gfx takes,
+// whatever the format of the surface is
+static inline Uint32 GfxColour(Uint8 r, Uint8 g, Uint8 b, Uint8 a){
+  return ((Uint32)r << 24) | ((Uint32)g << 16) | ((Uint32)b << 8) | a;
+}
+
+// Reads a Rug::Colour, or a 0xRRGGBBAA number, in the format SDL_gfx takes
+Uint32 ColourToGfx(VALUE);
+
+// Converts a gfx colour to a pixel in the given format. Recent conversions
+// are remembered, so this is cheap to call for every shape.
+Uint32 MapGfxColour(SDL_PixelFormat *, Uint32);
+
+#endif //RUG_COLOUR_H
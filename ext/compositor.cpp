@@ -0,0 +1,215 @@
+#include "compositor.h"
+#include "blit.h"
+#include "conf.h"
+
+#include <SDL/SDL_thread.h>
+#include <stdlib.h>
+#include <vector>
+
+using namespace std;
+
+extern SDL_Surface * mainWnd;
+extern _RugConf RugConf;
+
+typedef struct {
+  SDL_Surface * src; // holds a reference until the blit is done
+  SDL_Rect from, to;
+} RugBlitCommand;
+
+static vector<RugBlitCommand> commands;
+static bool deferring = false;
+
+// The screen is split into one horizontal band per thread. Each thread
+// runs every command that touches its band, in the order they were
+// recorded, so each pixel is drawn in the right order.
+static vector<SDL_Thread *> workers;
+static SDL_mutex * bandLock = NULL;
+static SDL_cond * bandsReady = NULL;
+static SDL_cond * bandsDone = NULL;
+static int numBands = 0, nextBand = 0, bandsLeft = 0;
+static unsigned long generation = 0;
+static bool stopWorkers = false;
+
+static void RunBand(int band){
+  int top = mainWnd->h * band / numBands;
+  int bottom = mainWnd->h * (band + 1) / numBands;
+
+  for (size_t i = 0; i < commands.size(); i++){
+    RugBlitCommand & cmd = commands[i];
+
+    int y0 = cmd.to.y, y1 = cmd.to.y + cmd.to.h;
+    if (y1 <= top || y0 >= bottom){
+      continue;
+    }
+
+    int cutTop = (y0 < top) ? top - y0 : 0;
+    int cutBottom = (y1 > bottom) ? y1 - bottom : 0;
+
+    SDL_Rect from = cmd.from, to = cmd.to;
+    from.y += cutTop;
+    to.y += cutTop;
+    from.h -= cutTop + cutBottom;
+    to.h = from.h;
+
+    SDL_LowerBlit(cmd.src, &from, mainWnd, &to);
+  }
+}
+
+// Takes bands until there are none left. bandLock must be held.
+static void TakeBands(){
+  while (nextBand < numBands){
+    int band = nextBand++;
+
+    SDL_UnlockMutex(bandLock);
+    RunBand(band);
+    SDL_LockMutex(bandLock);
+
+    if (--bandsLeft == 0){
+      SDL_CondSignal(bandsDone);
+    }
+  }
+}
+
+static int CompositeWorker(void * unused){
+  unsigned long seen = 0;
+
+  SDL_LockMutex(bandLock);
+  while (1){
+    while (generation == seen && !stopWorkers){
+      SDL_CondWait(bandsReady, bandLock);
+    }
+    if (stopWorkers){
+      break;
+    }
+
+    seen = generation;
+    TakeBands();
+  }
+  SDL_UnlockMutex(bandLock);
+
+  return 0;
+}
+
+static void StopCompositeWorkers(){
+  if (bandLock == NULL){
+    return;
+  }
+
+  SDL_LockMutex(bandLock);
+  stopWorkers = true;
+  SDL_CondBroadcast(bandsReady);
+  SDL_UnlockMutex(bandLock);
+
+  for (size_t i = 0; i < workers.size(); i++){
+    SDL_WaitThread(workers[i], NULL);
+  }
+  workers.clear();
+
+  SDL_DestroyCond(bandsReady);
+  SDL_DestroyCond(bandsDone);
+  SDL_DestroyMutex(bandLock);
+  bandLock = NULL;
+}
+
+static void StartCompositeWorkers(){
+  if (bandLock != NULL){
+    return;
+  }
+
+  bandLock = SDL_CreateMutex();
+  bandsReady = SDL_CreateCond();
+  bandsDone = SDL_CreateCond();
+  stopWorkers = false;
+
+  // the main thread does a band as well
+  for (int i = 1; i < RugConf.compositeThreads; i++){
+    workers.push_back(SDL_CreateThread(CompositeWorker, NULL));
+  }
+
+  atexit(StopCompositeWorkers);
+}
+
+// SDL can only blit from several threads at once when nothing needs
+// locking or goes through the video hardware
+static bool CanRunInParallel(){
+  if (SDL_MUSTLOCK(mainWnd)){
+    return false;
+  }
+
+  for (size_t i = 0; i < commands.size(); i++){
+    SDL_Surface * src = commands[i].src;
+    if (SDL_MUSTLOCK(src) || (src->flags & SDL_HWACCEL) == SDL_HWACCEL){
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void BeginComposite(){
+  deferring = RugConf.compositeThreads > 1 && mainWnd != NULL;
+  if (deferring){
+    StartCompositeWorkers();
+  }
+}
+
+void EndComposite(){
+  FlushComposite();
+  deferring = false;
+}
+
+bool DeferBlit(SDL_Surface * src, SDL_Rect * srcRect, SDL_Rect * dstRect){
+  if (!deferring){
+    return false;
+  }
+
+  RugBlitCommand cmd;
+  if (!ClipBlit(src, srcRect, mainWnd, dstRect, cmd.from, cmd.to)){
+    dstRect->w = dstRect->h = 0;
+    return true;
+  }
+
+  cmd.src = src;
+  src->refcount++;
+  commands.push_back(cmd);
+
+  *dstRect = cmd.to;
+  return true;
+}
+
+void FlushComposite(){
+  if (commands.empty()){
+    return;
+  }
+
+  // SDL_LowerBlit sets up the blit mapping the first time a surface is
+  // blitted onto another one, so do that here on one thread. Empty blits
+  // don't draw anything.
+  for (size_t i = 0; i < commands.size(); i++){
+    SDL_Rect empty = { 0, 0, 0, 0 }, at = empty;
+    SDL_LowerBlit(commands[i].src, &empty, mainWnd, &at);
+  }
+
+  if (CanRunInParallel()){
+    SDL_LockMutex(bandLock);
+    numBands = workers.size() + 1;
+    nextBand = 0;
+    bandsLeft = numBands;
+    generation++;
+    SDL_CondBroadcast(bandsReady);
+
+    TakeBands();
+    while (bandsLeft > 0){
+      SDL_CondWait(bandsDone, bandLock);
+    }
+    SDL_UnlockMutex(bandLock);
+  }else{
+    numBands = 1;
+    RunBand(0);
+  }
+
+  for (size_t i = 0; i < commands.size(); i++){
+    SDL_FreeSurface(commands[i].src);
+  }
+  commands.clear();
+}
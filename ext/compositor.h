@@ -0,0 +1,20 @@
+#ifndef RUG_COMPOSITOR_H
+#define RUG_COMPOSITOR_H
+
+#include <SDL/SDL.h>
+
+// Blits onto the screen made between these are recorded and run later
+// on several threads, when Rug::Conf#composite_threads is set
+void BeginComposite();
+void EndComposite();
+
+// Records a blit onto the screen. Returns false if blits aren't being
+// deferred, in which case the caller should do it now. dstRect gets the
+// clipped rectangle, like SDL_BlitSurface.
+bool DeferBlit(SDL_Surface * src, SDL_Rect * srcRect, SDL_Rect * dstRect);
+
+// Runs everything recorded so far. This needs to be called before
+// drawing anything onto a surface that might be waiting to be blitted.
+void FlushComposite();
+
+#endif //RUG_COMPOSITOR_H
@@ -1,12 +1,30 @@
 #include "conf.h"
+#include "replay.h"
 
 #include <SDL/SDL.h>
 #include <SDL/SDL_image.h>
+#include <limits.h>
 
 _RugConf RugConf;
 VALUE cRugConf;
 VALUE block_converter;
 
+static bool virtualClock = false;
+static double virtualTicks = 0;
+
+Uint32 RugGetTicks(){
+  return virtualClock ? (Uint32)virtualTicks : SDL_GetTicks();
+}
+
+void SetTicks(double ms){
+  virtualClock = true;
+  virtualTicks = ms;
+}
+
+void AdvanceTicks(double ms){
+  virtualTicks += ms;
+}
+
 /*
  * When in full screen this sets the horizontal resolution of the
  * screen. When windowed sets the width of the window.
@@ -84,6 +102,43 @@ VALUE RugConfSetFPS(VALUE self, VALUE _fps){
   return _fps;
 }
 
+/*
+ * Runs the update block at a fixed rate of _rate_ ticks per second, passing
+ * the same dt every time. The draw block is then called at least once a
+ * tick and at most at the frame rate set by fps, and is passed an
+ * interpolation factor between 0 and 1 that says how far the simulation
+ * is between the last tick and the next.
+ * Pass false or 0 to go back to the variable time step.
+ *
+ * Usage:
+ *
+ *    Rug.conf do
+ *      fixed_timestep 60
+ *    end
+ *
+ *    Rug.draw do |alpha|
+ *      # draw things at last_x + (x - last_x) * alpha
+ *    end
+ */
+VALUE RugConfSetFixedTimestep(VALUE self, VALUE rate){
+  RugConf.tickRate = (rate == Qfalse || rate == Qnil) ? 0 : NUM2INT(rate);
+  return rate;
+}
+
+/*
+ * When using a fixed time step, this is the most ticks that will be run
+ * before drawing a frame. If the game falls further behind than this
+ * the extra time is dropped, so a slow frame doesn't cause a spiral of
+ * catching up.
+ */
+VALUE RugConfSetMaxCatchup(VALUE self, VALUE steps){
+  RugConf.maxCatchup = NUM2INT(steps);
+  if (RugConf.maxCatchup < 1){
+    RugConf.maxCatchup = 1;
+  }
+  return steps;
+}
+
 /*
  * Enables or disables the GUI layer.
  */
@@ -92,6 +147,126 @@ VALUE RugConfSetGUI(VALUE self, VALUE gui){
   return gui;
 }
 
+/*
+ * Enables dirty rectangle rendering. Instead of redrawing and updating
+ * the whole screen every frame, only the areas that images, layers and
+ * text were drawn on are cleared back to the background and sent to the
+ * display. This is much faster for mostly static screens, but anything
+ * that is drawn onto the screen in some other way won't be cleared.
+ * This turns off double buffering.
+ */
+VALUE RugConfSetDirtyRects(VALUE self, VALUE dirty){
+  RugConf.dirtyRects = (dirty == Qtrue ? true : false);
+  return dirty;
+}
+
+/*
+ * Sets the number of threads used to load images in the background with
+ * Rug::Image.load_async. The default is 2.
+ */
+VALUE RugConfSetLoadThreads(VALUE self, VALUE threads){
+  RugConf.loadThreads = NUM2INT(threads);
+  if (RugConf.loadThreads < 1){
+    RugConf.loadThreads = 1;
+  }
+  return threads;
+}
+
+/*
+ * Sets how many megabytes the rotations cached by
+ * Rug::Image#cache_rotations can use between them. When the cache is full
+ * the rotations that were used longest ago are thrown away. The default
+ * is 32.
+ */
+VALUE RugConfSetRotationCache(VALUE self, VALUE megabytes){
+  long mb = NUM2LONG(megabytes);
+  if (mb < 0){
+    rb_raise(rb_eArgError, "the rotation cache size can't be negative");
+  }
+
+  // anything bigger than fits in a long is as good as no limit
+  RugConf.rotationCacheSize = (mb > LONG_MAX / (1024 * 1024)) ? LONG_MAX : mb * 1024 * 1024;
+  return megabytes;
+}
+
+/*
+ * Sets the number of threads that draw onto the screen. With more than
+ * one, images and layers drawn onto the screen in the draw block are
+ * recorded, and then drawn by all the threads at once, each one taking a
+ * band of the screen. The default is 1, which draws everything straight
+ * away.
+ */
+VALUE RugConfSetCompositeThreads(VALUE self, VALUE threads){
+  RugConf.compositeThreads = NUM2INT(threads);
+  if (RugConf.compositeThreads < 1){
+    RugConf.compositeThreads = 1;
+  }
+  return threads;
+}
+
+/*
+ * Turns on timing of each part of the frame, see Rug.frame_stats. This
+ * is off by default, since it costs a little every frame.
+ */
+VALUE RugConfSetProfile(VALUE self, VALUE profile){
+  RugConf.profile = (profile == Qtrue ? true : false);
+  return profile;
+}
+
+/*
+ * Runs without a window, drawing into an offscreen surface through SDL's
+ * dummy video driver. Time is virtual: every frame moves it on by the
+ * frame gap, or by one tick with a fixed time step, and frames are drawn
+ * as fast as possible. This is for benchmarks and for running games on
+ * machines without a display.
+ */
+VALUE RugConfSetHeadless(VALUE self, VALUE headless){
+  RugConf.headless = (headless == Qtrue ? true : false);
+  return headless;
+}
+
+/*
+ * Quits after this many frames have been drawn. The default is 0, which
+ * runs until the program quits.
+ */
+VALUE RugConfSetFrames(VALUE self, VALUE frames){
+  RugConf.frameLimit = NUM2INT(frames);
+  if (RugConf.frameLimit < 0){
+    RugConf.frameLimit = 0;
+  }
+  return frames;
+}
+
+/*
+ * Takes a checksum of the screen after every frame, and makes Rug.start
+ * return them in an array. Runs of the same headless game should give the
+ * same checksums, so this can catch changes in what is drawn.
+ */
+VALUE RugConfSetChecksums(VALUE self, VALUE checksums){
+  RugConf.checksums = (checksums == Qtrue ? true : false);
+  return checksums;
+}
+
+/*
+ * Records every event that is handled and the time of every frame to
+ * _filename_, so that the session can be played back with replay.
+ */
+VALUE RugConfSetRecord(VALUE self, VALUE filename){
+  OpenRecording(StringValueCStr(filename));
+  return filename;
+}
+
+/*
+ * Plays back a session saved with record instead of taking input from the
+ * keyboard and mouse. Time comes from the recording and frames are drawn
+ * as fast as possible, so this makes a repeatable benchmark. The program
+ * quits at the end of the recording.
+ */
+VALUE RugConfSetReplay(VALUE self, VALUE filename){
+  OpenReplay(StringValueCStr(filename));
+  return filename;
+}
+
 /*
  * Sets the background image.
  */
@@ -121,14 +296,32 @@ static VALUE RugConfFunc(int argc, VALUE * argv, VALUE klass){
 
 // This function performs all configuration necessary and returns the screen object
 SDL_Surface * DoConf(){
-  // TODO: make double buffering optional
-  int params = SDL_HWSURFACE | SDL_SRCALPHA | SDL_DOUBLEBUF;
+  int params;
 
-  if (RugConf.fullscreen){
+  if (RugConf.dirtyRects){
+    // dirty rectangles rely on the last frame still being in the buffer
+    params = SDL_SWSURFACE | SDL_SRCALPHA;
+  }else{
+    params = SDL_HWSURFACE | SDL_SRCALPHA | SDL_DOUBLEBUF;
+  }
+
+  if (RugConf.headless){
+    params = SDL_SWSURFACE | SDL_SRCALPHA;
+  }else if (RugConf.fullscreen){
     params |= SDL_FULLSCREEN;
   }
 
   SDL_Surface * wnd = SDL_SetVideoMode(RugConf.width, RugConf.height, RugConf.bpp, params);
+
+  // the background is blitted every frame, so match the screen's format
+  if (RugConf.background != NULL){
+    SDL_Surface * background = RugConf.background->format->Amask ?
+      SDL_DisplayFormatAlpha(RugConf.background) : SDL_DisplayFormat(RugConf.background);
+    if (background != NULL){
+      SDL_FreeSurface(RugConf.background);
+      RugConf.background = background;
+    }
+  }
   if (RugConf.title != Qnil){
     SDL_WM_SetCaption(STR2CSTR(RugConf.title), NULL);
   }
@@ -152,9 +345,19 @@ void LoadConf(VALUE mRug){
   RugConf.height         = 600;
   RugConf.bpp            = 32;
   RugConf.frameGap       = 33;
+  RugConf.tickRate       = 0;
+  RugConf.maxCatchup     = 5;
+  RugConf.loadThreads    = 2;
+  RugConf.rotationCacheSize = 32 * 1024 * 1024;
+  RugConf.compositeThreads = 1;
   RugConf.fullscreen     = 0;
   RugConf.show_cursor    = 1;
   RugConf.gui            = 1;
+  RugConf.dirtyRects     = 0;
+  RugConf.profile        = 0;
+  RugConf.headless       = 0;
+  RugConf.checksums      = 0;
+  RugConf.frameLimit     = 0;
   RugConf.repeatDelay    = SDL_DEFAULT_REPEAT_DELAY;
   RugConf.repeatInterval = SDL_DEFAULT_REPEAT_INTERVAL;
   RugConf.background     = NULL;
@@ -181,4 +384,16 @@ void LoadConf(VALUE mRug){
   rb_define_method(cRugConf, "key_repeat_interval", (VALUE (*)(...))RugConfSetInterval, 1);
   rb_define_method(cRugConf, "gui",                 (VALUE (*)(...))RugConfSetGUI, 1);
   rb_define_method(cRugConf, "background",          (VALUE (*)(...))RugConfSetBackground, 1);
+  rb_define_method(cRugConf, "fixed_timestep",      (VALUE (*)(...))RugConfSetFixedTimestep, 1);
+  rb_define_method(cRugConf, "dirty_rects",         (VALUE (*)(...))RugConfSetDirtyRects, 1);
+  rb_define_method(cRugConf, "load_threads",        (VALUE (*)(...))RugConfSetLoadThreads, 1);
+  rb_define_method(cRugConf, "max_catchup",         (VALUE (*)(...))RugConfSetMaxCatchup, 1);
+  rb_define_method(cRugConf, "rotation_cache",      (VALUE (*)(...))RugConfSetRotationCache, 1);
+  rb_define_method(cRugConf, "composite_threads",   (VALUE (*)(...))RugConfSetCompositeThreads, 1);
+  rb_define_method(cRugConf, "profile",             (VALUE (*)(...))RugConfSetProfile, 1);
+  rb_define_method(cRugConf, "headless",            (VALUE (*)(...))RugConfSetHeadless, 1);
+  rb_define_method(cRugConf, "frames",              (VALUE (*)(...))RugConfSetFrames, 1);
+  rb_define_method(cRugConf, "checksums",           (VALUE (*)(...))RugConfSetChecksums, 1);
+  rb_define_method(cRugConf, "record",              (VALUE (*)(...))RugConfSetRecord, 1);
+  rb_define_method(cRugConf, "replay",              (VALUE (*)(...))RugConfSetReplay, 1);
 }
@@ -9,11 +9,24 @@ typedef struct {
   VALUE title;
   int repeatDelay, repeatInterval;
   int frameGap;
-  bool fullscreen, show_cursor, gui;
+  int tickRate, maxCatchup;
+  int loadThreads;
+  long rotationCacheSize; // in bytes
+  int compositeThreads;
+  int frameLimit;
+  bool fullscreen, show_cursor, gui, dirtyRects, profile;
+  bool headless, checksums;
   SDL_Surface * background;
 } _RugConf;
 
 void LoadConf(VALUE);
 SDL_Surface * DoConf();
 
+// The time in milliseconds. Once SetTicks is called the time is virtual
+// and only moves when it is told to, which headless runs and replays use
+// so that they don't depend on how fast the machine is.
+Uint32 RugGetTicks();
+void SetTicks(double ms);
+void AdvanceTicks(double ms);
+
 #endif //RUG_CONF_H
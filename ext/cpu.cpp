@@ -0,0 +1,14 @@
+#include "cpu.h"
+
+bool CpuHasAVX2(){
+#ifdef RUG_HAVE_AVX2_KERNEL
+  static int avx2 = -1;
+  if (avx2 < 0){
+    __builtin_cpu_init();
+    avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+  }
+  return avx2 == 1;
+#else
+  return false;
+#endif
+}
@@ -0,0 +1,11 @@
+#ifndef RUG_CPU_H
+#define RUG_CPU_H
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RUG_HAVE_AVX2_KERNEL 1
+#endif
+
+// Whether the AVX2 versions of the pixel kernels can be used
+bool CpuHasAVX2();
+
+#endif //RUG_CPU_H
@@ -1,7 +1,10 @@
 #include "events.h"
+#include "replay.h"
 
 #include <SDL/SDL.h>
+#include <string.h>
 #include <list>
+#include <vector>
 
 using namespace std;
 
@@ -22,6 +25,22 @@ struct _RugEvents {
   VALUE mRug;
 } RugEvents;
 
+// A queued event. Mouse motion offsets are summed when motion events
+// are merged, so they are kept outside the SDL_Event where they can't
+// overflow.
+typedef RecordedEvent PendingEvent;
+
+static vector<PendingEvent> pendingEvents;
+
+// Set while pendingEvents is being dispatched, so that a handler can't
+// pump the queue and clear it from under the loop
+static bool handlingEvents = false;
+
+// A quit handled by Rug.pump_events, for the main loop to pick up
+static bool quitPumped = false;
+
+static ID id_call;
+
 static void AddRugEvent(VALUE event){
   VALUE stash = rb_iv_get(RugEvents.mRug, "@event_callbacks");
   rb_funcall(stash, rb_intern("<<"), 1, event);
@@ -105,7 +124,65 @@ static VALUE AddMouseMoveOffset(int argc, VALUE * argv, VALUE self){
   return Qnil;
 }
 
+// Puts an event on the queue as though it came from the keyboard or mouse.
+// The type is one of :keydown, :keyup, :mousemove, :mousedown, :mouseup or
+// :quit, and the arguments are what the matching handler takes. This and
+// pump_events are private, they are only there for bench/bench.rb:
+//
+//   Rug.send :push_event, :keydown, Rug::Key::Space
+static VALUE RugPushEvent(int argc, VALUE * argv, VALUE self){
+  VALUE type, a, b, c;
+  rb_scan_args(argc, argv, "13", &type, &a, &b, &c);
+
+  SDL_Event ev;
+  memset(&ev, 0, sizeof(ev));
+
+  ID which = SYM2ID(type);
+  if (which == rb_intern("keydown") || which == rb_intern("keyup")){
+    ev.type = which == rb_intern("keydown") ? SDL_KEYDOWN : SDL_KEYUP;
+    ev.key.keysym.sym = (SDLKey)NUM2INT(a);
+  }else if (which == rb_intern("mousemove")){
+    ev.type = SDL_MOUSEMOTION;
+    ev.motion.x = NUM2INT(a);
+    ev.motion.y = NUM2INT(b);
+  }else if (which == rb_intern("mousedown") || which == rb_intern("mouseup")){
+    ev.type = which == rb_intern("mousedown") ? SDL_MOUSEBUTTONDOWN : SDL_MOUSEBUTTONUP;
+    ev.button.x = NUM2INT(a);
+    ev.button.y = NUM2INT(b);
+    ev.button.button = c == Qnil ? SDL_BUTTON_LEFT : NUM2INT(c);
+  }else if (which == rb_intern("quit")){
+    ev.type = SDL_QUIT;
+  }else{
+    rb_raise(rb_eArgError, "unknown event type");
+  }
+
+  if (SDL_PushEvent(&ev) < 0){
+    rb_raise(rb_eRuntimeError, "could not queue event: %s", SDL_GetError());
+  }
+
+  return Qnil;
+}
+
+// Handles everything on the event queue straight away, the same as is done
+// at the start of each frame. Returns false if a quit event was handled,
+// and the main loop still quits at the start of the next frame.
+static VALUE RugPumpEvents(VALUE self){
+  if (handlingEvents){
+    rb_raise(rb_eRuntimeError, "can't pump events from an event handler");
+  }
+
+  if (!HandleEvents()){
+    quitPumped = true;
+    return Qfalse;
+  }
+  return Qtrue;
+}
+
 void LoadEvents(VALUE mRug){
+  VALUE cRugSingleton = rb_singleton_class(mRug);
+  rb_define_private_method(cRugSingleton, "push_event",  (VALUE (*)(...))RugPushEvent,  -1);
+  rb_define_private_method(cRugSingleton, "pump_events", (VALUE (*)(...))RugPumpEvents,  0);
+
   rb_define_singleton_method(mRug, "keyup",           (VALUE (*)(...))AddKeyUp,           -1);
   rb_define_singleton_method(mRug, "keydown",         (VALUE (*)(...))AddKeyDown,         -1);
   rb_define_singleton_method(mRug, "mousemove",       (VALUE (*)(...))AddMouseMove,       -1);
@@ -117,6 +194,7 @@ void LoadEvents(VALUE mRug){
   VALUE mMouseModule = rb_define_module_under(mRug, "Mouse");
 
   RugEvents.mRug = mRug;
+  id_call = rb_intern("call");
   rb_iv_set(mRug, "@event_callbacks", rb_ary_new());
 
   // Load character codes
@@ -226,47 +304,35 @@ void LoadEvents(VALUE mRug){
   rb_define_const(mMouseModule, "Right",  INT2FIX(SDL_BUTTON_RIGHT));
 }
 
+static void CallAll(int which, int argc, VALUE a, VALUE b = Qnil, VALUE c = Qnil){
+  for (EventIterator it = RugEvents.events[which].begin();
+       it != RugEvents.events[which].end();
+       it++){
+    rb_funcall(*it, id_call, argc, a, b, c);
+  }
+}
+
+static void DispatchMouseMove(int x, int y, int xrel, int yrel){
+  CallAll(MOUSEMOVE, 2, INT2FIX(x), INT2FIX(y));
+  CallAll(MOUSEMOVEOFFSET, 2, INT2FIX(xrel), INT2FIX(yrel));
+}
+
 int HandleEvent(SDL_Event &ev){
   switch(ev.type){
   case SDL_KEYUP:
-    for (EventIterator it = RugEvents.events[KEYUP].begin();
-         it != RugEvents.events[KEYUP].end();
-         it++){
-      rb_funcall(*it, rb_intern("call"), 1, INT2FIX(ev.key.keysym.sym));
-    }
+    CallAll(KEYUP, 1, INT2FIX(ev.key.keysym.sym));
     break;
   case SDL_KEYDOWN:
-    for (EventIterator it = RugEvents.events[KEYDOWN].begin();
-         it != RugEvents.events[KEYDOWN].end();
-         it++){
-      rb_funcall(*it, rb_intern("call"), 1, INT2FIX(ev.key.keysym.sym));
-    }
+    CallAll(KEYDOWN, 1, INT2FIX(ev.key.keysym.sym));
     break;
   case SDL_MOUSEMOTION:
-    for (EventIterator it = RugEvents.events[MOUSEMOVE].begin();
-         it != RugEvents.events[MOUSEMOVE].end();
-         it++){
-      rb_funcall(*it, rb_intern("call"), 2, INT2FIX(ev.motion.x), INT2FIX(ev.motion.y));
-    }
-    for (EventIterator it = RugEvents.events[MOUSEMOVEOFFSET].begin();
-         it != RugEvents.events[MOUSEMOVEOFFSET].end();
-         it++){
-      rb_funcall(*it, rb_intern("call"), 2, INT2FIX(ev.motion.xrel), INT2FIX(ev.motion.yrel));
-    }
+    DispatchMouseMove(ev.motion.x, ev.motion.y, ev.motion.xrel, ev.motion.yrel);
     break;
   case SDL_MOUSEBUTTONDOWN:
-    for (EventIterator it = RugEvents.events[MOUSEDOWN].begin();
-         it != RugEvents.events[MOUSEDOWN].end();
-         it++){
-      rb_funcall(*it, rb_intern("call"), 3, INT2FIX(ev.button.x), INT2FIX(ev.button.y), INT2FIX(ev.button.button));
-    }
+    CallAll(MOUSEDOWN, 3, INT2FIX(ev.button.x), INT2FIX(ev.button.y), INT2FIX(ev.button.button));
     break;
   case SDL_MOUSEBUTTONUP:
-    for (EventIterator it = RugEvents.events[MOUSEUP].begin();
-         it != RugEvents.events[MOUSEUP].end();
-         it++){
-      rb_funcall(*it, rb_intern("call"), 3, INT2FIX(ev.button.x), INT2FIX(ev.button.y), INT2FIX(ev.button.button));
-    }
+    CallAll(MOUSEUP, 3, INT2FIX(ev.button.x), INT2FIX(ev.button.y), INT2FIX(ev.button.button));
     break;
   case SDL_QUIT:
     return 0;
@@ -276,3 +342,72 @@ int HandleEvent(SDL_Event &ev){
 
   return 1;
 }
+
+static VALUE DispatchPendingEvents(VALUE unused){
+  for (size_t i = 0; i < pendingEvents.size(); i++){
+    PendingEvent & p = pendingEvents[i];
+    RecordEvent(p);
+
+    if (p.ev.type == SDL_MOUSEMOTION){
+      DispatchMouseMove(p.ev.motion.x, p.ev.motion.y, p.xrel, p.yrel);
+    }else if (!HandleEvent(p.ev)){
+      return Qfalse;
+    }
+  }
+
+  return Qtrue;
+}
+
+// Runs even if a handler raises
+static VALUE EndDispatch(VALUE unused){
+  handlingEvents = false;
+  return Qnil;
+}
+
+// Drains the whole SDL event queue and then dispatches it in one go.
+// Runs of mouse motion are merged into a single move to the final
+// position with the offsets summed, so a burst of motion only costs one
+// call per handler. When replaying, the recorded events for this frame
+// are dispatched instead, only by the first call in the frame, and only a
+// real quit is taken from SDL. Returns 0 if the app should quit.
+int HandleEvents(){
+  if (quitPumped){
+    quitPumped = false;
+    return 0;
+  }
+
+  pendingEvents.clear();
+
+  PendingEvent pending;
+  while (SDL_PollEvent(&pending.ev)){
+    if (Replaying()){
+      if (pending.ev.type == SDL_QUIT){
+        return 0;
+      }
+      continue;
+    }
+
+    if (pending.ev.type == SDL_MOUSEMOTION){
+      if (!pendingEvents.empty() && pendingEvents.back().ev.type == SDL_MOUSEMOTION){
+        PendingEvent & last = pendingEvents.back();
+        last.xrel += pending.ev.motion.xrel;
+        last.yrel += pending.ev.motion.yrel;
+        last.ev.motion.x = pending.ev.motion.x;
+        last.ev.motion.y = pending.ev.motion.y;
+        last.ev.motion.state = pending.ev.motion.state;
+        continue;
+      }
+
+      pending.xrel = pending.ev.motion.xrel;
+      pending.yrel = pending.ev.motion.yrel;
+    }
+    pendingEvents.push_back(pending);
+  }
+
+  if (Replaying()){
+    TakeReplayEvents(pendingEvents);
+  }
+
+  handlingEvents = true;
+  return rb_ensure(DispatchPendingEvents, Qnil, EndDispatch, Qnil) == Qtrue;
+}
@@ -6,6 +6,7 @@
 
 void LoadEvents(VALUE);
 int HandleEvent(SDL_Event &);
+int HandleEvents();
 
 #endif //RUG_EVENTS_H
 
@@ -0,0 +1,158 @@
+#include "flip.h"
+#include "cpu.h"
+
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifdef RUG_HAVE_AVX2_KERNEL
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// Each kernel reverses the order of the pixels in one row. They swap
+// blocks from both ends and meet in the middle, so a row is only read
+// and written once, and whatever is left in the middle is done pixel
+// by pixel.
+
+static void ReverseRow8(Uint8 * row, int w){
+  reverse(row, row + w);
+}
+
+static void ReverseRow24(Uint8 * row, int w){
+  Uint8 * l = row;
+  Uint8 * r = row + (w - 1) * 3;
+  while (l < r){
+    Uint8 t0 = l[0], t1 = l[1], t2 = l[2];
+    l[0] = r[0]; l[1] = r[1]; l[2] = r[2];
+    r[0] = t0;   r[1] = t1;   r[2] = t2;
+    l += 3;
+    r -= 3;
+  }
+}
+
+static void ReverseRow16(Uint8 * row, int w){
+  Uint16 * l = (Uint16 *)row;
+  Uint16 * r = l + w;
+
+#if defined(__SSE2__)
+  while (r - l >= 16){
+    r -= 8;
+    __m128i a = _mm_loadu_si128((__m128i *)l);
+    __m128i b = _mm_loadu_si128((__m128i *)r);
+
+    // reverse the words in each half, then swap the halves
+    a = _mm_shuffle_epi32(_mm_shufflehi_epi16(_mm_shufflelo_epi16(a, 0x1B), 0x1B), 0x4E);
+    b = _mm_shuffle_epi32(_mm_shufflehi_epi16(_mm_shufflelo_epi16(b, 0x1B), 0x1B), 0x4E);
+
+    _mm_storeu_si128((__m128i *)l, b);
+    _mm_storeu_si128((__m128i *)r, a);
+    l += 8;
+  }
+#endif
+
+  reverse(l, r);
+}
+
+static void ReverseRow32(Uint8 * row, int w){
+  Uint32 * l = (Uint32 *)row;
+  Uint32 * r = l + w;
+
+#if defined(__SSE2__)
+  while (r - l >= 8){
+    r -= 4;
+    __m128i a = _mm_shuffle_epi32(_mm_loadu_si128((__m128i *)l), 0x1B);
+    __m128i b = _mm_shuffle_epi32(_mm_loadu_si128((__m128i *)r), 0x1B);
+    _mm_storeu_si128((__m128i *)l, b);
+    _mm_storeu_si128((__m128i *)r, a);
+    l += 4;
+  }
+#endif
+
+  reverse(l, r);
+}
+
+#ifdef RUG_HAVE_AVX2_KERNEL
+__attribute__((target("avx2")))
+static void ReverseRow32AVX2(Uint8 * row, int w){
+  Uint32 * l = (Uint32 *)row;
+  Uint32 * r = l + w;
+
+  const __m256i backwards = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+  while (r - l >= 16){
+    r -= 8;
+    __m256i a = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((__m256i *)l), backwards);
+    __m256i b = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((__m256i *)r), backwards);
+    _mm256_storeu_si256((__m256i *)l, b);
+    _mm256_storeu_si256((__m256i *)r, a);
+    l += 8;
+  }
+
+  // the rest is less than two AVX blocks wide
+  ReverseRow32((Uint8 *)l, r - l);
+}
+#endif
+
+typedef void (*ReverseRowFunc)(Uint8 *, int);
+
+static ReverseRowFunc GetReverseRow(int bytesPerPixel){
+  switch (bytesPerPixel){
+    case 1: return ReverseRow8;
+    case 2: return ReverseRow16;
+    case 3: return ReverseRow24;
+  }
+
+#ifdef RUG_HAVE_AVX2_KERNEL
+  if (CpuHasAVX2()){
+    return ReverseRow32AVX2;
+  }
+#endif
+
+  return ReverseRow32;
+}
+
+void FlipSurfaceH(SDL_Surface * surface){
+  if (surface == NULL || surface->w < 2){
+    return;
+  }
+
+  ReverseRowFunc reverseRow = GetReverseRow(surface->format->BytesPerPixel);
+
+  if (SDL_MUSTLOCK(surface)) SDL_LockSurface(surface);
+
+  Uint8 * row = (Uint8 *)surface->pixels;
+  for (int y = 0; y < surface->h; y++, row += surface->pitch){
+    reverseRow(row, surface->w);
+  }
+
+  if (SDL_MUSTLOCK(surface)) SDL_UnlockSurface(surface);
+}
+
+void FlipSurfaceV(SDL_Surface * surface){
+  if (surface == NULL || surface->h < 2){
+    return;
+  }
+
+  // whole rows are swapped, so memcpy does the wide copies for us
+  size_t rowSize = surface->w * surface->format->BytesPerPixel;
+  vector<Uint8> temp(rowSize);
+
+  if (SDL_MUSTLOCK(surface)) SDL_LockSurface(surface);
+
+  Uint8 * top = (Uint8 *)surface->pixels;
+  Uint8 * bottom = top + (surface->h - 1) * surface->pitch;
+  while (top < bottom){
+    memcpy(&temp[0], top, rowSize);
+    memcpy(top, bottom, rowSize);
+    memcpy(bottom, &temp[0], rowSize);
+    top += surface->pitch;
+    bottom -= surface->pitch;
+  }
+
+  if (SDL_MUSTLOCK(surface)) SDL_UnlockSurface(surface);
+}
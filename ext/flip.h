@@ -0,0 +1,10 @@
+#ifndef RUG_FLIP_H
+#define RUG_FLIP_H
+
+#include <SDL/SDL.h>
+
+// Both of these mirror the surface in place and work for any depth
+void FlipSurfaceH(SDL_Surface *);
+void FlipSurfaceV(SDL_Surface *);
+
+#endif //RUG_FLIP_H
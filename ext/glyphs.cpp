@@ -0,0 +1,232 @@
+#include "glyphs.h"
+
+#include <string.h>
+#include <vector>
+
+using namespace std;
+
+static const int SHEET_WIDTH = 512;
+static const int FIRST_GLYPH = 32;
+
+// Each colour that text is drawn in needs its own atlas, so keep a few
+// around and throw out the least recently used when there are too many
+static const size_t MAX_ATLASES = 8;
+
+static vector<RugGlyphAtlas *> atlases;
+static unsigned long useCounter = 0;
+
+// Copies a glyph rendered by SDL_ttf into the sheet, keeping its alpha.
+// Solid glyphs are palettized with 0 as the transparent colour.
+static void CopyGlyph(SDL_Surface * glyph, SDL_Surface * sheet, SDL_Rect & at, SDL_Color colour){
+  if (SDL_MUSTLOCK(glyph)) SDL_LockSurface(glyph);
+  if (SDL_MUSTLOCK(sheet)) SDL_LockSurface(sheet);
+
+  if (glyph->format->BitsPerPixel == 8){
+    Uint32 pixel = SDL_MapRGBA(sheet->format, colour.r, colour.g, colour.b, 255);
+    for (int y = 0; y < at.h; y++){
+      Uint8 * src = (Uint8 *)glyph->pixels + y * glyph->pitch;
+      Uint32 * dst = (Uint32 *)((Uint8 *)sheet->pixels + (at.y + y) * sheet->pitch) + at.x;
+      for (int x = 0; x < at.w; x++){
+        if (src[x] != 0){
+          dst[x] = pixel;
+        }
+      }
+    }
+  }else{
+    // blended glyphs come out of SDL_ttf in the same format as the sheet
+    for (int y = 0; y < at.h; y++){
+      Uint8 * src = (Uint8 *)glyph->pixels + y * glyph->pitch;
+      Uint8 * dst = (Uint8 *)sheet->pixels + (at.y + y) * sheet->pitch + at.x * 4;
+      memcpy(dst, src, at.w * 4);
+    }
+  }
+
+  if (SDL_MUSTLOCK(sheet)) SDL_UnlockSurface(sheet);
+  if (SDL_MUSTLOCK(glyph)) SDL_UnlockSurface(glyph);
+}
+
+static RugGlyphAtlas * BuildGlyphAtlas(TTF_Font * font, SDL_Color colour, bool solid){
+  RugGlyphAtlas * atlas = new RugGlyphAtlas;
+  memset(atlas->glyphs, 0, sizeof(atlas->glyphs));
+
+  atlas->font   = font;
+  atlas->colour = colour;
+  atlas->solid  = solid;
+
+  SDL_Surface * rendered[256];
+  memset(rendered, 0, sizeof(rendered));
+
+  int ascent = TTF_FontAscent(font);
+
+  // render every glyph and pack them into rows
+  int x = 0, y = 0, rowHeight = 0;
+  for (int c = FIRST_GLYPH; c < 256; c++){
+    RugGlyph & g = atlas->glyphs[c];
+
+    int minx, maxx, miny, maxy, advance;
+    if (TTF_GlyphMetrics(font, c, &minx, &maxx, &miny, &maxy, &advance) != 0){
+      continue;
+    }
+
+    g.minx    = minx;
+    g.yoffset = ascent - maxy;
+    g.advance = advance;
+
+    rendered[c] = solid ? TTF_RenderGlyph_Solid(font, c, colour) : TTF_RenderGlyph_Blended(font, c, colour);
+    if (rendered[c] == NULL || rendered[c]->w == 0 || rendered[c]->h == 0 || rendered[c]->w > SHEET_WIDTH){
+      continue;
+    }
+
+    if (x + rendered[c]->w > SHEET_WIDTH){
+      x = 0;
+      y += rowHeight + 1;
+      rowHeight = 0;
+    }
+
+    g.rect.x = x;
+    g.rect.y = y;
+    g.rect.w = rendered[c]->w;
+    g.rect.h = rendered[c]->h;
+
+    x += g.rect.w + 1;
+    if (g.rect.h > rowHeight){
+      rowHeight = g.rect.h;
+    }
+  }
+
+  // same format that SDL_ttf uses for blended text
+  SDL_Surface * sheet = SDL_CreateRGBSurface(SDL_SWSURFACE, SHEET_WIDTH, y + rowHeight + 1, 32,
+      0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+  SDL_FillRect(sheet, NULL, 0);
+
+  for (int c = FIRST_GLYPH; c < 256; c++){
+    if (rendered[c] != NULL){
+      if (atlas->glyphs[c].rect.w > 0){
+        CopyGlyph(rendered[c], sheet, atlas->glyphs[c].rect, colour);
+      }
+      SDL_FreeSurface(rendered[c]);
+    }
+  }
+
+  SDL_SetAlpha(sheet, SDL_SRCALPHA, SDL_ALPHA_OPAQUE);
+
+  // blits to the screen are quicker if the sheet matches its format
+  if (SDL_GetVideoSurface() != NULL){
+    SDL_Surface * converted = SDL_DisplayFormatAlpha(sheet);
+    if (converted != NULL){
+      SDL_FreeSurface(sheet);
+      sheet = converted;
+    }
+  }
+
+  atlas->sheet = sheet;
+
+  return atlas;
+}
+
+static void FreeGlyphAtlas(RugGlyphAtlas * atlas){
+  SDL_FreeSurface(atlas->sheet);
+  delete atlas;
+}
+
+// Gets the atlas for the font in the given colour, rendering it if it
+// hasn't been used recently.
+RugGlyphAtlas * GetGlyphAtlas(TTF_Font * font, SDL_Color colour, bool solid){
+  size_t oldest = 0;
+
+  for (size_t i = 0; i < atlases.size(); i++){
+    RugGlyphAtlas * atlas = atlases[i];
+    if (atlas->font == font && atlas->solid == solid &&
+        atlas->colour.r == colour.r && atlas->colour.g == colour.g && atlas->colour.b == colour.b){
+      atlas->lastUsed = ++useCounter;
+      return atlas;
+    }
+
+    if (atlas->lastUsed < atlases[oldest]->lastUsed){
+      oldest = i;
+    }
+  }
+
+  RugGlyphAtlas * atlas = BuildGlyphAtlas(font, colour, solid);
+  atlas->lastUsed = ++useCounter;
+
+  if (atlases.size() >= MAX_ATLASES){
+    FreeGlyphAtlas(atlases[oldest]);
+    atlases[oldest] = atlas;
+  }else{
+    atlases.push_back(atlas);
+  }
+
+  return atlas;
+}
+
+// Draws a string with its top-left corner at x, y. The glyphs are laid
+// out the same way that TTF_RenderText does, so this looks the same as
+// rendering the whole string at once. If bounds is passed it is set to
+// the area of the target that was drawn on.
+void DrawGlyphText(RugGlyphAtlas * atlas, const char * text, SDL_Surface * target, int x, int y, SDL_Rect * bounds){
+  const unsigned char * c = (const unsigned char *)text;
+  int pen = x;
+  int left = 0, top = 0, right = 0, bottom = 0;
+  bool drawn = false;
+
+#if SDL_TTF_MAJOR_VERSION > 2 || SDL_TTF_PATCHLEVEL >= 14
+  bool kerning = TTF_GetFontKerning(atlas->font) != 0;
+  Uint16 prev = 0;
+#endif
+
+  // SDL_ttf shifts the whole string right if the first glyph hangs left
+  if (*c && atlas->glyphs[*c].minx < 0){
+    pen -= atlas->glyphs[*c].minx;
+  }
+
+  for (; *c; c++){
+    RugGlyph & g = atlas->glyphs[*c];
+
+#if SDL_TTF_MAJOR_VERSION > 2 || SDL_TTF_PATCHLEVEL >= 14
+    if (kerning && prev){
+      pen += TTF_GetFontKerningSizeGlyphs(atlas->font, prev, *c);
+    }
+    prev = *c;
+#endif
+
+    if (g.rect.w > 0){
+      SDL_Rect src = g.rect;
+      SDL_Rect dst;
+      dst.x = pen + g.minx;
+      dst.y = y + g.yoffset;
+      dst.w = dst.h = 0;
+
+      SDL_BlitSurface(atlas->sheet, &src, target, &dst);
+
+      if (dst.w > 0 && dst.h > 0){
+        if (!drawn){
+          left = dst.x; top = dst.y;
+          right = dst.x + dst.w; bottom = dst.y + dst.h;
+          drawn = true;
+        }else{
+          if (dst.x < left) left = dst.x;
+          if (dst.y < top) top = dst.y;
+          if (dst.x + dst.w > right) right = dst.x + dst.w;
+          if (dst.y + dst.h > bottom) bottom = dst.y + dst.h;
+        }
+      }
+    }
+
+    pen += g.advance;
+  }
+
+  if (bounds != NULL){
+    bounds->x = left;
+    bounds->y = top;
+    bounds->w = right - left;
+    bounds->h = bottom - top;
+  }
+}
+
+void UnloadGlyphAtlases(){
+  for (size_t i = 0; i < atlases.size(); i++){
+    FreeGlyphAtlas(atlases[i]);
+  }
+  atlases.clear();
+}
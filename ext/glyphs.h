@@ -0,0 +1,27 @@
+#ifndef RUG_GLYPHS_H
+#define RUG_GLYPHS_H
+
+#include <SDL/SDL.h>
+#include <SDL/SDL_ttf.h>
+
+typedef struct {
+  SDL_Rect rect;   // where the glyph is in the sheet, w is 0 if there is none
+  int minx, yoffset, advance;
+} RugGlyph;
+
+// All the Latin-1 glyphs of one font rendered in one colour
+typedef struct {
+  TTF_Font * font;
+  SDL_Color colour;
+  bool solid;
+
+  SDL_Surface * sheet;
+  RugGlyph glyphs[256];
+  unsigned long lastUsed;
+} RugGlyphAtlas;
+
+RugGlyphAtlas * GetGlyphAtlas(TTF_Font *, SDL_Color, bool solid);
+void DrawGlyphText(RugGlyphAtlas *, const char *, SDL_Surface *, int x, int y, SDL_Rect * bounds = NULL);
+void UnloadGlyphAtlases();
+
+#endif //RUG_GLYPHS_H
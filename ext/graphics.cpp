@@ -1,34 +1,158 @@
 #include "graphics.h"
 #include "conf.h"
+#include "colour.h"
+#include "glyphs.h"
+#include "compositor.h"
+#include "profiler.h"
 
 #include <SDL/SDL.h>
 #include <SDL/SDL_ttf.h>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
 
 extern SDL_Surface * mainWnd;
 extern _RugConf RugConf;
 
 _RugGraphics RugGraphics;
 extern VALUE block_converter;
+VALUE exec_converter;
 VALUE cRugGraphics;
 
+// In dirty rectangle mode these are the areas of the screen that were
+// drawn on last frame and this frame
+static vector<SDL_Rect> lastDirty, thisDirty;
+static bool fullRedraw = true;
+
+// Past this many rectangles it is cheaper to redraw the whole screen
+static const size_t MAX_DIRTY_RECTS = 256;
+
 void SetGraphicsFunc(VALUE func){
   RugGraphics.renderFunc = func;
   rb_iv_set(cRugGraphics, "@render_func", func); // Add reference for GC
 }
 
-void RenderGraphics(){
+// Records an area of the screen that was drawn on, so that it gets
+// cleared and updated when using dirty rectangles. SDL_UpdateRects doesn't
+// clip, so only the part that is on the screen is kept.
+void MarkDirty(const SDL_Rect & rect){
+  if (!RugConf.dirtyRects || mainWnd == NULL){
+    return;
+  }
+
+  int x0 = max((int)rect.x, 0), y0 = max((int)rect.y, 0);
+  int x1 = min((int)rect.x + (int)rect.w, mainWnd->w);
+  int y1 = min((int)rect.y + (int)rect.h, mainWnd->h);
+  if (x1 <= x0 || y1 <= y0){
+    return;
+  }
+
+  SDL_Rect clipped;
+  clipped.x = x0;
+  clipped.y = y0;
+  clipped.w = x1 - x0;
+  clipped.h = y1 - y0;
+  thisDirty.push_back(clipped);
+}
+
+// Clears part of the screen back to the background, or all of it if
+// rect is NULL
+static void ClearScreen(SDL_Rect * rect){
+  // TODO: make background colour configurable
+  SDL_FillRect(mainWnd, rect, SDL_MapRGB(mainWnd->format, 0, 0, 0));
+
   if (RugConf.background != NULL){
-    SDL_BlitSurface(RugConf.background, NULL, mainWnd, NULL);
+    if (rect == NULL){
+      SDL_BlitSurface(RugConf.background, NULL, mainWnd, NULL);
+    }else{
+      SDL_Rect src = *rect, dst = *rect;
+      SDL_BlitSurface(RugConf.background, &src, mainWnd, &dst);
+    }
+  }
+}
+
+// Sends the changed parts of the screen to the display
+static void PresentScreen(){
+  if (!RugConf.dirtyRects){
+    SDL_UpdateRect(mainWnd, 0, 0, 0, 0);
+    SDL_Flip(mainWnd);
+    return;
+  }
+
+  if (fullRedraw || lastDirty.size() + thisDirty.size() > MAX_DIRTY_RECTS){
+    SDL_UpdateRect(mainWnd, 0, 0, 0, 0);
+  }else{
+    // what was drawn last frame has been erased, so that needs updating too
+    lastDirty.insert(lastDirty.end(), thisDirty.begin(), thisDirty.end());
+    if (!lastDirty.empty()){
+      SDL_UpdateRects(mainWnd, lastDirty.size(), &lastDirty[0]);
+    }
+  }
+
+  fullRedraw = thisDirty.size() > MAX_DIRTY_RECTS;
+  lastDirty.swap(thisDirty);
+  thisDirty.clear();
+}
+
+// FNV-1a over the visible pixels of the screen, skipping row padding
+Uint32 ScreenChecksum(){
+  if (SDL_MUSTLOCK(mainWnd)){
+    SDL_LockSurface(mainWnd);
+  }
+
+  Uint32 hash = 2166136261u;
+  int rowBytes = mainWnd->w * mainWnd->format->BytesPerPixel;
+  for (int y = 0; y < mainWnd->h; y++){
+    Uint8 * row = (Uint8 *)mainWnd->pixels + y * mainWnd->pitch;
+    for (int i = 0; i < rowBytes; i++){
+      hash = (hash ^ row[i]) * 16777619u;
+    }
+  }
+
+  if (SDL_MUSTLOCK(mainWnd)){
+    SDL_UnlockSurface(mainWnd);
+  }
+
+  return hash;
+}
+
+// If alpha is not nil it is passed on to the draw block, this is used
+// for interpolating when running with a fixed time step
+void RenderGraphics(VALUE alpha){
+  ProfileBegin("clear");
+  if (RugConf.dirtyRects && !fullRedraw){
+    // only erase what was drawn last frame
+    for (size_t i = 0; i < lastDirty.size(); i++){
+      ClearScreen(&lastDirty[i]);
+    }
+  }else{
+    ClearScreen(NULL);
   }
+  ProfileEnd();
+
+  BeginComposite();
 
   if (RugGraphics.renderFunc != Qnil){
-    rb_funcall(block_converter, rb_intern("call"), 3, RugGraphics.graphicsObj, rb_str_new2("instance_eval"), RugGraphics.renderFunc);
+    ProfileBegin("draw");
+    if (alpha == Qnil){
+      rb_funcall(block_converter, rb_intern("call"), 3, RugGraphics.graphicsObj, rb_str_new2("instance_eval"), RugGraphics.renderFunc);
+    }else{
+      rb_funcall(exec_converter, rb_intern("call"), 3, RugGraphics.graphicsObj, RugGraphics.renderFunc, alpha);
+    }
+    ProfileEnd();
   }
-  SDL_UpdateRect(mainWnd, 0, 0, 0, 0);
-  SDL_Flip(mainWnd);
+
+  ProfileBegin("composite");
+  EndComposite();
+  ProfileEnd();
+
+  ProfileBegin("present");
+  PresentScreen();
+  ProfileEnd();
 }
 
-static VALUE RugDrawText(VALUE self, VALUE rx, VALUE ry, VALUE rtext, SDL_Surface * (*renderFunc)(TTF_Font *, const char *, SDL_Color)){
+static VALUE RugDrawText(VALUE self, VALUE rx, VALUE ry, VALUE rtext, bool solid){
   if (RugGraphics.font == NULL){
     return Qnil;
   }
@@ -38,28 +162,30 @@ static VALUE RugDrawText(VALUE self, VALUE rx, VALUE ry, VALUE rtext, SDL_Surfac
 
   const char * text = STR2CSTR(rtext);
 
-  SDL_Surface * fontText = renderFunc(RugGraphics.font, text, RugGraphics.foreColourS);
+  RugGlyphAtlas * atlas = GetGlyphAtlas(RugGraphics.font, RugGraphics.foreColourS, solid);
 
-  SDL_Rect dst;
-  dst.x = x;
-  dst.y = y;
-  dst.w = dst.h = 0;
+  // text is drawn straight onto the screen, so it has to go on top of
+  // anything that is waiting
+  FlushComposite();
 
-  SDL_BlitSurface(fontText, NULL, SDL_GetVideoSurface(), &dst);
-  SDL_FreeSurface(fontText);
+  SDL_Rect bounds;
+  DrawGlyphText(atlas, text, SDL_GetVideoSurface(), x, y, &bounds);
+  MarkDirty(bounds);
 
   return rtext;
 }
 
 static VALUE RugDrawTextFast(VALUE self, VALUE rx, VALUE ry, VALUE rtext){
-  return RugDrawText(self, rx, ry, rtext, TTF_RenderText_Solid);
+  return RugDrawText(self, rx, ry, rtext, true);
 }
 
 static VALUE RugDrawTextNice(VALUE self, VALUE rx, VALUE ry, VALUE rtext){
-  return RugDrawText(self, rx, ry, rtext, TTF_RenderText_Blended);
+  return RugDrawText(self, rx, ry, rtext, false);
 }
 
 void UnloadGraphics(){
+  UnloadGlyphAtlases();
+
   if (RugGraphics.font != NULL){
     TTF_CloseFont(RugGraphics.font);
   }
@@ -88,12 +214,9 @@ static void SetBackColour(int r, int g, int b, int a){
  * Sets the foreground colour of the graphics object.
  */
 static VALUE GraphicsSetFore(VALUE klass, VALUE colour){
-  Uint8 r = FIX2INT(rb_iv_get(colour, "@r"));
-  Uint8 g = FIX2INT(rb_iv_get(colour, "@g"));
-  Uint8 b = FIX2INT(rb_iv_get(colour, "@b"));
-  Uint8 a = FIX2INT(rb_iv_get(colour, "@a"));
+  Uint32 rgba = ColourToGfx(colour);
 
-  SetForeColour(r, g, b, a);
+  SetForeColour(rgba >> 24, (rgba >> 16) & 0xFF, (rgba >> 8) & 0xFF, rgba & 0xFF);
 
   return colour;
 }
@@ -102,12 +225,9 @@ static VALUE GraphicsSetFore(VALUE klass, VALUE colour){
  * Sets the background colour of the graphics object.
  */
 static VALUE GraphicsSetBack(VALUE klass, VALUE colour){
-  Uint8 r = FIX2INT(rb_iv_get(colour, "@r"));
-  Uint8 g = FIX2INT(rb_iv_get(colour, "@g"));
-  Uint8 b = FIX2INT(rb_iv_get(colour, "@b"));
-  Uint8 a = FIX2INT(rb_iv_get(colour, "@a"));
+  Uint32 rgba = ColourToGfx(colour);
 
-  SetBackColour(r, g, b, a);
+  SetBackColour(rgba >> 24, (rgba >> 16) & 0xFF, (rgba >> 8) & 0xFF, rgba & 0xFF);
 
   return colour;
 }
@@ -139,6 +259,9 @@ void LoadGraphics(VALUE mRug){
   RugGraphics.graphicsObj = rb_funcall(cRugGraphics, rb_intern("new"), 0);
   RugGraphics.renderFunc = Qnil;
 
+  exec_converter = rb_eval_string("proc { |recv, block, arg| recv.instance_exec(arg, &block) }");
+  rb_iv_set(cRugGraphics, "@exec_converter", exec_converter);
+
   SetForeColour(255, 255, 255, 255);
   SetBackColour(0, 0, 0, 255);
 
@@ -15,7 +15,9 @@ typedef struct {
 } _RugGraphics;
 
 void LoadGraphics(VALUE);
-void RenderGraphics();
+void RenderGraphics(VALUE alpha = Qnil);
+void MarkDirty(const SDL_Rect &);
 void SetGraphicsFunc(VALUE);
+Uint32 ScreenChecksum();
 
 #endif //RUG_GRAPHICS_H
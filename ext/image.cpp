@@ -1,32 +1,172 @@
 #include "defs.h"
 #include "image.h"
 #include "layer.h"
+#include "graphics.h"
+#include "flip.h"
+#include "blit.h"
+#include "compositor.h"
+#include "pixels.h"
+#include "batch.h"
+#include "colour.h"
 
 #include <SDL/SDL_image.h>
 #include <SDL/SDL_rotozoom.h>
-#include <SDL/SDL_gfxBlitFunc.h>
 #include <SDL/SDL_gfxPrimitives.h>
 #include <stdlib.h>
 #include <string.h>
+#include <map>
+#include <string>
+
+using namespace std;
 
 VALUE cRugImage;
 
 extern SDL_Surface * mainWnd;
 
+// Images loaded from files are shared by path. The cache doesn't hold a
+// reference itself. The surface's refcount can't say when to drop an
+// entry, since deferred blits hold references too, so the cache counts
+// the images using each surface and drops it when the last one is freed.
 typedef struct {
-  SDL_Surface * image;
-  Uint32 foreColour, backColour;
-} RugImage;
+  string path;
+  int users;
+} RugCachedSurface;
+
+static map<string, SDL_Surface *> imageCache;
+static map<SDL_Surface *, RugCachedSurface> cachedPaths;
+
+// Converts a surface to the format of the screen so that blitting it
+// doesn't need a conversion every time. The original is freed. Images
+// with no alpha or colour key stay opaque, so they can be blitted without
+// blending.
+SDL_Surface * ConvertToDisplay(SDL_Surface * surface){
+  if (surface == NULL || SDL_GetVideoSurface() == NULL){
+    return surface;
+  }
+
+  bool opaque = surface->format->Amask == 0 && !(surface->flags & SDL_SRCCOLORKEY);
+  SDL_Surface * converted = opaque ? SDL_DisplayFormat(surface) : SDL_DisplayFormatAlpha(surface);
+  if (converted == NULL){
+    return surface;
+  }
+
+  SDL_FreeSurface(surface);
+  return converted;
+}
+
+// Makes a private copy of a surface, including its colour key and alpha
+static SDL_Surface * CopySurface(SDL_Surface * surface){
+  return SDL_ConvertSurface(surface, surface->format,
+      surface->flags & (SDL_SWSURFACE | SDL_HWSURFACE | SDL_SRCCOLORKEY | SDL_SRCALPHA));
+}
+
+// Gets a new reference to the image loaded from filename for an image to
+// use, or NULL if it isn't loaded
+SDL_Surface * FindCachedSurface(const char * filename){
+  map<string, SDL_Surface *>::iterator it = imageCache.find(filename);
+  if (it != imageCache.end()){
+    it->second->refcount++;
+    cachedPaths[it->second].users++;
+    return it->second;
+  }
+  return NULL;
+}
+
+// Adds a freshly loaded surface to the cache. If the file was loaded
+// in the meantime, the new surface is freed and the cached one is used.
+SDL_Surface * CacheSurface(const char * filename, SDL_Surface * surface){
+  SDL_Surface * cached = FindCachedSurface(filename);
+  if (cached != NULL){
+    SDL_FreeSurface(surface);
+    return cached;
+  }
+
+  RugCachedSurface entry;
+  entry.path = filename;
+  entry.users = 1;
+
+  imageCache[filename] = surface;
+  cachedPaths[surface] = entry;
+
+  return surface;
+}
+
+static SDL_Surface * LoadCachedSurface(const char * filename){
+  SDL_Surface * surface = FindCachedSurface(filename);
+  if (surface != NULL){
+    return surface;
+  }
+
+  surface = ConvertToDisplay(IMG_Load(filename));
+  if (surface == NULL){
+    return NULL;
+  }
+
+  return CacheSurface(filename, surface);
+}
+
+// Drops a reference to an image's surface. Once no image is using a
+// cached surface it leaves the cache, even if a deferred blit still has
+// it, so the next load of the file doesn't get a surface about to be freed.
+static void ReleaseSurface(SDL_Surface * surface){
+  map<SDL_Surface *, RugCachedSurface>::iterator it = cachedPaths.find(surface);
+  if (it != cachedPaths.end() && --it->second.users == 0){
+    imageCache.erase(it->second.path);
+    cachedPaths.erase(it);
+  }
+  SDL_FreeSurface(surface);
+}
+
+// This needs to be called before drawing on an image, so that other
+// images sharing its surface don't change as well. Surfaces are shared
+// by images loaded from the same file, which the cache counts, and by
+// rotations and pixel buffers, which only show up in the refcount. The
+// compositor's references are gone once it has been flushed.
+static void ModifyImage(RugImage * image){
+  FlushComposite();
+
+  if (image->rotations != NULL){
+    ClearRotationCache(image->rotations);
+  }
+
+  map<SDL_Surface *, RugCachedSurface>::iterator it = cachedPaths.find(image->image);
+  int users = (it != cachedPaths.end()) ? it->second.users : 1;
+
+  if (users > 1 || image->image->refcount > 1){
+    SDL_Surface * copy = CopySurface(image->image);
+    ReleaseSurface(image->image);
+    image->image = copy;
+  }else if (it != cachedPaths.end()){
+    // it no longer looks like the file, so don't hand it out for it
+    imageCache.erase(it->second.path);
+    cachedPaths.erase(it);
+  }
+}
 
 static void unload_image(void * vp){
   RugImage * rImage = (RugImage *)vp;
+  if (rImage->rotations != NULL){
+    FreeRotationCache(rImage->rotations);
+  }
   if (rImage->image != NULL){
-    SDL_FreeSurface(rImage->image);
+    ReleaseSurface(rImage->image);
   }
   rImage->image = NULL;
   free(rImage);
 }
 
+// Wraps a surface in a new Rug::Image, which takes the reference
+VALUE WrapImage(SDL_Surface * surface){
+  RugImage * rImage = ALLOC(RugImage);
+
+  rImage->image = surface;
+  rImage->foreColour = GfxColour(0, 0, 0, 255);
+  rImage->backColour = GfxColour(255, 255, 255, 255);
+  rImage->rotations = NULL;
+
+  return Data_Wrap_Struct(cRugImage, NULL, unload_image, rImage);
+}
+
 /*
  * Two version:
  *   Image.new(_filename_)
@@ -34,14 +174,18 @@ static void unload_image(void * vp){
  *
  * The first loads the image from a file, the second creates a blank
  * image with a specified width and height.
+ *
+ * Loaded images are converted to the format of the screen, and loading
+ * the same file again shares the pixel data with the images that are
+ * already loaded until one of them is drawn on.
  */
 static VALUE new_image(int argc, VALUE * argv, VALUE klass){
-  VALUE filename, width, height;
+  VALUE filename, height;
 
   rb_scan_args(argc, argv, "11", &filename, &height);
 
   if (height == Qnil){
-    SDL_Surface * image = IMG_Load(STR2CSTR(filename));
+    SDL_Surface * image = LoadCachedSurface(STR2CSTR(filename));
 
     if (!image){
       // throw exception
@@ -49,13 +193,7 @@ static VALUE new_image(int argc, VALUE * argv, VALUE klass){
       snprintf(buffer, 1024, "Unable to load image: %s", STR2CSTR(filename));
       rb_raise(rb_eIOError, buffer);
     }else{
-      RugImage * rImage = ALLOC(RugImage);
-
-      rImage->image = image;
-      rImage->foreColour = SDL_MapRGBA(image->format, 0, 0, 0, 255);
-      rImage->backColour = SDL_MapRGBA(image->format, 255, 255, 255, 255);
-
-      return Data_Wrap_Struct(cRugImage, NULL, unload_image, rImage);
+      return WrapImage(image);
     }
   }else{
     // filename contains the width
@@ -64,16 +202,14 @@ static VALUE new_image(int argc, VALUE * argv, VALUE klass){
     w = FIX2INT(filename);
     h = FIX2INT(height);
 
-    RugImage * rImage = ALLOC(RugImage);
-
-    rImage->image = SDL_CreateRGBSurface(SDL_HWSURFACE,
+    SDL_Surface * image = SDL_CreateRGBSurface(SDL_HWSURFACE,
         w, h, 32,
         RED_MASK, GREEN_MASK, BLUE_MASK, ALPHA_MASK);
 
-    Uint32 clear = SDL_MapRGBA(rImage->image->format, 0, 0, 0, 0);
-    SDL_FillRect(rImage->image, NULL, clear);
+    Uint32 clear = SDL_MapRGBA(image->format, 0, 0, 0, 0);
+    SDL_FillRect(image, NULL, clear);
 
-    return Data_Wrap_Struct(cRugImage, NULL, unload_image, rImage);
+    return WrapImage(image);
   }
 
   return Qnil;
@@ -97,6 +233,101 @@ static VALUE get_image_height(VALUE self){
   return INT2FIX(image->image->h);
 }
 
+/*
+ * Locks the image and passes a Rug::PixelBuffer over its pixels to the
+ * block, so they can be read and written in place. The buffer can't be
+ * used once the block returns. Changing the image in other ways inside
+ * the block gives it new pixels that the buffer doesn't see.
+ *
+ * Usage:
+ *
+ *    image.pixels do |buffer|
+ *      buffer[10, 10] = 0xFF0000FF
+ *    end
+ */
+static VALUE image_pixels(VALUE self){
+  RugImage * image;
+  Data_Get_Struct(self, RugImage, image);
+
+  ModifyImage(image);
+  return YieldPixelBuffer(image->image);
+}
+
+/*
+ * Gets the pixels in the rectangle at _x_, _y_ of size _w_ x _h_ as a
+ * String, one row after another with no padding, each pixel in the
+ * image's own format. Leaving out the rectangle gets the whole image.
+ */
+static VALUE image_get_pixels(int argc, VALUE * argv, VALUE self){
+  RugImage * image;
+  Data_Get_Struct(self, RugImage, image);
+  return GetPixels(image->image, argc, argv);
+}
+
+/*
+ * Copies pixels from a String laid out like the one get_pixels returns
+ * into the rectangle at _x_, _y_ of size _w_ x _h_, or the whole image if
+ * the rectangle is left out.
+ */
+static VALUE image_put_pixels(int argc, VALUE * argv, VALUE self){
+  RugImage * image;
+  Data_Get_Struct(self, RugImage, image);
+
+  ModifyImage(image);
+  return PutPixels(image->image, argc, argv);
+}
+
+// Blits part of a surface onto the screen or a layer's surface, without
+// marking anything dirty. dst gets the area that was drawn on. Callers
+// drawing onto a layer need to call FlushComposite first.
+void BlitOnto(SDL_Surface * surface, SDL_Rect * src, SDL_Rect & dst, SDL_Surface * target){
+  if (target == mainWnd){
+    if (!DeferBlit(surface, src, &dst)){
+      SDL_BlitSurface(surface, src, mainWnd, &dst);
+    }
+  }else if (surface->format->Amask == 0 && !(surface->flags & SDL_SRCCOLORKEY)){
+    // opaque images have nothing to blend, and SDL_gfx would take their
+    // missing alpha as 0
+    SDL_BlitSurface(surface, src, target, &dst);
+  }else{
+    // Strange bug, if blitting an image directly to the screen
+    // the green is always maxed to 255. Blending the way SDL_gfx does
+    // seems to fix it.
+    BlendBlit(surface, src, target, &dst);
+  }
+}
+
+// Gets the surface to draw on for a layer, or the screen if it is nil
+SDL_Surface * TargetSurface(VALUE targetLayer){
+  if (targetLayer == Qnil){
+    return mainWnd;
+  }
+
+  RugLayer * layer;
+  Data_Get_Struct(targetLayer, RugLayer, layer);
+  return layer->layer;
+}
+
+// Draws part of a surface (or all of it if src is NULL) at x, y on the
+// screen, or on a layer if targetLayer isn't nil
+void DrawSurface(SDL_Surface * surface, SDL_Rect * src, int x, int y, VALUE targetLayer){
+  SDL_Rect dst;
+  dst.x = x;
+  dst.y = y;
+  dst.w = dst.h = 0;
+
+  SDL_Surface * target = TargetSurface(targetLayer);
+  if (target != mainWnd){
+    FlushComposite();
+  }
+
+  BlitOnto(surface, src, dst, target);
+
+  if (target == mainWnd){
+    MarkDirty(dst);
+  }
+}
+
 /*
  * Draws the image at _x_, _y_. If a width and height are passed, then only
  * a subsection of the image will drawn, with width and height equal to the
@@ -128,27 +359,9 @@ static VALUE blit_image(int argc, VALUE * argv, VALUE self){
     RugImage * image;
     Data_Get_Struct(self, RugImage, image);
 
-    SDL_Rect src, dst;
-
-    SDL_Surface * target;
-
-    bool use_gfx = false;
-
-    if (targetLayer == Qnil){
-      target = mainWnd;
-    }else{
-      use_gfx = true;
-
-      RugLayer * layer;
-      Data_Get_Struct(targetLayer, RugLayer, layer);
-      target = layer->layer;
-    }
-
-    dst.x = FIX2INT(x);
-    dst.y = FIX2INT(y);
-    dst.w = dst.h = 0;
-
     if (width != Qnil){
+      SDL_Rect src;
+
       src.w = FIX2INT(width);
 
       src.h = (height != Qnil) ? FIX2INT(height) : src.w;
@@ -156,19 +369,9 @@ static VALUE blit_image(int argc, VALUE * argv, VALUE self){
       src.x = (sx != Qnil) ? FIX2INT(sx) : 0;
       src.y = (sy != Qnil) ? FIX2INT(sy) : 0;
 
-      // Strange bug, if blitting an image directly to the screen
-      // the green is always maxed to 255. This seems to fix it.
-      if (use_gfx){
-        SDL_gfxBlitRGBA(image->image, &src, target, &dst);
-      }else{
-        SDL_BlitSurface(image->image, &src, target, &dst);
-      }
+      DrawSurface(image->image, &src, FIX2INT(x), FIX2INT(y), targetLayer);
     }else{
-      if (use_gfx){
-        SDL_gfxBlitRGBA(image->image, NULL, target, &dst);
-      }else{
-        SDL_BlitSurface(image->image, NULL, target, &dst);
-      }
+      DrawSurface(image->image, NULL, FIX2INT(x), FIX2INT(y), targetLayer);
     }
   }
 
@@ -177,17 +380,105 @@ static VALUE blit_image(int argc, VALUE * argv, VALUE self){
 
 /*
  * Rotates an image by _degrees_ degrees. This method does not
- * affect the image itself, but returns a new image.
+ * affect the image itself, but returns a new image. If the image caches
+ * its rotations, the angle is rounded to the nearest cached step.
  */
 static VALUE rotate_image(VALUE self, VALUE degrees){
   RugImage * image;
   Data_Get_Struct(self, RugImage, image);
 
-  RugImage * rotated = ALLOC(RugImage);
+  SDL_Surface * rotated;
+  if (image->rotations != NULL){
+    rotated = GetRotation(image->rotations, image->image, NUM2DBL(degrees));
+    if (rotated != NULL){
+      rotated->refcount++;
+    }
+  }else{
+    rotated = rotozoomSurface(image->image, NUM2DBL(degrees), 1.0, SMOOTHING_ON);
+  }
 
-  rotated->image = rotozoomSurface(image->image, NUM2DBL(degrees), 1.0, SMOOTHING_ON);
+  if (rotated == NULL){
+    rb_raise(rb_eNoMemError, "Unable to rotate image");
+  }
 
-  return Data_Wrap_Struct(cRugImage, NULL, unload_image, rotated);
+  return WrapImage(rotated);
+}
+
+/*
+ * Makes the image remember its rotations. Angles passed to rotate and
+ * draw_rotated are rounded to one of _steps_ directions, and each
+ * direction is only rendered the first time it is used. All the cached
+ * rotations share the memory set with Rug::Conf#rotation_cache, and the
+ * ones that haven't been used for the longest are dropped first. Passing
+ * 0 or nil turns the cache off again.
+ *
+ * Usage:
+ *
+ *    ship = Rug::Image.new "ship.png"
+ *    ship.cache_rotations 64
+ *
+ *    Rug.draw do
+ *      ship.draw_rotated x, y, heading
+ *    end
+ */
+static VALUE image_cache_rotations(VALUE self, VALUE steps){
+  RugImage * image;
+  Data_Get_Struct(self, RugImage, image);
+
+  int numSteps = (steps == Qnil || steps == Qfalse) ? 0 : NUM2INT(steps);
+
+  if (image->rotations != NULL){
+    if (RotationCacheSteps(image->rotations) == numSteps){
+      return steps;
+    }
+    FreeRotationCache(image->rotations);
+    image->rotations = NULL;
+  }
+
+  if (numSteps > 0){
+    image->rotations = NewRotationCache(numSteps);
+  }
+
+  return steps;
+}
+
+/*
+ * Draws the image rotated by _degrees_ degrees. The rotated image is
+ * centred where the middle of the unrotated image would be if it was
+ * drawn at _x_, _y_. If a layer is passed it is drawn onto the layer
+ * instead of the screen.
+ */
+static VALUE image_draw_rotated(int argc, VALUE * argv, VALUE self){
+  if (mainWnd == NULL){
+    return self;
+  }
+
+  VALUE x, y, degrees, targetLayer;
+  rb_scan_args(argc, argv, "31", &x, &y, &degrees, &targetLayer);
+
+  RugImage * image;
+  Data_Get_Struct(self, RugImage, image);
+
+  SDL_Surface * rotated;
+  if (image->rotations != NULL){
+    rotated = GetRotation(image->rotations, image->image, NUM2DBL(degrees));
+  }else{
+    rotated = rotozoomSurface(image->image, NUM2DBL(degrees), 1.0, SMOOTHING_ON);
+  }
+
+  if (rotated == NULL){
+    return self;
+  }
+
+  DrawSurface(rotated, NULL,
+      FIX2INT(x) + (image->image->w - rotated->w) / 2,
+      FIX2INT(y) + (image->image->h - rotated->h) / 2, targetLayer);
+
+  if (image->rotations == NULL){
+    SDL_FreeSurface(rotated);
+  }
+
+  return self;
 }
 
 /*
@@ -201,10 +492,14 @@ static VALUE rotate_image_d(VALUE self, VALUE degrees){
   Data_Get_Struct(self, RugImage, image);
   Data_Get_Struct(res, RugImage, newImage);
 
-  SDL_FreeSurface(image->image);
+  ReleaseSurface(image->image);
   image->image = newImage->image;
   newImage->image = NULL;
 
+  if (image->rotations != NULL){
+    ClearRotationCache(image->rotations);
+  }
+
   return Qnil;
 }
 
@@ -225,11 +520,7 @@ static VALUE scale_image(int argc, VALUE * argv, VALUE self){
   RugImage * image;
   Data_Get_Struct(self, RugImage, image);
 
-  RugImage * scaled = ALLOC(RugImage);
-
-  scaled->image = zoomSurface(image->image, NUM2DBL(sx), NUM2DBL(sy), SMOOTHING_ON);
-
-  return Data_Wrap_Struct(cRugImage, NULL, unload_image, scaled);
+  return WrapImage(zoomSurface(image->image, NUM2DBL(sx), NUM2DBL(sy), SMOOTHING_ON));
 }
 
 /*
@@ -243,10 +534,14 @@ static VALUE scale_image_d(int argc, VALUE * argv, VALUE self){
   Data_Get_Struct(self, RugImage, image);
   Data_Get_Struct(res, RugImage, newImage);
 
-  SDL_FreeSurface(image->image);
+  ReleaseSurface(image->image);
   image->image = newImage->image;
   newImage->image = NULL;
 
+  if (image->rotations != NULL){
+    ClearRotationCache(image->rotations);
+  }
+
   return Qnil;
 }
 
@@ -257,45 +552,10 @@ static VALUE flip_h_image(VALUE self){
   RugImage * image;
   Data_Get_Struct(self, RugImage, image);
 
-  RugImage * newImage = ALLOC(RugImage);
-
-  SDL_PixelFormat * fmt = image->image->format;
-  newImage->image = SDL_CreateRGBSurface(SDL_HWSURFACE, image->image->w, image->image->h,
-      fmt->BitsPerPixel, fmt->Rmask, fmt->Gmask, fmt->Bmask, fmt->Amask);
-  
-  int x, y, i;
-  if (image->image->format->BitsPerPixel == 32){
-    Uint32 *src = (Uint32*)image->image->pixels;
-    Uint32 *dst = (Uint32*)newImage->image->pixels;
-    for (x = 0; x < image->image->w; x++){
-      for (y = 0; y < image->image->h; y++){
-        dst[x + y * image->image->w] = src[image->image->w - x - 1 + y * image->image->w];
-      }
-    }
-  }else if (image->image->format->BitsPerPixel == 16){
-    Uint16 *src = (Uint16*)image->image->pixels;
-    Uint16 *dst = (Uint16*)newImage->image->pixels;
-    for (x = 0; x < image->image->w; x++){
-      for (y = 0; y < image->image->h; y++){
-        dst[x + y * image->image->w] = src[image->image->w - x - 1 + y * image->image->w];
-      }
-    }
-  }else if (image->image->format->BitsPerPixel == 24){
-    Uint8 *src = (Uint8*)image->image->pixels;
-    Uint8 *dst = (Uint8*)newImage->image->pixels;
-    for (x = 0; x < image->image->w; x++){
-      for (y = 0; y < image->image->h; y++){
-        for (i = 0; i < 3; i++){
-          dst[3 * x + y * image->image->w * 3 + i] = src[(image->image->w - x - 1) * 3 + y * image->image->w * 3 + i];
-        }
-      }
-    }
-  }else{
-    // TODO: this, if necessary
-  }
-  SDL_UpdateRect(newImage->image, 0, 0, 0, 0);
+  SDL_Surface * flipped = CopySurface(image->image);
+  FlipSurfaceH(flipped);
 
-  return Data_Wrap_Struct(cRugImage, NULL, unload_image, newImage);
+  return WrapImage(flipped);
 }
 
 /*
@@ -305,79 +565,38 @@ static VALUE flip_v_image(VALUE self){
   RugImage * image;
   Data_Get_Struct(self, RugImage, image);
 
-  RugImage * newImage = ALLOC(RugImage);
-
-  SDL_PixelFormat * fmt = image->image->format;
-  newImage->image = SDL_CreateRGBSurface(SDL_HWSURFACE, image->image->w, image->image->h,
-      fmt->BitsPerPixel, fmt->Rmask, fmt->Gmask, fmt->Bmask, fmt->Amask);
-  
-  int x, y, i;
-  if (image->image->format->BitsPerPixel == 32){
-    Uint32 *src = (Uint32*)image->image->pixels;
-    Uint32 *dst = (Uint32*)newImage->image->pixels;
-    for (y = 0; y < image->image->h; y++){
-      for (x = 0; x < image->image->w; x++){
-        dst[x + y * image->image->w] = src[x + (image->image->h - y - 1) * image->image->w];
-      }
-    }
-  }else if (image->image->format->BitsPerPixel == 16){
-    Uint16 *src = (Uint16*)image->image->pixels;
-    Uint16 *dst = (Uint16*)newImage->image->pixels;
-    for (x = 0; x < image->image->w; x++){
-      for (y = 0; y < image->image->h; y++){
-        dst[x + y * image->image->w] = src[x + (image->image->h - y - 1) * image->image->w];
-      }
-    }
-  }else if (image->image->format->BitsPerPixel == 24){
-    Uint8 *src = (Uint8*)image->image->pixels;
-    Uint8 *dst = (Uint8*)newImage->image->pixels;
-    for (x = 0; x < image->image->w; x++){
-      for (y = 0; y < image->image->h; y++){
-        for (i = 0; i < 3; i++){
-          dst[3 * x + y * image->image->w * 3 + i] = src[3 * x + (image->image->h - y - 1) * image->image->w * 3 + i];
-        }
-      }
-    }
-  }else{
-    // TODO: this, if necessary
-  }
-  SDL_UpdateRect(newImage->image, 0, 0, 0, 0);
+  SDL_Surface * flipped = CopySurface(image->image);
+  FlipSurfaceV(flipped);
 
-  return Data_Wrap_Struct(cRugImage, NULL, unload_image, newImage);
+  return WrapImage(flipped);
 }
 
 /*
  * Flips an image horizontally: the current image is replaced by the
- * rotated version.
+ * flipped version. No new surface is made unless the image shares its
+ * pixels with another one.
  */
 static VALUE flip_h_image_d(VALUE self){
-  VALUE res = flip_h_image(self);
-
-  RugImage *image, *newImage;
+  RugImage * image;
   Data_Get_Struct(self, RugImage, image);
-  Data_Get_Struct(res, RugImage, newImage);
 
-  SDL_FreeSurface(image->image);
-  image->image = newImage->image;
-  newImage->image = NULL;
+  ModifyImage(image);
+  FlipSurfaceH(image->image);
 
   return Qnil;
 }
 
 /*
  * Flips an image vertically: the current image is replaced by the
- * rotated version.
+ * flipped version. No new surface is made unless the image shares its
+ * pixels with another one.
  */
 static VALUE flip_v_image_d(VALUE self){
-  VALUE res = flip_v_image(self);
-
-  RugImage *image, *newImage;
+  RugImage * image;
   Data_Get_Struct(self, RugImage, image);
-  Data_Get_Struct(res, RugImage, newImage);
 
-  SDL_FreeSurface(image->image);
-  image->image = newImage->image;
-  newImage->image = NULL;
+  ModifyImage(image);
+  FlipSurfaceV(image->image);
 
   return Qnil;
 }
@@ -386,15 +605,10 @@ static VALUE flip_v_image_d(VALUE self){
  * Sets the foreground colour of the image.
  */
 static VALUE set_fore_colour(VALUE self, VALUE colour){
-  Uint8 r = FIX2INT(rb_iv_get(colour, "@r"));
-  Uint8 g = FIX2INT(rb_iv_get(colour, "@g"));
-  Uint8 b = FIX2INT(rb_iv_get(colour, "@b"));
-  Uint8 a = FIX2INT(rb_iv_get(colour, "@a"));
-
   RugImage *image;
   Data_Get_Struct(self, RugImage, image);
 
-  image->foreColour = SDL_MapRGBA(image->image->format, r, g, b, a);
+  image->foreColour = ColourToGfx(colour);
 
   return colour;
 }
@@ -403,15 +617,10 @@ static VALUE set_fore_colour(VALUE self, VALUE colour){
  * Sets the background colour of the image.
  */
 static VALUE set_back_colour(VALUE self, VALUE colour){
-  Uint8 r = FIX2INT(rb_iv_get(colour, "@r"));
-  Uint8 g = FIX2INT(rb_iv_get(colour, "@g"));
-  Uint8 b = FIX2INT(rb_iv_get(colour, "@b"));
-  Uint8 a = FIX2INT(rb_iv_get(colour, "@a"));
-
   RugImage *image;
   Data_Get_Struct(self, RugImage, image);
 
-  image->backColour = SDL_MapRGBA(image->image->format, r, g, b, a);
+  image->backColour = ColourToGfx(colour);
 
   return colour;
 }
@@ -429,6 +638,7 @@ static VALUE set_back_colour(VALUE self, VALUE colour){
 static VALUE image_draw_pie(VALUE self, VALUE x, VALUE y, VALUE rad, VALUE start, VALUE end){
   RugImage *image;
   Data_Get_Struct(self, RugImage, image);
+  ModifyImage(image);
 
   // do a transformation since SDL_gfx has a weird system
   int angle_s = 360 - FIX2INT(end);
@@ -452,6 +662,7 @@ static VALUE image_draw_pie(VALUE self, VALUE x, VALUE y, VALUE rad, VALUE start
 static VALUE image_fill_pie(VALUE self, VALUE x, VALUE y, VALUE rad, VALUE start, VALUE end){
   RugImage *image;
   Data_Get_Struct(self, RugImage, image);
+  ModifyImage(image);
 
   // do a transformation since SDL_gfx has a weird system
   int angle_s = 360 - FIX2INT(end);
@@ -473,6 +684,7 @@ static VALUE image_fill_pie(VALUE self, VALUE x, VALUE y, VALUE rad, VALUE start
 static VALUE image_draw_rect(VALUE self, VALUE l, VALUE t, VALUE r, VALUE b){
   RugImage *image;
   Data_Get_Struct(self, RugImage, image);
+  ModifyImage(image);
 
   rectangleColor(image->image, FIX2INT(l), FIX2INT(t), FIX2INT(r), FIX2INT(b), image->foreColour);
 
@@ -490,6 +702,7 @@ static VALUE image_draw_rect(VALUE self, VALUE l, VALUE t, VALUE r, VALUE b){
 static VALUE image_fill_rect(VALUE self, VALUE l, VALUE t, VALUE r, VALUE b){
   RugImage *image;
   Data_Get_Struct(self, RugImage, image);
+  ModifyImage(image);
 
   boxColor(image->image, FIX2INT(l), FIX2INT(t), FIX2INT(r), FIX2INT(b), image->backColour);
 
@@ -506,6 +719,7 @@ static VALUE image_fill_rect(VALUE self, VALUE l, VALUE t, VALUE r, VALUE b){
 static VALUE image_draw_circle(VALUE self, VALUE x, VALUE y, VALUE r){
   RugImage *image;
   Data_Get_Struct(self, RugImage, image);
+  ModifyImage(image);
 
   circleColor(image->image, FIX2INT(x), FIX2INT(y), FIX2INT(r), image->foreColour);
 
@@ -522,12 +736,107 @@ static VALUE image_draw_circle(VALUE self, VALUE x, VALUE y, VALUE r){
 static VALUE image_fill_circle(VALUE self, VALUE x, VALUE y, VALUE r){
   RugImage *image;
   Data_Get_Struct(self, RugImage, image);
+  ModifyImage(image);
 
   filledCircleColor(image->image, FIX2INT(x), FIX2INT(y), FIX2INT(r), image->backColour);
 
   return Qnil;
 }
 
+/*
+ * Fills many rectangles in one call. _rects_ is a flat array of _l_, _t_,
+ * _r_, _b_ for each rectangle, or the same packed as native int16s with
+ * <tt>pack("s*")</tt>.
+ *
+ * _colours_: Optional. Nil for the current background colour, a single
+ * colour, or one per rectangle as an array of colours and 0xRRGGBBAA
+ * numbers or a string packed with <tt>pack("L*")</tt>
+ */
+static VALUE image_fill_rects(int argc, VALUE * argv, VALUE self){
+  VALUE rects, colours;
+  rb_scan_args(argc, argv, "11", &rects, &colours);
+
+  RugImage *image;
+  Data_Get_Struct(self, RugImage, image);
+  ModifyImage(image);
+
+  BatchFillRects(image->image, rects, colours, image->backColour);
+
+  return Qnil;
+}
+
+/*
+ * Draws the outlines of many rectangles in one call, using the current
+ * foreground colour unless _colours_ are given. Takes the same arguments as
+ * fill_rects.
+ */
+static VALUE image_draw_rects(int argc, VALUE * argv, VALUE self){
+  VALUE rects, colours;
+  rb_scan_args(argc, argv, "11", &rects, &colours);
+
+  RugImage *image;
+  Data_Get_Struct(self, RugImage, image);
+  ModifyImage(image);
+
+  BatchDrawRects(image->image, rects, colours, image->foreColour);
+
+  return Qnil;
+}
+
+/*
+ * Fills many circles in one call. _circles_ is a flat array of _x_, _y_,
+ * _r_ for each circle, or the same packed as native int16s. _colours_ work
+ * like they do for fill_rects.
+ */
+static VALUE image_fill_circles(int argc, VALUE * argv, VALUE self){
+  VALUE circles, colours;
+  rb_scan_args(argc, argv, "11", &circles, &colours);
+
+  RugImage *image;
+  Data_Get_Struct(self, RugImage, image);
+  ModifyImage(image);
+
+  BatchFillCircles(image->image, circles, colours, image->backColour);
+
+  return Qnil;
+}
+
+/*
+ * Draws the outlines of many circles in one call, using the current
+ * foreground colour unless _colours_ are given. Takes the same arguments as
+ * fill_circles.
+ */
+static VALUE image_draw_circles(int argc, VALUE * argv, VALUE self){
+  VALUE circles, colours;
+  rb_scan_args(argc, argv, "11", &circles, &colours);
+
+  RugImage *image;
+  Data_Get_Struct(self, RugImage, image);
+  ModifyImage(image);
+
+  BatchDrawCircles(image->image, circles, colours, image->foreColour);
+
+  return Qnil;
+}
+
+/*
+ * Draws many lines in one call, using the current foreground colour unless
+ * _colours_ are given. _lines_ is a flat array of _x1_, _y1_, _x2_, _y2_
+ * for each line, or the same packed as native int16s.
+ */
+static VALUE image_draw_lines(int argc, VALUE * argv, VALUE self){
+  VALUE lines, colours;
+  rb_scan_args(argc, argv, "11", &lines, &colours);
+
+  RugImage *image;
+  Data_Get_Struct(self, RugImage, image);
+  ModifyImage(image);
+
+  BatchDrawLines(image->image, lines, colours, image->foreColour);
+
+  return Qnil;
+}
+
 void LoadImageModule(VALUE rugModule){
   IMG_Init(IMG_INIT_JPG | IMG_INIT_PNG | IMG_INIT_TIF);
   atexit(IMG_Quit);
@@ -547,6 +856,8 @@ void LoadImageModule(VALUE rugModule){
   rb_define_method(cRugImage, "back_color=", (VALUE (*)(...))set_back_colour, 1);
 
   rb_define_method(cRugImage, "rotate", (VALUE (*)(...))rotate_image, 1);
+  rb_define_method(cRugImage, "cache_rotations", (VALUE (*)(...))image_cache_rotations, 1);
+  rb_define_method(cRugImage, "draw_rotated", (VALUE (*)(...))image_draw_rotated, -1);
   rb_define_method(cRugImage, "scale", (VALUE (*)(...))scale_image, -1);
   rb_define_method(cRugImage, "flip_h", (VALUE (*)(...))flip_h_image, 0);
   rb_define_method(cRugImage, "flip_v", (VALUE (*)(...))flip_v_image, 0);
@@ -556,6 +867,10 @@ void LoadImageModule(VALUE rugModule){
   rb_define_method(cRugImage, "flip_h!", (VALUE (*)(...))flip_h_image_d, 0);
   rb_define_method(cRugImage, "flip_v!", (VALUE (*)(...))flip_v_image_d, 0);
 
+  rb_define_method(cRugImage, "pixels", (VALUE (*)(...))image_pixels, 0);
+  rb_define_method(cRugImage, "get_pixels", (VALUE (*)(...))image_get_pixels, -1);
+  rb_define_method(cRugImage, "put_pixels", (VALUE (*)(...))image_put_pixels, -1);
+
   // TODO: Add in ellipses, rounded rectangles
   rb_define_method(cRugImage, "draw_rect", (VALUE (*)(...))image_draw_rect, 4);
   rb_define_method(cRugImage, "fill_rect", (VALUE (*)(...))image_fill_rect, 4);
@@ -563,5 +878,11 @@ void LoadImageModule(VALUE rugModule){
   rb_define_method(cRugImage, "fill_pie", (VALUE (*)(...))image_fill_pie, 5);
   rb_define_method(cRugImage, "draw_circle", (VALUE (*)(...))image_draw_circle, 3);
   rb_define_method(cRugImage, "fill_circle", (VALUE (*)(...))image_fill_circle, 3);
+
+  rb_define_method(cRugImage, "draw_rects", (VALUE (*)(...))image_draw_rects, -1);
+  rb_define_method(cRugImage, "fill_rects", (VALUE (*)(...))image_fill_rects, -1);
+  rb_define_method(cRugImage, "draw_circles", (VALUE (*)(...))image_draw_circles, -1);
+  rb_define_method(cRugImage, "fill_circles", (VALUE (*)(...))image_fill_circles, -1);
+  rb_define_method(cRugImage, "draw_lines", (VALUE (*)(...))image_draw_lines, -1);
 }
 
@@ -3,7 +3,26 @@
 
 #include "ruby.h"
 
+#include <SDL/SDL.h>
+
+#include "rotation.h"
+
+typedef struct {
+  SDL_Surface * image;
+  Uint32 foreColour, backColour;
+  RugRotationCache * rotations; // NULL unless cache_rotations was called
+} RugImage;
+
+extern VALUE cRugImage;
+
 void LoadImageModule(VALUE);
+void DrawSurface(SDL_Surface *, SDL_Rect *, int x, int y, VALUE targetLayer);
+void BlitOnto(SDL_Surface *, SDL_Rect * src, SDL_Rect & dst, SDL_Surface * target);
+SDL_Surface * TargetSurface(VALUE targetLayer);
+SDL_Surface * ConvertToDisplay(SDL_Surface *);
+SDL_Surface * FindCachedSurface(const char *);
+SDL_Surface * CacheSurface(const char *, SDL_Surface *);
+VALUE WrapImage(SDL_Surface *);
 
 #endif //RUG_IMAGE_H
 
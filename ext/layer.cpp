@@ -1,11 +1,16 @@
 #include "defs.h"
 #include "layer.h"
+#include "graphics.h"
+#include "compositor.h"
+#include "pixels.h"
 
 VALUE cRugLayer;
 
 extern SDL_Surface * mainWnd;
 
 void ClearLayer(RugLayer * rLayer){
+  FlushComposite();
+
   Uint32 clear = SDL_MapRGBA(rLayer->layer->format, 0, 0, 0, 0);
   SDL_FillRect(rLayer->layer, NULL, clear);
 }
@@ -82,11 +87,12 @@ static VALUE RugDrawLayer(int argc, VALUE * argv, VALUE self){
     target = layer->layer;
   }
 
+  SDL_Rect dst, src;
+  SDL_Rect * from = NULL;
+
   if (x == Qnil){
-    SDL_BlitSurface(rLayer->layer, NULL, target, NULL);
+    dst.x = dst.y = 0;
   }else{
-    SDL_Rect dst, src;
-
     dst.x = FIX2INT(x);
     dst.y = FIX2INT(y);
 
@@ -97,11 +103,18 @@ static VALUE RugDrawLayer(int argc, VALUE * argv, VALUE self){
       src.w = FIX2INT(width);
       src.h = FIX2INT(height);
 
-      SDL_BlitSurface(rLayer->layer, &src, target, &dst);
-    }else{
-      SDL_BlitSurface(rLayer->layer, NULL, target, &dst);
+      from = &src;
     }
   }
+
+  if (target != mainWnd || !DeferBlit(rLayer->layer, from, &dst)){
+    FlushComposite();
+    SDL_BlitSurface(rLayer->layer, from, target, &dst);
+  }
+
+  if (target == mainWnd){
+    MarkDirty(dst);
+  }
   return Qnil;
 }
 
@@ -133,6 +146,40 @@ static VALUE RugLayerHeight(VALUE self){
   return INT2FIX(rLayer->layer ? rLayer->layer->h : 0);
 }
 
+/*
+ * Locks the layer and passes a Rug::PixelBuffer over its pixels to the
+ * block, the same as Rug::Image#pixels.
+ */
+static VALUE RugLayerPixels(VALUE self){
+  RugLayer * rLayer;
+  Data_Get_Struct(self, RugLayer, rLayer);
+
+  FlushComposite();
+  return YieldPixelBuffer(rLayer->layer);
+}
+
+/*
+ * Gets pixels from the layer as a String, the same as
+ * Rug::Image#get_pixels.
+ */
+static VALUE RugLayerGetPixels(int argc, VALUE * argv, VALUE self){
+  RugLayer * rLayer;
+  Data_Get_Struct(self, RugLayer, rLayer);
+  return GetPixels(rLayer->layer, argc, argv);
+}
+
+/*
+ * Copies pixels from a String onto the layer, the same as
+ * Rug::Image#put_pixels.
+ */
+static VALUE RugLayerPutPixels(int argc, VALUE * argv, VALUE self){
+  RugLayer * rLayer;
+  Data_Get_Struct(self, RugLayer, rLayer);
+
+  FlushComposite();
+  return PutPixels(rLayer->layer, argc, argv);
+}
+
 void LoadLayer(VALUE mRug){
   // create conf class
   cRugLayer = rb_define_class_under(mRug, "Layer", rb_cObject);
@@ -142,4 +189,7 @@ void LoadLayer(VALUE mRug){
   rb_define_method(cRugLayer, "clear", (VALUE (*)(...))RugClearLayer, 0);
   rb_define_method(cRugLayer, "width", (VALUE (*)(...))RugLayerWidth, 0);
   rb_define_method(cRugLayer, "height", (VALUE (*)(...))RugLayerHeight, 0);
+  rb_define_method(cRugLayer, "pixels", (VALUE (*)(...))RugLayerPixels, 0);
+  rb_define_method(cRugLayer, "get_pixels", (VALUE (*)(...))RugLayerGetPixels, -1);
+  rb_define_method(cRugLayer, "put_pixels", (VALUE (*)(...))RugLayerPutPixels, -1);
 }
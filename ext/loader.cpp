@@ -0,0 +1,298 @@
+#include "loader.h"
+#include "image.h"
+#include "conf.h"
+
+#include <SDL/SDL.h>
+#include <SDL/SDL_image.h>
+#include <SDL/SDL_thread.h>
+#include <list>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+extern _RugConf RugConf;
+
+VALUE cRugImageLoad;
+
+static const int LOAD_PENDING = 0;
+static const int LOAD_DONE    = 1;
+static const int LOAD_FAILED  = 2;
+
+typedef struct {
+  string path;
+  SDL_Surface * surface; // decoded by the worker, converted when handed over
+  int state;
+  VALUE callback;
+  VALUE image;
+} RugImageLoad;
+
+// Jobs waiting for a worker, and jobs the workers have finished that the
+// main thread hasn't picked up yet. Both are guarded by loadLock.
+static list<RugImageLoad *> queuedLoads, finishedLoads;
+
+static vector<SDL_Thread *> workers;
+static SDL_mutex * loadLock = NULL;
+static SDL_cond * loadReady = NULL;
+static bool stopWorkers = false;
+
+// Handles that are in flight, so that they don't get collected while a
+// worker is using them
+static VALUE pendingHandles;
+
+static ID id_call;
+
+static int LoadWorker(void * unused){
+  SDL_LockMutex(loadLock);
+  while (1){
+    while (queuedLoads.empty() && !stopWorkers){
+      SDL_CondWait(loadReady, loadLock);
+    }
+    if (stopWorkers){
+      break;
+    }
+
+    RugImageLoad * load = queuedLoads.front();
+    queuedLoads.pop_front();
+
+    // decode without holding the lock, this is the slow part
+    SDL_UnlockMutex(loadLock);
+
+    SDL_Surface * surface = IMG_Load(load->path.c_str());
+
+    SDL_LockMutex(loadLock);
+    load->surface = surface;
+    finishedLoads.push_back(load);
+  }
+  SDL_UnlockMutex(loadLock);
+
+  return 0;
+}
+
+static void StopLoadWorkers(VALUE unused){
+  if (loadLock == NULL){
+    return;
+  }
+
+  SDL_LockMutex(loadLock);
+  stopWorkers = true;
+  SDL_CondBroadcast(loadReady);
+  SDL_UnlockMutex(loadLock);
+
+  for (size_t i = 0; i < workers.size(); i++){
+    SDL_WaitThread(workers[i], NULL);
+  }
+  workers.clear();
+
+  // throw away anything that was never handed over
+  for (list<RugImageLoad *>::iterator it = finishedLoads.begin(); it != finishedLoads.end(); it++){
+    if ((*it)->surface != NULL){
+      SDL_FreeSurface((*it)->surface);
+      (*it)->surface = NULL;
+    }
+  }
+  queuedLoads.clear();
+  finishedLoads.clear();
+
+  SDL_DestroyCond(loadReady);
+  SDL_DestroyMutex(loadLock);
+  loadLock = NULL;
+}
+
+static void StartLoadWorkers(){
+  if (loadLock != NULL){
+    return;
+  }
+
+  loadLock = SDL_CreateMutex();
+  loadReady = SDL_CreateCond();
+  stopWorkers = false;
+
+  for (int i = 0; i < RugConf.loadThreads; i++){
+    workers.push_back(SDL_CreateThread(LoadWorker, NULL));
+  }
+
+  // stop before Ruby starts freeing the handles the workers are using
+  rb_set_end_proc(StopLoadWorkers, Qnil);
+}
+
+// Hands finished loads over to Ruby and calls their callbacks. This is
+// called by the main loop every time around.
+void PumpImageLoads(){
+  if (loadLock == NULL){
+    return;
+  }
+
+  list<RugImageLoad *> done;
+
+  SDL_LockMutex(loadLock);
+  done.swap(finishedLoads);
+  SDL_UnlockMutex(loadLock);
+
+  for (list<RugImageLoad *>::iterator it = done.begin(); it != done.end(); it++){
+    RugImageLoad * load = *it;
+
+    // converting uses the screen, so it has to happen on this thread
+    SDL_Surface * surface = ConvertToDisplay(load->surface);
+    load->surface = NULL;
+
+    if (surface == NULL){
+      load->state = LOAD_FAILED;
+    }else{
+      load->image = WrapImage(CacheSurface(load->path.c_str(), surface));
+      load->state = LOAD_DONE;
+    }
+  }
+
+  // run callbacks last, they might start more loads
+  long i = 0;
+  while (i < RARRAY_LEN(pendingHandles)){
+    VALUE handle = rb_ary_entry(pendingHandles, i);
+
+    RugImageLoad * load;
+    Data_Get_Struct(handle, RugImageLoad, load);
+
+    if (load->state == LOAD_PENDING){
+      i++;
+      continue;
+    }
+
+    rb_ary_delete_at(pendingHandles, i);
+
+    if (load->state == LOAD_DONE && load->callback != Qnil){
+      rb_funcall(load->callback, id_call, 1, load->image);
+    }
+  }
+}
+
+static void mark_image_load(void * vp){
+  RugImageLoad * load = (RugImageLoad *)vp;
+  rb_gc_mark(load->callback);
+  rb_gc_mark(load->image);
+}
+
+static void unload_image_load(void * vp){
+  RugImageLoad * load = (RugImageLoad *)vp;
+  if (load->surface != NULL){
+    SDL_FreeSurface(load->surface);
+  }
+  delete load;
+}
+
+/*
+ * Starts loading an image in the background and returns a Rug::ImageLoad
+ * handle for it. The image is decoded on a separate thread, so the game
+ * keeps running while it loads. If a block is given
+ * it is called with the Rug::Image once it has loaded, from the main
+ * loop.
+ *
+ * Usage:
+ *
+ *    level = LEVEL_FILES.map { |f| Rug::Image.load_async f }
+ *
+ *    Rug.update do |dt|
+ *      start_level if level.all? { |l| l.ready? }
+ *    end
+ */
+static VALUE RugImageLoadAsync(int argc, VALUE * argv, VALUE klass){
+  VALUE filename, callback;
+  rb_scan_args(argc, argv, "1&", &filename, &callback);
+
+  RugImageLoad * load = new RugImageLoad;
+  load->path     = STR2CSTR(filename);
+  load->surface  = NULL;
+  load->state    = LOAD_PENDING;
+  load->callback = callback;
+  load->image    = Qnil;
+
+  VALUE handle = Data_Wrap_Struct(cRugImageLoad, mark_image_load, unload_image_load, load);
+  rb_ary_push(pendingHandles, handle);
+
+  StartLoadWorkers();
+
+  // already loaded images don't need a worker. They are wrapped straight
+  // away, so the cache's count of images using them stays right, and the
+  // callback is still called from the main loop.
+  SDL_Surface * cached = FindCachedSurface(load->path.c_str());
+  if (cached != NULL){
+    load->image = WrapImage(cached);
+    load->state = LOAD_DONE;
+    return handle;
+  }
+
+  SDL_LockMutex(loadLock);
+  queuedLoads.push_back(load);
+  SDL_CondSignal(loadReady);
+  SDL_UnlockMutex(loadLock);
+
+  return handle;
+}
+
+/*
+ * Returns true if the image has finished loading.
+ */
+static VALUE RugImageLoadReady(VALUE self){
+  RugImageLoad * load;
+  Data_Get_Struct(self, RugImageLoad, load);
+  return load->state == LOAD_DONE ? Qtrue : Qfalse;
+}
+
+/*
+ * Returns true if the image could not be loaded.
+ */
+static VALUE RugImageLoadFailed(VALUE self){
+  RugImageLoad * load;
+  Data_Get_Struct(self, RugImageLoad, load);
+  return load->state == LOAD_FAILED ? Qtrue : Qfalse;
+}
+
+/*
+ * Gets the loaded Rug::Image, or nil if it hasn't loaded yet. Raises an
+ * IOError if the image couldn't be loaded.
+ */
+static VALUE RugImageLoadImage(VALUE self){
+  RugImageLoad * load;
+  Data_Get_Struct(self, RugImageLoad, load);
+
+  if (load->state == LOAD_FAILED){
+    rb_raise(rb_eIOError, "Unable to load image: %s", load->path.c_str());
+  }
+
+  return load->image;
+}
+
+/*
+ * Blocks until the image has loaded and returns it.
+ */
+static VALUE RugImageLoadWait(VALUE self){
+  RugImageLoad * load;
+  Data_Get_Struct(self, RugImageLoad, load);
+
+  while (load->state == LOAD_PENDING){
+    PumpImageLoads();
+    if (load->state == LOAD_PENDING){
+      SDL_Delay(1);
+    }
+  }
+
+  return RugImageLoadImage(self);
+}
+
+void LoadLoader(VALUE mRug){
+  VALUE cRugImage = rb_const_get(mRug, rb_intern("Image"));
+
+  cRugImageLoad = rb_define_class_under(mRug, "ImageLoad", rb_cObject);
+
+  rb_define_singleton_method(cRugImage, "load_async", (VALUE (*)(...))RugImageLoadAsync, -1);
+
+  rb_define_method(cRugImageLoad, "ready?",  (VALUE (*)(...))RugImageLoadReady,  0);
+  rb_define_method(cRugImageLoad, "failed?", (VALUE (*)(...))RugImageLoadFailed, 0);
+  rb_define_method(cRugImageLoad, "image",   (VALUE (*)(...))RugImageLoadImage,  0);
+  rb_define_method(cRugImageLoad, "wait",    (VALUE (*)(...))RugImageLoadWait,   0);
+
+  // need to set an instance variable or this will get GC'ed
+  pendingHandles = rb_ary_new();
+  rb_iv_set(cRugImageLoad, "@pending", pendingHandles);
+
+  id_call = rb_intern("call");
+}
@@ -0,0 +1,9 @@
+#ifndef RUG_LOADER_H
+#define RUG_LOADER_H
+
+#include "ruby.h"
+
+void LoadLoader(VALUE);
+void PumpImageLoads();
+
+#endif //RUG_LOADER_H
@@ -0,0 +1,527 @@
+#include "particles.h"
+#include "colour.h"
+#include "image.h"
+#include "graphics.h"
+#include "compositor.h"
+
+#include <SDL/SDL.h>
+#include <SDL/SDL_gfxPrimitives.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+VALUE cRugParticleSystem, cRugEmitter;
+
+extern SDL_Surface * mainWnd;
+
+typedef struct {
+  float x, y;
+  float rate, pending;   // particles per second, and the part of one owed
+  float angle, spread;   // in degrees, 0 is to the right and 90 is down
+  float speedMin, speedMax;
+  float lifeMin, lifeMax; // in milliseconds
+  Uint32 colour;
+} RugEmitter;
+
+// Every particle attribute is kept in its own array, so updating them
+// is a straight run through memory that can be done 4 at a time
+typedef struct {
+  vector<float> x, y, vx, vy, age, life;
+  vector<Uint32> colour;
+  int count, max;
+
+  vector<RugEmitter> emitters;
+
+  VALUE sprite;
+  int size;
+  bool fade;
+  float gravityX, gravityY;
+  Uint32 seed;
+} RugParticleSystem;
+
+typedef struct {
+  VALUE system;
+  int index;
+} RugEmitterHandle;
+
+static void mark_particle_system(void * vp){
+  rb_gc_mark(((RugParticleSystem *)vp)->sprite);
+}
+
+static void unload_particle_system(void * vp){
+  delete (RugParticleSystem *)vp;
+}
+
+static void mark_emitter(void * vp){
+  rb_gc_mark(((RugEmitterHandle *)vp)->system);
+}
+
+static void unload_emitter(void * vp){
+  delete (RugEmitterHandle *)vp;
+}
+
+static RugParticleSystem * GetParticleSystem(VALUE self){
+  RugParticleSystem * ps;
+  Data_Get_Struct(self, RugParticleSystem, ps);
+  return ps;
+}
+
+static RugEmitter & GetEmitter(VALUE self){
+  RugEmitterHandle * handle;
+  Data_Get_Struct(self, RugEmitterHandle, handle);
+  return GetParticleSystem(handle->system)->emitters[handle->index];
+}
+
+// xorshift, so spawning doesn't go through Ruby
+static inline float Random(RugParticleSystem * ps){
+  ps->seed ^= ps->seed << 13;
+  ps->seed ^= ps->seed >> 17;
+  ps->seed ^= ps->seed << 5;
+  return (ps->seed >> 8) * (1.0f / 16777216.0f);
+}
+
+static void Spawn(RugParticleSystem * ps, RugEmitter & e, int n){
+  n = min(n, ps->max - ps->count);
+
+  for (int k = 0; k < n; k++){
+    int i = ps->count++;
+
+    float angle = (e.angle + (Random(ps) - 0.5f) * e.spread) * (float)M_PI / 180.0f;
+    float speed = e.speedMin + (e.speedMax - e.speedMin) * Random(ps);
+
+    ps->x[i] = e.x;
+    ps->y[i] = e.y;
+    ps->vx[i] = cosf(angle) * speed;
+    ps->vy[i] = sinf(angle) * speed;
+    ps->age[i] = 0;
+    ps->life[i] = e.lifeMin + (e.lifeMax - e.lifeMin) * Random(ps);
+    ps->colour[i] = e.colour;
+  }
+}
+
+// Moves every particle along dt seconds worth
+static void Integrate(RugParticleSystem * ps, float dt){
+  float * x = &ps->x[0];
+  float * y = &ps->y[0];
+  float * vx = &ps->vx[0];
+  float * vy = &ps->vy[0];
+  float * age = &ps->age[0];
+
+  float gx = ps->gravityX * dt, gy = ps->gravityY * dt, ms = dt * 1000.0f;
+
+  int i = 0;
+#if defined(__SSE2__)
+  __m128 t = _mm_set1_ps(dt), dvx = _mm_set1_ps(gx), dvy = _mm_set1_ps(gy), dage = _mm_set1_ps(ms);
+  for (; i + 4 <= ps->count; i += 4){
+    __m128 nvx = _mm_add_ps(_mm_loadu_ps(vx + i), dvx);
+    __m128 nvy = _mm_add_ps(_mm_loadu_ps(vy + i), dvy);
+    _mm_storeu_ps(vx + i, nvx);
+    _mm_storeu_ps(vy + i, nvy);
+    _mm_storeu_ps(x + i, _mm_add_ps(_mm_loadu_ps(x + i), _mm_mul_ps(nvx, t)));
+    _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(nvy, t)));
+    _mm_storeu_ps(age + i, _mm_add_ps(_mm_loadu_ps(age + i), dage));
+  }
+#endif
+
+  for (; i < ps->count; i++){
+    vx[i] += gx;
+    vy[i] += gy;
+    x[i] += vx[i] * dt;
+    y[i] += vy[i] * dt;
+    age[i] += ms;
+  }
+}
+
+// Dead particles are replaced by the last one, so the arrays stay packed
+static void RemoveDead(RugParticleSystem * ps){
+  int i = 0;
+  while (i < ps->count){
+    if (ps->age[i] < ps->life[i]){
+      i++;
+      continue;
+    }
+
+    int last = --ps->count;
+    ps->x[i] = ps->x[last];
+    ps->y[i] = ps->y[last];
+    ps->vx[i] = ps->vx[last];
+    ps->vy[i] = ps->vy[last];
+    ps->age[i] = ps->age[last];
+    ps->life[i] = ps->life[last];
+    ps->colour[i] = ps->colour[last];
+  }
+}
+
+/*
+ * Creates a particle system that can hold up to _max_ particles (10000 by
+ * default). All the particles are stored and moved natively, so there can
+ * be tens of thousands of them. Particles come from emitters, see
+ * Rug::ParticleSystem#emitter.
+ *
+ * Usage:
+ *
+ *    sparks = Rug::ParticleSystem.new
+ *    sparks.gravity = 300
+ *    torch = sparks.emitter :x => 100, :y => 200, :rate => 500, :angle => -90,
+ *      :spread => 40, :speed => 50..120, :life => 400..900, :colour => Rug::Colour::Yellow
+ *
+ *    Rug.update { |dt| sparks.update dt }
+ *    Rug.draw { sparks.draw }
+ */
+static VALUE RugCreateParticleSystem(int argc, VALUE * argv, VALUE klass){
+  VALUE rmax;
+  rb_scan_args(argc, argv, "01", &rmax);
+
+  int max = (rmax == Qnil) ? 10000 : NUM2INT(rmax);
+  if (max < 0){
+    rb_raise(rb_eArgError, "the maximum number of particles can't be negative");
+  }
+
+  RugParticleSystem * ps = new RugParticleSystem;
+  ps->max = max;
+  ps->count = 0;
+
+  // room for a few extra, so the SIMD loop never has to stop short
+  ps->x.resize(max + 4);
+  ps->y.resize(max + 4);
+  ps->vx.resize(max + 4);
+  ps->vy.resize(max + 4);
+  ps->age.resize(max + 4);
+  ps->life.resize(max + 4);
+  ps->colour.resize(max + 4);
+
+  ps->sprite = Qnil;
+  ps->size = 1;
+  ps->fade = true;
+  ps->gravityX = ps->gravityY = 0;
+  ps->seed = 2463534242u;
+
+  return Data_Wrap_Struct(cRugParticleSystem, mark_particle_system, unload_particle_system, ps);
+}
+
+// Reads a number or a range of numbers from an options hash
+static void GetRange(VALUE options, const char * key, float & low, float & high){
+  VALUE value = rb_hash_aref(options, ID2SYM(rb_intern(key)));
+  if (value == Qnil){
+    return;
+  }
+
+  if (rb_obj_is_kind_of(value, rb_cRange)){
+    low = NUM2DBL(rb_funcall(value, rb_intern("first"), 0));
+    high = NUM2DBL(rb_funcall(value, rb_intern("last"), 0));
+  }else{
+    low = high = NUM2DBL(value);
+  }
+}
+
+static void SetEmitterOptions(RugEmitter & e, VALUE options){
+  float unused;
+  GetRange(options, "x", e.x, unused);
+  GetRange(options, "y", e.y, unused);
+  GetRange(options, "rate", e.rate, unused);
+  GetRange(options, "angle", e.angle, unused);
+  GetRange(options, "spread", e.spread, unused);
+  GetRange(options, "speed", e.speedMin, e.speedMax);
+  GetRange(options, "life", e.lifeMin, e.lifeMax);
+
+  VALUE colour = rb_hash_aref(options, ID2SYM(rb_intern("colour")));
+  if (colour == Qnil){
+    colour = rb_hash_aref(options, ID2SYM(rb_intern("color")));
+  }
+  if (colour != Qnil){
+    e.colour = ColourToGfx(colour);
+  }
+}
+
+/*
+ * Adds an emitter to the system and returns it. The options are:
+ *
+ * :x, :y::     where particles start
+ * :rate::      how many particles are made per second
+ * :angle::     the direction particles go in, in degrees clockwise from the right
+ * :spread::    how many degrees wide the spray is, centred on the angle
+ * :speed::     pixels per second, or a range to pick from
+ * :life::      how many milliseconds they last, or a range to pick from
+ * :colour::    what colour they are drawn in, when there's no sprite
+ */
+static VALUE RugParticleSystemEmitter(int argc, VALUE * argv, VALUE self){
+  VALUE options;
+  rb_scan_args(argc, argv, "01", &options);
+
+  RugParticleSystem * ps = GetParticleSystem(self);
+
+  RugEmitter e;
+  e.x = e.y = 0;
+  e.rate = 100;
+  e.pending = 0;
+  e.angle = 0;
+  e.spread = 360;
+  e.speedMin = e.speedMax = 100;
+  e.lifeMin = e.lifeMax = 1000;
+  e.colour = 0xFFFFFFFF;
+
+  if (options != Qnil){
+    Check_Type(options, T_HASH);
+    SetEmitterOptions(e, options);
+  }
+
+  ps->emitters.push_back(e);
+
+  RugEmitterHandle * handle = new RugEmitterHandle;
+  handle->system = self;
+  handle->index = ps->emitters.size() - 1;
+
+  return Data_Wrap_Struct(cRugEmitter, mark_emitter, unload_emitter, handle);
+}
+
+/*
+ * Makes new particles from all the emitters and moves every particle
+ * along by _dt_ milliseconds. Particles that have lived out their life
+ * are removed.
+ */
+static VALUE RugParticleSystemUpdate(VALUE self, VALUE rdt){
+  RugParticleSystem * ps = GetParticleSystem(self);
+  float dt = NUM2DBL(rdt) / 1000.0f;
+
+  for (size_t i = 0; i < ps->emitters.size(); i++){
+    RugEmitter & e = ps->emitters[i];
+    e.pending += e.rate * dt;
+
+    int n = (int)e.pending;
+    e.pending -= n;
+    Spawn(ps, e, n);
+  }
+
+  Integrate(ps, dt);
+  RemoveDead(ps);
+
+  return self;
+}
+
+/*
+ * Draws every particle on the screen, or on a layer if one is passed. If
+ * the system has a sprite it is drawn centred on each particle, otherwise
+ * each particle is a square _size_ pixels across in its emitter's colour,
+ * fading out over its life if fade is on.
+ */
+static VALUE RugParticleSystemDraw(int argc, VALUE * argv, VALUE self){
+  if (mainWnd == NULL){
+    return self;
+  }
+
+  VALUE targetLayer;
+  rb_scan_args(argc, argv, "01", &targetLayer);
+
+  RugParticleSystem * ps = GetParticleSystem(self);
+  if (ps->count == 0){
+    return self;
+  }
+
+  SDL_Surface * target = TargetSurface(targetLayer);
+
+  int w, h;
+  SDL_Surface * sprite = NULL;
+
+  if (ps->sprite != Qnil){
+    RugImage * image;
+    Data_Get_Struct(ps->sprite, RugImage, image);
+    sprite = image->image;
+    w = sprite->w;
+    h = sprite->h;
+
+    if (target != mainWnd){
+      FlushComposite();
+    }
+  }else{
+    w = h = ps->size;
+
+    // these go straight onto the target
+    FlushComposite();
+  }
+
+  // the area drawn on, in target pixels
+  int minX = target->w, minY = target->h, maxX = -1, maxY = -1;
+
+  for (int i = 0; i < ps->count; i++){
+    float left = ps->x[i] - w / 2, top = ps->y[i] - h / 2;
+
+    // particles can fly off a long way, and anything not on the target
+    // can't be turned into a Sint16 safely. This also skips NaNs.
+    if (!(left > -w && left < target->w && top > -h && top < target->h)){
+      continue;
+    }
+
+    Sint16 px = (Sint16)left, py = (Sint16)top;
+    minX = min(minX, (int)px);
+    minY = min(minY, (int)py);
+    maxX = max(maxX, px + w - 1);
+    maxY = max(maxY, py + h - 1);
+
+    if (sprite){
+      SDL_Rect dst;
+      dst.x = px;
+      dst.y = py;
+      BlitOnto(sprite, NULL, dst, target);
+    }else{
+      Uint32 colour = ps->colour[i];
+      if (ps->fade){
+        Uint32 alpha = (Uint32)((colour & 0xFF) * (1.0f - ps->age[i] / ps->life[i]));
+        colour = (colour & 0xFFFFFF00) | min(alpha, (Uint32)255);
+      }
+
+      if (w == 1){
+        pixelColor(target, px, py, colour);
+      }else{
+        boxColor(target, px, py, px + w - 1, py + h - 1, colour);
+      }
+    }
+  }
+
+  if (target == mainWnd && maxX >= 0){
+    minX = max(minX, 0);
+    minY = max(minY, 0);
+    maxX = min(maxX, target->w - 1);
+    maxY = min(maxY, target->h - 1);
+
+    SDL_Rect bounds;
+    bounds.x = minX;
+    bounds.y = minY;
+    bounds.w = maxX - minX + 1;
+    bounds.h = maxY - minY + 1;
+    MarkDirty(bounds);
+  }
+
+  return self;
+}
+
+/*
+ * Gets the number of live particles.
+ */
+static VALUE RugParticleSystemCount(VALUE self){
+  return INT2FIX(GetParticleSystem(self)->count);
+}
+
+/*
+ * Removes every particle.
+ */
+static VALUE RugParticleSystemClear(VALUE self){
+  GetParticleSystem(self)->count = 0;
+  return self;
+}
+
+/*
+ * Sets a Rug::Image to draw for each particle, or nil to draw squares.
+ */
+static VALUE RugParticleSystemSetSprite(VALUE self, VALUE sprite){
+  if (sprite != Qnil && !rb_obj_is_kind_of(sprite, cRugImage)){
+    rb_raise(rb_eTypeError, "the sprite must be a Rug::Image");
+  }
+  GetParticleSystem(self)->sprite = sprite;
+  return sprite;
+}
+
+/*
+ * Sets how many pixels across particles are when there is no sprite.
+ */
+static VALUE RugParticleSystemSetSize(VALUE self, VALUE size){
+  GetParticleSystem(self)->size = max(1, NUM2INT(size));
+  return size;
+}
+
+/*
+ * Sets whether particles without a sprite fade out as they age. This is
+ * on by default.
+ */
+static VALUE RugParticleSystemSetFade(VALUE self, VALUE fade){
+  GetParticleSystem(self)->fade = RTEST(fade);
+  return fade;
+}
+
+/*
+ * Sets the downwards acceleration of every particle, in pixels per second
+ * per second.
+ */
+static VALUE RugParticleSystemSetGravity(VALUE self, VALUE gravity){
+  GetParticleSystem(self)->gravityY = NUM2DBL(gravity);
+  return gravity;
+}
+
+/*
+ * Sets the sideways acceleration of every particle, in pixels per second
+ * per second.
+ */
+static VALUE RugParticleSystemSetWind(VALUE self, VALUE wind){
+  GetParticleSystem(self)->gravityX = NUM2DBL(wind);
+  return wind;
+}
+
+/*
+ * Moves the emitter.
+ */
+static VALUE RugEmitterMove(VALUE self, VALUE x, VALUE y){
+  RugEmitter & e = GetEmitter(self);
+  e.x = NUM2DBL(x);
+  e.y = NUM2DBL(y);
+  return self;
+}
+
+/*
+ * Changes the emitter's settings, taking the same options as
+ * Rug::ParticleSystem#emitter.
+ */
+static VALUE RugEmitterSet(VALUE self, VALUE options){
+  Check_Type(options, T_HASH);
+  SetEmitterOptions(GetEmitter(self), options);
+  return self;
+}
+
+/*
+ * Sets how many particles the emitter makes per second. Set it to 0 to
+ * turn the emitter off.
+ */
+static VALUE RugEmitterSetRate(VALUE self, VALUE rate){
+  GetEmitter(self).rate = NUM2DBL(rate);
+  return rate;
+}
+
+/*
+ * Makes _n_ particles straight away.
+ */
+static VALUE RugEmitterBurst(VALUE self, VALUE n){
+  RugEmitterHandle * handle;
+  Data_Get_Struct(self, RugEmitterHandle, handle);
+
+  RugParticleSystem * ps = GetParticleSystem(handle->system);
+  Spawn(ps, ps->emitters[handle->index], NUM2INT(n));
+
+  return self;
+}
+
+void LoadParticles(VALUE mRug){
+  cRugParticleSystem = rb_define_class_under(mRug, "ParticleSystem", rb_cObject);
+  cRugEmitter = rb_define_class_under(cRugParticleSystem, "Emitter", rb_cObject);
+
+  rb_define_singleton_method(cRugParticleSystem, "new", (VALUE (*)(...))RugCreateParticleSystem, -1);
+
+  rb_define_method(cRugParticleSystem, "emitter",  (VALUE (*)(...))RugParticleSystemEmitter,    -1);
+  rb_define_method(cRugParticleSystem, "update",   (VALUE (*)(...))RugParticleSystemUpdate,      1);
+  rb_define_method(cRugParticleSystem, "draw",     (VALUE (*)(...))RugParticleSystemDraw,       -1);
+  rb_define_method(cRugParticleSystem, "count",    (VALUE (*)(...))RugParticleSystemCount,       0);
+  rb_define_method(cRugParticleSystem, "clear",    (VALUE (*)(...))RugParticleSystemClear,       0);
+  rb_define_method(cRugParticleSystem, "sprite=",  (VALUE (*)(...))RugParticleSystemSetSprite,   1);
+  rb_define_method(cRugParticleSystem, "size=",    (VALUE (*)(...))RugParticleSystemSetSize,     1);
+  rb_define_method(cRugParticleSystem, "fade=",    (VALUE (*)(...))RugParticleSystemSetFade,     1);
+  rb_define_method(cRugParticleSystem, "gravity=", (VALUE (*)(...))RugParticleSystemSetGravity,  1);
+  rb_define_method(cRugParticleSystem, "wind=",    (VALUE (*)(...))RugParticleSystemSetWind,     1);
+
+  rb_define_method(cRugEmitter, "move",  (VALUE (*)(...))RugEmitterMove,    2);
+  rb_define_method(cRugEmitter, "set",   (VALUE (*)(...))RugEmitterSet,     1);
+  rb_define_method(cRugEmitter, "rate=", (VALUE (*)(...))RugEmitterSetRate, 1);
+  rb_define_method(cRugEmitter, "burst", (VALUE (*)(...))RugEmitterBurst,   1);
+}
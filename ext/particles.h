@@ -0,0 +1,8 @@
+#ifndef RUG_PARTICLES_H
+#define RUG_PARTICLES_H
+
+#include "ruby.h"
+
+void LoadParticles(VALUE);
+
+#endif //RUG_PARTICLES_H
@@ -0,0 +1,289 @@
+#include "pixels.h"
+
+#include <string.h>
+
+VALUE cRugPixelBuffer;
+
+typedef struct {
+  SDL_Surface * surface;
+  bool valid;
+} RugPixelBuffer;
+
+static void unload_pixel_buffer(void * vp){
+  free(vp);
+}
+
+static SDL_Surface * GetBufferSurface(VALUE self){
+  RugPixelBuffer * buffer;
+  Data_Get_Struct(self, RugPixelBuffer, buffer);
+
+  if (!buffer->valid){
+    rb_raise(rb_eRuntimeError, "pixel buffer used outside of its block");
+  }
+  return buffer->surface;
+}
+
+static void LockPixels(SDL_Surface * surface){
+  if (SDL_MUSTLOCK(surface) && SDL_LockSurface(surface) < 0){
+    rb_raise(rb_eRuntimeError, "Unable to lock surface: %s", SDL_GetError());
+  }
+}
+
+static void UnlockPixels(SDL_Surface * surface){
+  if (SDL_MUSTLOCK(surface)){
+    SDL_UnlockSurface(surface);
+  }
+}
+
+static inline Uint8 * PixelAddress(SDL_Surface * surface, int x, int y){
+  return (Uint8 *)surface->pixels + y * surface->pitch + x * surface->format->BytesPerPixel;
+}
+
+// Works out the rectangle from optional x, y, w, h arguments, which default
+// to the whole surface, and makes sure it is inside the surface
+static void GetPixelRect(SDL_Surface * surface, int argc, VALUE * argv, SDL_Rect & rect){
+  VALUE x, y, w, h;
+  rb_scan_args(argc, argv, "04", &x, &y, &w, &h);
+
+  int rx = x == Qnil ? 0 : NUM2INT(x);
+  int ry = y == Qnil ? 0 : NUM2INT(y);
+  int rw = w == Qnil ? surface->w - rx : NUM2INT(w);
+  int rh = h == Qnil ? surface->h - ry : NUM2INT(h);
+
+  if (rx < 0 || ry < 0 || rw < 0 || rh < 0 || rw > surface->w - rx || rh > surface->h - ry){
+    rb_raise(rb_eArgError, "rectangle is outside of the %dx%d surface", surface->w, surface->h);
+  }
+
+  rect.x = rx;
+  rect.y = ry;
+  rect.w = rw;
+  rect.h = rh;
+}
+
+static VALUE CopyOut(SDL_Surface * surface, const SDL_Rect & rect){
+  int rowBytes = rect.w * surface->format->BytesPerPixel;
+  VALUE data = rb_str_new(NULL, (long)rowBytes * rect.h);
+  char * out = RSTRING_PTR(data);
+
+  for (int y = 0; y < rect.h; y++){
+    memcpy(out + (long)y * rowBytes, PixelAddress(surface, rect.x, rect.y + y), rowBytes);
+  }
+  return data;
+}
+
+// Makes sure there's enough data for the rectangle. This has to be done
+// before locking, since raising skips the unlock.
+static void CheckPixelData(SDL_Surface * surface, const SDL_Rect & rect, VALUE data){
+  long needed = (long)rect.w * rect.h * surface->format->BytesPerPixel;
+  if (RSTRING_LEN(data) < needed){
+    rb_raise(rb_eArgError, "need %ld bytes of pixels, got %ld", needed, (long)RSTRING_LEN(data));
+  }
+}
+
+static void CopyIn(SDL_Surface * surface, const SDL_Rect & rect, VALUE data){
+  int rowBytes = rect.w * surface->format->BytesPerPixel;
+  const char * in = RSTRING_PTR(data);
+  for (int y = 0; y < rect.h; y++){
+    memcpy(PixelAddress(surface, rect.x, rect.y + y), in + (long)y * rowBytes, rowBytes);
+  }
+}
+
+VALUE GetPixels(SDL_Surface * surface, int argc, VALUE * argv){
+  SDL_Rect rect;
+  GetPixelRect(surface, argc, argv, rect);
+
+  LockPixels(surface);
+  VALUE data = CopyOut(surface, rect);
+  UnlockPixels(surface);
+
+  return data;
+}
+
+VALUE PutPixels(SDL_Surface * surface, int argc, VALUE * argv){
+  if (argc < 1){
+    rb_raise(rb_eArgError, "wrong number of arguments (0 for 1)");
+  }
+
+  SDL_Rect rect;
+  GetPixelRect(surface, argc - 1, argv + 1, rect);
+
+  StringValue(argv[0]);
+  CheckPixelData(surface, rect, argv[0]);
+
+  LockPixels(surface);
+  CopyIn(surface, rect, argv[0]);
+  UnlockPixels(surface);
+
+  return Qnil;
+}
+
+static VALUE RugPixelBufferYield(VALUE buffer){
+  return rb_yield(buffer);
+}
+
+static VALUE RugPixelBufferRelease(VALUE self){
+  RugPixelBuffer * buffer;
+  Data_Get_Struct(self, RugPixelBuffer, buffer);
+
+  buffer->valid = false;
+  UnlockPixels(buffer->surface);
+  SDL_FreeSurface(buffer->surface);
+
+  return Qnil;
+}
+
+VALUE YieldPixelBuffer(SDL_Surface * surface){
+  if (!rb_block_given_p()){
+    rb_raise(rb_eArgError, "pixels needs a block");
+  }
+
+  LockPixels(surface);
+
+  // hold on to the surface for as long as the block runs
+  surface->refcount++;
+
+  RugPixelBuffer * buffer = ALLOC(RugPixelBuffer);
+  buffer->surface = surface;
+  buffer->valid = true;
+  VALUE rBuffer = Data_Wrap_Struct(cRugPixelBuffer, NULL, unload_pixel_buffer, buffer);
+
+  return rb_ensure(RugPixelBufferYield, rBuffer, RugPixelBufferRelease, rBuffer);
+}
+
+/*
+ * Gets the width of the buffer in pixels.
+ */
+static VALUE RugPixelBufferWidth(VALUE self){
+  return INT2FIX(GetBufferSurface(self)->w);
+}
+
+/*
+ * Gets the height of the buffer in pixels.
+ */
+static VALUE RugPixelBufferHeight(VALUE self){
+  return INT2FIX(GetBufferSurface(self)->h);
+}
+
+/*
+ * Gets the number of bytes from the start of one row to the start of the
+ * next, which can be more than width * bytes_per_pixel.
+ */
+static VALUE RugPixelBufferPitch(VALUE self){
+  return INT2FIX(GetBufferSurface(self)->pitch);
+}
+
+/*
+ * Gets how many bytes each pixel takes up.
+ */
+static VALUE RugPixelBufferBytesPerPixel(VALUE self){
+  return INT2FIX(GetBufferSurface(self)->format->BytesPerPixel);
+}
+
+/*
+ * Gets the red, green, blue and alpha masks of a pixel as an array.
+ */
+static VALUE RugPixelBufferMasks(VALUE self){
+  SDL_PixelFormat * format = GetBufferSurface(self)->format;
+  return rb_ary_new3(4, UINT2NUM(format->Rmask), UINT2NUM(format->Gmask),
+                        UINT2NUM(format->Bmask), UINT2NUM(format->Amask));
+}
+
+/*
+ * Gets the address of the first pixel, for handing the buffer to other
+ * native code. It is only valid inside the block.
+ */
+static VALUE RugPixelBufferAddress(VALUE self){
+  return ULL2NUM((unsigned long long)(size_t)GetBufferSurface(self)->pixels);
+}
+
+/*
+ * Gets the pixel at _x_, _y_ as a number in the surface's format.
+ */
+static VALUE RugPixelBufferGet(VALUE self, VALUE rx, VALUE ry){
+  SDL_Surface * surface = GetBufferSurface(self);
+  int x = NUM2INT(rx), y = NUM2INT(ry);
+
+  if (x < 0 || y < 0 || x >= surface->w || y >= surface->h){
+    return Qnil;
+  }
+
+  Uint8 * p = PixelAddress(surface, x, y);
+  Uint32 pixel = 0;
+  switch (surface->format->BytesPerPixel){
+  case 1: pixel = *p; break;
+  case 2: pixel = *(Uint16 *)p; break;
+  case 3: memcpy(&pixel, p, 3); break;
+  case 4: pixel = *(Uint32 *)p; break;
+  }
+
+  return UINT2NUM(pixel);
+}
+
+/*
+ * Sets the pixel at _x_, _y_ to a number in the surface's format.
+ */
+static VALUE RugPixelBufferSet(VALUE self, VALUE rx, VALUE ry, VALUE value){
+  SDL_Surface * surface = GetBufferSurface(self);
+  int x = NUM2INT(rx), y = NUM2INT(ry);
+
+  if (x < 0 || y < 0 || x >= surface->w || y >= surface->h){
+    rb_raise(rb_eIndexError, "pixel %d, %d is outside of the buffer", x, y);
+  }
+
+  Uint8 * p = PixelAddress(surface, x, y);
+  Uint32 pixel = NUM2UINT(value);
+  switch (surface->format->BytesPerPixel){
+  case 1: *p = pixel; break;
+  case 2: *(Uint16 *)p = pixel; break;
+  case 3: memcpy(p, &pixel, 3); break;
+  case 4: *(Uint32 *)p = pixel; break;
+  }
+
+  return value;
+}
+
+/*
+ * Same as Rug::Image#get_pixels, without locking again.
+ */
+static VALUE RugPixelBufferGetPixels(int argc, VALUE * argv, VALUE self){
+  SDL_Surface * surface = GetBufferSurface(self);
+  SDL_Rect rect;
+  GetPixelRect(surface, argc, argv, rect);
+  return CopyOut(surface, rect);
+}
+
+/*
+ * Same as Rug::Image#put_pixels, without locking again.
+ */
+static VALUE RugPixelBufferPutPixels(int argc, VALUE * argv, VALUE self){
+  if (argc < 1){
+    rb_raise(rb_eArgError, "wrong number of arguments (0 for 1)");
+  }
+
+  SDL_Surface * surface = GetBufferSurface(self);
+  SDL_Rect rect;
+  GetPixelRect(surface, argc - 1, argv + 1, rect);
+
+  StringValue(argv[0]);
+  CheckPixelData(surface, rect, argv[0]);
+  CopyIn(surface, rect, argv[0]);
+  return Qnil;
+}
+
+void LoadPixels(VALUE mRug){
+  cRugPixelBuffer = rb_define_class_under(mRug, "PixelBuffer", rb_cObject);
+
+  // buffers only come from Rug::Image#pixels and Rug::Layer#pixels
+  rb_undef_alloc_func(cRugPixelBuffer);
+
+  rb_define_method(cRugPixelBuffer, "width",           (VALUE (*)(...))RugPixelBufferWidth,         0);
+  rb_define_method(cRugPixelBuffer, "height",          (VALUE (*)(...))RugPixelBufferHeight,        0);
+  rb_define_method(cRugPixelBuffer, "pitch",           (VALUE (*)(...))RugPixelBufferPitch,         0);
+  rb_define_method(cRugPixelBuffer, "bytes_per_pixel", (VALUE (*)(...))RugPixelBufferBytesPerPixel, 0);
+  rb_define_method(cRugPixelBuffer, "masks",           (VALUE (*)(...))RugPixelBufferMasks,         0);
+  rb_define_method(cRugPixelBuffer, "address",         (VALUE (*)(...))RugPixelBufferAddress,       0);
+  rb_define_method(cRugPixelBuffer, "[]",              (VALUE (*)(...))RugPixelBufferGet,           2);
+  rb_define_method(cRugPixelBuffer, "[]=",             (VALUE (*)(...))RugPixelBufferSet,           3);
+  rb_define_method(cRugPixelBuffer, "get_pixels",      (VALUE (*)(...))RugPixelBufferGetPixels,    -1);
+  rb_define_method(cRugPixelBuffer, "put_pixels",      (VALUE (*)(...))RugPixelBufferPutPixels,    -1);
+}
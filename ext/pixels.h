@@ -0,0 +1,18 @@
+#ifndef RUG_PIXELS_H
+#define RUG_PIXELS_H
+
+#include "ruby.h"
+#include <SDL/SDL.h>
+
+void LoadPixels(VALUE);
+
+// Locks the surface and yields a Rug::PixelBuffer over its memory to the
+// block, unlocking it and invalidating the buffer afterwards
+VALUE YieldPixelBuffer(SDL_Surface *);
+
+// Copy a rectangle of pixels out of or into a surface as a packed String,
+// with the arguments passed from Ruby
+VALUE GetPixels(SDL_Surface *, int argc, VALUE * argv);
+VALUE PutPixels(SDL_Surface *, int argc, VALUE * argv);
+
+#endif //RUG_PIXELS_H
@@ -0,0 +1,274 @@
+#include "profiler.h"
+#include "conf.h"
+
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+using namespace std;
+
+extern _RugConf RugConf;
+
+// how many frames the stats are worked out over
+static const int HISTORY = 240;
+
+// stop recording a trace at this many events, rather than eat all memory
+static const size_t MAX_TRACE_EVENTS = 1 << 20;
+
+typedef struct {
+  string name;
+  double start;
+} OpenScope;
+
+typedef struct {
+  double frameTotal;
+  int frameCalls;
+  vector<double> history;
+  int next;
+} PhaseStats;
+
+typedef struct {
+  string name;
+  double start, duration;
+} TraceEvent;
+
+static vector<OpenScope> openScopes;
+static map<string, PhaseStats> phases;
+static double frameStart = 0;
+
+static bool tracing = false;
+static double traceOrigin;
+static vector<TraceEvent> traceEvents;
+
+// Microseconds from some fixed point, SDL_GetTicks is too coarse
+static double ProfileNow(){
+#ifdef _WIN32
+  static LARGE_INTEGER freq;
+  if (freq.QuadPart == 0){
+    QueryPerformanceFrequency(&freq);
+  }
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  return now.QuadPart * 1000000.0 / freq.QuadPart;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000.0 + now.tv_nsec / 1000.0;
+#endif
+}
+
+static inline bool ProfileActive(){
+  return RugConf.profile || tracing;
+}
+
+static void Record(const string & name, double start, double duration){
+  PhaseStats & stats = phases[name];
+  stats.frameTotal += duration;
+  stats.frameCalls++;
+
+  if (tracing && traceEvents.size() < MAX_TRACE_EVENTS){
+    TraceEvent event;
+    event.name = name;
+    event.start = start - traceOrigin;
+    event.duration = duration;
+    traceEvents.push_back(event);
+  }
+}
+
+void ProfileBegin(const char * name){
+  if (!ProfileActive()){
+    return;
+  }
+
+  OpenScope scope;
+  scope.name = name;
+  scope.start = ProfileNow();
+  openScopes.push_back(scope);
+}
+
+void ProfileEnd(){
+  if (openScopes.empty()){
+    return;
+  }
+
+  OpenScope & scope = openScopes.back();
+  double start = scope.start;
+  Record(scope.name, start, ProfileNow() - start);
+  openScopes.pop_back();
+}
+
+void ProfileFrame(){
+  if (!ProfileActive()){
+    frameStart = 0;
+    return;
+  }
+
+  double now = ProfileNow();
+  if (frameStart != 0){
+    Record("frame", frameStart, now - frameStart);
+  }
+  frameStart = now;
+
+  // anything left open was skipped over by an exception
+  openScopes.clear();
+
+  for (map<string, PhaseStats>::iterator it = phases.begin(); it != phases.end(); it++){
+    PhaseStats & stats = it->second;
+    if (stats.frameCalls == 0){
+      continue;
+    }
+
+    if ((int)stats.history.size() < HISTORY){
+      stats.history.push_back(stats.frameTotal);
+    }else{
+      stats.history[stats.next] = stats.frameTotal;
+    }
+    stats.next = (stats.next + 1) % HISTORY;
+
+    stats.frameTotal = 0;
+    stats.frameCalls = 0;
+  }
+}
+
+static VALUE RugProfileYield(VALUE unused){
+  return rb_yield(Qnil);
+}
+
+static VALUE RugProfileEnsure(VALUE unused){
+  ProfileEnd();
+  return Qnil;
+}
+
+/*
+ * Times the block under _name_, which then shows up in Rug.frame_stats and
+ * in traces alongside the built in phases. Returns what the block returns.
+ *
+ * Usage:
+ *
+ *    Rug.update do |dt|
+ *      Rug.profile("physics") { world.update dt }
+ *    end
+ */
+static VALUE RugProfile(VALUE klass, VALUE name){
+  if (!ProfileActive()){
+    return rb_yield(Qnil);
+  }
+
+  ProfileBegin(StringValueCStr(name));
+  return rb_ensure(RugProfileYield, Qnil, RugProfileEnsure, Qnil);
+}
+
+/*
+ * Gets the time spent in each part of the frame over the last few seconds,
+ * as a hash from the name of the part to a hash of :min, :avg, :p99, :max
+ * and :last, all in milliseconds. Profiling has to be turned on in the
+ * configuration block for this to have anything in it.
+ *
+ * The built in parts are "events", "loads", "animations", "update",
+ * "clear", "draw", "composite" and "present", and "frame" for the whole
+ * frame. Blocks timed with Rug.profile are added under their own names.
+ */
+static VALUE RugFrameStats(VALUE klass){
+  VALUE result = rb_hash_new();
+
+  for (map<string, PhaseStats>::iterator it = phases.begin(); it != phases.end(); it++){
+    PhaseStats & stats = it->second;
+    int n = stats.history.size();
+    if (n == 0){
+      continue;
+    }
+
+    vector<double> sorted(stats.history);
+    sort(sorted.begin(), sorted.end());
+
+    double total = 0;
+    for (int i = 0; i < n; i++){
+      total += sorted[i];
+    }
+
+    int last = (stats.next + n - 1) % n;
+    int p99 = min(n - 1, (int)(n * 0.99));
+
+    VALUE entry = rb_hash_new();
+    rb_hash_aset(entry, ID2SYM(rb_intern("min")),  rb_float_new(sorted[0] / 1000.0));
+    rb_hash_aset(entry, ID2SYM(rb_intern("avg")),  rb_float_new(total / n / 1000.0));
+    rb_hash_aset(entry, ID2SYM(rb_intern("p99")),  rb_float_new(sorted[p99] / 1000.0));
+    rb_hash_aset(entry, ID2SYM(rb_intern("max")),  rb_float_new(sorted[n - 1] / 1000.0));
+    rb_hash_aset(entry, ID2SYM(rb_intern("last")), rb_float_new(stats.history[last] / 1000.0));
+
+    rb_hash_aset(result, rb_str_new2(it->first.c_str()), entry);
+  }
+
+  return result;
+}
+
+/*
+ * Starts recording every timed part of every frame, to be saved with
+ * Rug.trace_stop. This works whether or not profiling is turned on.
+ */
+static VALUE RugTraceStart(VALUE klass){
+  tracing = true;
+  traceOrigin = ProfileNow();
+  traceEvents.clear();
+  return Qnil;
+}
+
+static void WriteJSONString(FILE * file, const string & str){
+  fputc('"', file);
+  for (size_t i = 0; i < str.size(); i++){
+    unsigned char c = str[i];
+    if (c == '"' || c == '\\'){
+      fputc('\\', file);
+      fputc(c, file);
+    }else if (c < 0x20){
+      fprintf(file, "\\u%04x", c);
+    }else{
+      fputc(c, file);
+    }
+  }
+  fputc('"', file);
+}
+
+/*
+ * Stops recording and saves what was recorded since Rug.trace_start to
+ * _filename_ as Chrome trace event JSON, which can be opened in
+ * chrome://tracing or Perfetto.
+ */
+static VALUE RugTraceStop(VALUE klass, VALUE filename){
+  tracing = false;
+
+  FILE * file = fopen(StringValueCStr(filename), "w");
+  if (file == NULL){
+    rb_raise(rb_eIOError, "can't write trace to %s", StringValueCStr(filename));
+  }
+
+  fprintf(file, "{\"traceEvents\":[\n");
+  for (size_t i = 0; i < traceEvents.size(); i++){
+    TraceEvent & event = traceEvents[i];
+    fprintf(file, "%s{\"name\":", i == 0 ? "" : ",\n");
+    WriteJSONString(file, event.name);
+    fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}", event.start, event.duration);
+  }
+  fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+  fclose(file);
+
+  int count = traceEvents.size();
+  traceEvents.clear();
+
+  return INT2FIX(count);
+}
+
+void LoadProfiler(VALUE mRug){
+  rb_define_singleton_method(mRug, "profile",     (VALUE (*)(...))RugProfile,     1);
+  rb_define_singleton_method(mRug, "frame_stats", (VALUE (*)(...))RugFrameStats,  0);
+  rb_define_singleton_method(mRug, "trace_start", (VALUE (*)(...))RugTraceStart,  0);
+  rb_define_singleton_method(mRug, "trace_stop",  (VALUE (*)(...))RugTraceStop,   1);
+}
@@ -0,0 +1,16 @@
+#ifndef RUG_PROFILER_H
+#define RUG_PROFILER_H
+
+#include "ruby.h"
+
+void LoadProfiler(VALUE);
+
+// Times the code between them under the given name. These nest, and do
+// nothing unless profiling or tracing is on.
+void ProfileBegin(const char * name);
+void ProfileEnd();
+
+// Marks the end of a frame, adding up the time spent in each scope
+void ProfileFrame();
+
+#endif //RUG_PROFILER_H
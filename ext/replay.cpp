@@ -0,0 +1,211 @@
+#include "replay.h"
+#include "binio.h"
+#include "conf.h"
+
+#include <stdio.h>
+#include <string.h>
+
+using namespace std;
+
+// "RGRP"
+static const Uint32 REPLAY_MAGIC = 0x50524752;
+static const Uint32 REPLAY_VERSION = 1;
+
+// Layout, all numbers from binio.h:
+//
+//   magic, version, start ticks
+//   per frame: ticks, number of events, then each event as a type byte
+//   followed by its fields
+static FILE * recordFile = NULL;
+static FILE * replayFile = NULL;
+
+static vector<RecordedEvent> recordEvents;
+static vector<RecordedEvent> replayEvents;
+static Uint32 replayStart = 0;
+
+void OpenRecording(const char * filename){
+  CloseRecording();
+
+  recordFile = fopen(filename, "wb");
+  if (recordFile == NULL){
+    rb_raise(rb_eIOError, "Unable to open %s for recording", filename);
+  }
+
+  WriteUint32(recordFile, REPLAY_MAGIC);
+  WriteUint32(recordFile, REPLAY_VERSION);
+
+  static bool closeAtExit = false;
+  if (!closeAtExit){
+    atexit(CloseRecording);
+    closeAtExit = true;
+  }
+}
+
+void OpenReplay(const char * filename){
+  if (replayFile != NULL){
+    fclose(replayFile);
+  }
+
+  replayFile = fopen(filename, "rb");
+  if (replayFile == NULL){
+    rb_raise(rb_eIOError, "Unable to open recording %s", filename);
+  }
+
+  Uint32 magic, version;
+  if (!ReadUint32(replayFile, magic) || magic != REPLAY_MAGIC ||
+      !ReadUint32(replayFile, version) || version != REPLAY_VERSION ||
+      !ReadUint32(replayFile, replayStart)){
+    fclose(replayFile);
+    replayFile = NULL;
+    rb_raise(rb_eIOError, "%s is not a Rug recording", filename);
+  }
+}
+
+bool Recording(){
+  return recordFile != NULL;
+}
+
+bool Replaying(){
+  return replayFile != NULL;
+}
+
+void RecordStart(Uint32 ticks){
+  if (recordFile != NULL){
+    WriteUint32(recordFile, ticks);
+  }
+}
+
+Uint32 ReplayStart(){
+  return replayStart;
+}
+
+void RecordEvent(const RecordedEvent & event){
+  if (recordFile != NULL){
+    recordEvents.push_back(event);
+  }
+}
+
+static void WriteEvent(const RecordedEvent & event){
+  const SDL_Event & ev = event.ev;
+  fputc(ev.type, recordFile);
+
+  switch (ev.type){
+  case SDL_KEYUP:
+  case SDL_KEYDOWN:
+    WriteUint32(recordFile, ev.key.keysym.sym);
+    break;
+  case SDL_MOUSEMOTION:
+    WriteUint32(recordFile, ev.motion.x);
+    WriteUint32(recordFile, ev.motion.y);
+    WriteUint32(recordFile, (Uint32)event.xrel);
+    WriteUint32(recordFile, (Uint32)event.yrel);
+    break;
+  case SDL_MOUSEBUTTONDOWN:
+  case SDL_MOUSEBUTTONUP:
+    WriteUint32(recordFile, ev.button.x);
+    WriteUint32(recordFile, ev.button.y);
+    WriteUint32(recordFile, ev.button.button);
+    break;
+  default:
+    break;
+  }
+}
+
+void RecordFrame(Uint32 now){
+  if (recordFile == NULL){
+    return;
+  }
+
+  WriteUint32(recordFile, now);
+  WriteUint32(recordFile, recordEvents.size());
+  for (size_t i = 0; i < recordEvents.size(); i++){
+    WriteEvent(recordEvents[i]);
+  }
+  recordEvents.clear();
+}
+
+static bool ReadEvent(RecordedEvent & event){
+  memset(&event, 0, sizeof(event));
+
+  int type = fgetc(replayFile);
+  if (type == EOF){
+    return false;
+  }
+  event.ev.type = type;
+
+  Uint32 a, b, c, d;
+  switch (type){
+  case SDL_KEYUP:
+  case SDL_KEYDOWN:
+    if (!ReadUint32(replayFile, a)){
+      return false;
+    }
+    event.ev.key.keysym.sym = (SDLKey)a;
+    break;
+  case SDL_MOUSEMOTION:
+    if (!ReadUint32(replayFile, a) || !ReadUint32(replayFile, b) ||
+        !ReadUint32(replayFile, c) || !ReadUint32(replayFile, d)){
+      return false;
+    }
+    event.ev.motion.x = a;
+    event.ev.motion.y = b;
+    event.xrel = (int)c;
+    event.yrel = (int)d;
+    break;
+  case SDL_MOUSEBUTTONDOWN:
+  case SDL_MOUSEBUTTONUP:
+    if (!ReadUint32(replayFile, a) || !ReadUint32(replayFile, b) || !ReadUint32(replayFile, c)){
+      return false;
+    }
+    event.ev.button.x = a;
+    event.ev.button.y = b;
+    event.ev.button.button = c;
+    break;
+  default:
+    break;
+  }
+
+  return true;
+}
+
+bool ReplayFrame(Uint32 & now){
+  replayEvents.clear();
+  if (replayFile == NULL){
+    return false;
+  }
+
+  Uint32 count;
+  if (!ReadUint32(replayFile, now) || !ReadUint32(replayFile, count)){
+    return false;
+  }
+
+  for (Uint32 i = 0; i < count; i++){
+    RecordedEvent event;
+    if (!ReadEvent(event)){
+      return false;
+    }
+    replayEvents.push_back(event);
+  }
+
+  return true;
+}
+
+void TakeReplayEvents(vector<RecordedEvent> & events){
+  events.clear();
+  events.swap(replayEvents);
+}
+
+// The events since the last frame, such as the quit that ended the game,
+// go out as one last frame
+void CloseRecording(){
+  if (recordFile == NULL){
+    return;
+  }
+
+  if (!recordEvents.empty()){
+    RecordFrame(RugGetTicks());
+  }
+
+  fclose(recordFile);
+  recordFile = NULL;
+}
@@ -0,0 +1,39 @@
+#ifndef RUG_REPLAY_H
+#define RUG_REPLAY_H
+
+#include "ruby.h"
+#include <SDL/SDL.h>
+#include <vector>
+
+// An event as it is dispatched, after mouse motion has been merged
+typedef struct {
+  SDL_Event ev;
+  int xrel, yrel;
+} RecordedEvent;
+
+// Recording writes every dispatched event and the time of every frame.
+// These raise a Ruby exception if the file can't be opened or isn't a
+// recording.
+void OpenRecording(const char * filename);
+void OpenReplay(const char * filename);
+
+bool Recording();
+bool Replaying();
+
+// The time the game loop starts counting from, after the load block
+void RecordStart(Uint32 ticks);
+Uint32 ReplayStart();
+
+void RecordEvent(const RecordedEvent &);
+void RecordFrame(Uint32 now);
+
+// Reads the next frame of a replay, returning false at the end of it
+bool ReplayFrame(Uint32 & now);
+
+// Moves the events of the frame read last into _events_. They can only be
+// taken once, so pumping events again in the same frame doesn't repeat them.
+void TakeReplayEvents(std::vector<RecordedEvent> & events);
+
+void CloseRecording();
+
+#endif //RUG_REPLAY_H
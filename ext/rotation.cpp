@@ -0,0 +1,100 @@
+#include "rotation.h"
+#include "image.h"
+#include "conf.h"
+
+#include <SDL/SDL_rotozoom.h>
+#include <math.h>
+#include <list>
+#include <map>
+
+using namespace std;
+
+extern _RugConf RugConf;
+
+typedef struct {
+  RugRotationCache * owner;
+  int step;
+  SDL_Surface * surface;
+  long bytes;
+} RugRotation;
+
+// All the cached rotations of every image share one budget, with the
+// most recently used at the front
+static list<RugRotation> rotations;
+static long rotationBytes = 0;
+
+struct RugRotationCache {
+  int steps;
+  map<int, list<RugRotation>::iterator> rendered;
+};
+
+RugRotationCache * NewRotationCache(int steps){
+  RugRotationCache * cache = new RugRotationCache;
+  cache->steps = steps;
+  return cache;
+}
+
+int RotationCacheSteps(RugRotationCache * cache){
+  return cache->steps;
+}
+
+static void DropRotation(list<RugRotation>::iterator it){
+  it->owner->rendered.erase(it->step);
+  rotationBytes -= it->bytes;
+  SDL_FreeSurface(it->surface);
+  rotations.erase(it);
+}
+
+// Throws away the least recently used rotations until everything fits,
+// but never the one at the front, which is about to be drawn
+static void TrimRotations(){
+  while (rotationBytes > RugConf.rotationCacheSize && rotations.size() > 1){
+    DropRotation(--rotations.end());
+  }
+}
+
+// Gets source rotated by the nearest step to degrees. The cache keeps
+// the reference, take another one if it needs to outlive the next call.
+SDL_Surface * GetRotation(RugRotationCache * cache, SDL_Surface * source, double degrees){
+  int step = (int)floor(fmod(degrees, 360.0) / 360.0 * cache->steps + 0.5);
+  step = ((step % cache->steps) + cache->steps) % cache->steps;
+
+  map<int, list<RugRotation>::iterator>::iterator found = cache->rendered.find(step);
+  if (found != cache->rendered.end()){
+    rotations.splice(rotations.begin(), rotations, found->second);
+    return found->second->surface;
+  }
+
+  SDL_Surface * rotated = rotozoomSurface(source, step * 360.0 / cache->steps, 1.0, SMOOTHING_ON);
+  if (rotated == NULL){
+    return NULL;
+  }
+
+  // this is going to be blitted many times, so match the screen
+  rotated = ConvertToDisplay(rotated);
+
+  RugRotation rotation;
+  rotation.owner = cache;
+  rotation.step = step;
+  rotation.surface = rotated;
+  rotation.bytes = (long)rotated->pitch * rotated->h;
+
+  rotations.push_front(rotation);
+  cache->rendered[step] = rotations.begin();
+  rotationBytes += rotation.bytes;
+
+  TrimRotations();
+
+  return rotated;
+}
+
+void ClearRotationCache(RugRotationCache * cache){
+  while (!cache->rendered.empty()){
+    DropRotation(cache->rendered.begin()->second);
+  }
+}
+
+void FreeRotationCache(RugRotationCache * cache){
+  ClearRotationCache(cache);
+  delete cache;
+}
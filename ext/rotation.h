@@ -0,0 +1,15 @@
+#ifndef RUG_ROTATION_H
+#define RUG_ROTATION_H
+
+#include <SDL/SDL.h>
+
+// Rotations of one image, quantized to a number of steps per turn
+typedef struct RugRotationCache RugRotationCache;
+
+RugRotationCache * NewRotationCache(int steps);
+int RotationCacheSteps(RugRotationCache *);
+SDL_Surface * GetRotation(RugRotationCache *, SDL_Surface * source, double degrees);
+void ClearRotationCache(RugRotationCache *);
+void FreeRotationCache(RugRotationCache *);
+
+#endif //RUG_ROTATION_H
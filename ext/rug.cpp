@@ -2,13 +2,27 @@
 
 #include "conf.h"
 #include "image.h"
+#include "colour.h"
 #include "events.h"
 #include "layer.h"
 #include "graphics.h"
+#include "spatial.h"
+#include "loader.h"
+#include "atlas.h"
+#include "tilemap.h"
+#include "chunked.h"
+#include "particles.h"
+#include "bodies.h"
+#include "sweep.h"
+#include "profiler.h"
+#include "replay.h"
+#include "pixels.h"
+#include "animation.h"
 
 #include <SDL/SDL.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <math.h>
 
 SDL_Surface * mainWnd = NULL;
 VALUE loadFunc, updateFunc;
@@ -35,7 +49,9 @@ static VALUE RugLoad(int argc, VALUE * argv, VALUE klass){
 /*
  * Sets the Rug draw function. Requires a block to be passed with the
  * code to be executed on each draw. This block does not have any
- * arguments.
+ * arguments, unless a fixed time step is set in the configuration, in
+ * which case it is passed the interpolation factor between the last two
+ * updates.
  */
 static VALUE RugDraw(int argc, VALUE * argv, VALUE klass){
   if (rb_block_given_p()){
@@ -50,7 +66,7 @@ static VALUE RugDraw(int argc, VALUE * argv, VALUE klass){
  * Sets the Rug update function. Requires a block to be passed with the
  * code to be executed on each update. The block must accept one argument
  * which is the amount of time in milliseconds that has passed since the
- * last update.
+ * last update. With a fixed time step this is always the same.
  *
  * Usage:
  *
@@ -70,50 +86,152 @@ static VALUE RugUpdate(int argc, VALUE * argv, VALUE klass){
 
 /*
  * Runs the application. This method will block until the program quits.
+ * If checksums are turned on in the configuration it returns the checksum
+ * of every frame drawn, otherwise nil.
  */
 static VALUE RugStart(VALUE klass){
+  // putenv keeps the string, so it can't be a literal or on the stack. A
+  // driver picked by the user is left alone.
+  static char dummyDriver[] = "SDL_VIDEODRIVER=dummy";
+  if (RugConf.headless && getenv("SDL_VIDEODRIVER") == NULL){
+    SDL_putenv(dummyDriver);
+  }
+
   SDL_Init(SDL_INIT_VIDEO);
   atexit(SDL_Quit);
 
-  SDL_Event ev;
   int lastDraw = 0;
 
   int frameGap = RugConf.frameGap;
 
+  // fixed time step state, tick is in milliseconds
+  bool fixedStep = RugConf.tickRate > 0;
+  double tick = fixedStep ? 1000.0 / RugConf.tickRate : 0.0;
+  double accumulator = 0.0;
+
+  int frames = 0;
+  VALUE checksums = RugConf.checksums ? rb_ary_new() : Qnil;
+
+  // headless runs and replays keep their own time, headless time moves on
+  // exactly one frame each time around and replays take it from the log
+  bool replaying = Replaying();
+  bool stepped = RugConf.headless && !replaying;
+  if (RugConf.headless || replaying){
+    SetTicks(0);
+  }
+
   mainWnd = DoConf();
 
   if (loadFunc != Qnil){
     rb_funcall(loadFunc, rb_intern("call"), 0);
   }
 
-  // TODO: make background configurable
-  Uint32 black = SDL_MapRGB(mainWnd->format, 0, 0, 0);
+  if (replaying){
+    SetTicks(ReplayStart());
+  }
+  RecordStart(RugGetTicks());
+
+  // don't count the time spent loading as time to simulate
+  if (fixedStep){
+    lastDraw = RugGetTicks();
+  }
 
   while (1){
-    if (SDL_PollEvent(&ev)){
-      if (!HandleEvent(ev)){
+    if (replaying){
+      Uint32 ticks;
+      if (!ReplayFrame(ticks)){
         break;
       }
+      SetTicks(ticks);
+    }else if (stepped){
+      AdvanceTicks(fixedStep ? tick : frameGap);
     }
 
-    int now = SDL_GetTicks();
-    if (lastDraw + frameGap < now){
+    ProfileBegin("events");
+    if (!HandleEvents()){
+      break;
+    }
+    ProfileEnd();
+
+    ProfileBegin("loads");
+    PumpImageLoads();
+    ProfileEnd();
+
+    ProfileBegin("animations");
+    AdvanceAnimations(RugGetTicks());
+    ProfileEnd();
+
+    bool drew = false;
+    int now = RugGetTicks();
+    if (fixedStep){
+      accumulator += stepped ? tick : now - lastDraw;
+      lastDraw = now;
+
+      int steps = 0;
+      while (accumulator >= tick && steps < RugConf.maxCatchup){
+        if (updateFunc != Qnil){
+          ProfileBegin("update");
+          rb_funcall(updateFunc, rb_intern("call"), 1, rb_float_new(tick));
+          ProfileEnd();
+        }
+        accumulator -= tick;
+        steps++;
+      }
+
+      // too far behind, drop the time we couldn't simulate
+      if (accumulator >= tick){
+        accumulator = fmod(accumulator, tick);
+      }
+
+      // render every time around, with the state between the last two
+      // ticks, then sleep below until there is something new to show
+      RenderGraphics(rb_float_new(accumulator / tick));
+      ProfileFrame();
+      drew = true;
+    }else if (stepped || replaying || lastDraw + frameGap < now){
       // update
       if (updateFunc != Qnil){
+        ProfileBegin("update");
         rb_funcall(updateFunc, rb_intern("call"), 1, INT2NUM(now - lastDraw));
+        ProfileEnd();
       }
 
       // render
-      SDL_FillRect(mainWnd, NULL, black);
-
       RenderGraphics();
+      ProfileFrame();
       lastDraw = now;
+      drew = true;
+    }
+
+    if (drew){
+      RecordFrame(now);
+      frames++;
+
+      if (checksums != Qnil){
+        rb_ary_push(checksums, UINT2NUM(ScreenChecksum()));
+      }
+      if (RugConf.frameLimit > 0 && frames >= RugConf.frameLimit){
+        break;
+      }
     }
 
-    SDL_Delay(1);
+    if (!RugConf.headless && !replaying){
+      if (fixedStep){
+        // wait for the next tick or the next frame, whichever is sooner,
+        // less the time it took to draw this one
+        int wait = (int)(tick - accumulator);
+        if (wait > frameGap){
+          wait = frameGap;
+        }
+        wait -= RugGetTicks() - now;
+        SDL_Delay(wait > 1 ? wait : 1);
+      }else{
+        SDL_Delay(1);
+      }
+    }
   }
 
-  return Qnil;
+  return checksums;
 }
 
 /*
@@ -127,7 +245,17 @@ VALUE RugShowCursor(VALUE klass, VALUE show){
  * Gets the number of milliseconds passed since the program started.
  */
 VALUE RugGetTime(VALUE klass){
-  return INT2FIX(SDL_GetTicks());
+  return INT2FIX(RugGetTicks());
+}
+
+/*
+ * Gets a checksum of what is on the screen right now.
+ */
+VALUE RugChecksum(VALUE klass){
+  if (mainWnd == NULL){
+    return Qnil;
+  }
+  return UINT2NUM(ScreenChecksum());
 }
 
 /*
@@ -167,13 +295,26 @@ void Init_Rug(){
   rb_define_singleton_method(mRug, "get_time", (VALUE (*)(...))RugGetTime, 0);
   rb_define_singleton_method(mRug, "width", (VALUE (*)(...))RugGetWidth, 0);
   rb_define_singleton_method(mRug, "height", (VALUE (*)(...))RugGetHeight, 0);
+  rb_define_singleton_method(mRug, "checksum", (VALUE (*)(...))RugChecksum, 0);
 
   // load additional classes/modules
   LoadConf(mRug);
   LoadEvents(mRug);
+  LoadColour(mRug);
   LoadImageModule(mRug);
+  LoadLoader(mRug);
+  LoadAtlas(mRug);
   LoadLayer(mRug);
   LoadGraphics(mRug);
+  LoadSpatial(mRug);
+  LoadTilemap(mRug);
+  LoadChunkedImage(mRug);
+  LoadParticles(mRug);
+  LoadBodies(mRug);
+  LoadSweep(mRug);
+  LoadProfiler(mRug);
+  LoadPixels(mRug);
+  LoadAnimation(mRug);
 }
 #ifdef __cplusplus
 }
@@ -0,0 +1,286 @@
+#include "spatial.h"
+
+#include <math.h>
+#include <map>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+VALUE cRugSpatialHash;
+
+// must be a power of two
+static const int NUM_BUCKETS = 4096;
+
+typedef struct {
+  VALUE obj;
+  double x, y, w, h;
+  int cx0, cy0, cx1, cy1;
+  unsigned long order;
+  unsigned int stamp;
+  bool live;
+} SpatialEntry;
+
+typedef struct {
+  double cellSize;
+  vector<SpatialEntry> entries;
+  vector<int> freeEntries;
+  vector< vector<int> > buckets;
+  map<VALUE, int> index;
+  unsigned long nextOrder;
+  unsigned int stamp;
+} RugSpatialHash;
+
+// Multiplied as unsigned, signed overflow is undefined
+static inline int HashCell(int cx, int cy){
+  return (int)((((unsigned)cx * 73856093u) ^ ((unsigned)cy * 19349663u)) & (NUM_BUCKETS - 1));
+}
+
+static inline int CellCoord(RugSpatialHash * hash, double v){
+  return (int)floor(v / hash->cellSize);
+}
+
+static void BucketRemove(vector<int> & bucket, int id){
+  for (size_t i = 0; i < bucket.size(); i++){
+    if (bucket[i] == id){
+      bucket[i] = bucket.back();
+      bucket.pop_back();
+      return;
+    }
+  }
+}
+
+static void LinkEntry(RugSpatialHash * hash, int id){
+  SpatialEntry & e = hash->entries[id];
+  for (int cy = e.cy0; cy <= e.cy1; cy++){
+    for (int cx = e.cx0; cx <= e.cx1; cx++){
+      vector<int> & bucket = hash->buckets[HashCell(cx, cy)];
+
+      // large bodies can hash several cells to the same bucket
+      if (find(bucket.begin(), bucket.end(), id) == bucket.end()){
+        bucket.push_back(id);
+      }
+    }
+  }
+}
+
+static void UnlinkEntry(RugSpatialHash * hash, int id){
+  SpatialEntry & e = hash->entries[id];
+  for (int cy = e.cy0; cy <= e.cy1; cy++){
+    for (int cx = e.cx0; cx <= e.cx1; cx++){
+      BucketRemove(hash->buckets[HashCell(cx, cy)], id);
+    }
+  }
+}
+
+static bool SortByOrder(const SpatialEntry * a, const SpatialEntry * b){
+  return a->order < b->order;
+}
+
+// Collects every live entry overlapping the box, in insertion order
+static void QueryBox(RugSpatialHash * hash, double x, double y, double w, double h,
+    int skip, vector<SpatialEntry *> & found){
+  int cx0 = CellCoord(hash, x), cx1 = CellCoord(hash, x + w);
+  int cy0 = CellCoord(hash, y), cy1 = CellCoord(hash, y + h);
+
+  // the stamp marks entries already visited by this query
+  hash->stamp++;
+
+  for (int cy = cy0; cy <= cy1; cy++){
+    for (int cx = cx0; cx <= cx1; cx++){
+      vector<int> & bucket = hash->buckets[HashCell(cx, cy)];
+      for (size_t i = 0; i < bucket.size(); i++){
+        SpatialEntry & e = hash->entries[bucket[i]];
+        if (bucket[i] == skip || e.stamp == hash->stamp){
+          continue;
+        }
+        e.stamp = hash->stamp;
+
+        if (e.x <= x + w && x <= e.x + e.w && e.y <= y + h && y <= e.y + e.h){
+          found.push_back(&e);
+        }
+      }
+    }
+  }
+
+  sort(found.begin(), found.end(), SortByOrder);
+}
+
+static VALUE FoundToArray(vector<SpatialEntry *> & found){
+  VALUE res = rb_ary_new2(found.size());
+  for (size_t i = 0; i < found.size(); i++){
+    rb_ary_push(res, found[i]->obj);
+  }
+  return res;
+}
+
+static void mark_spatial_hash(void * vp){
+  RugSpatialHash * hash = (RugSpatialHash *)vp;
+  for (size_t i = 0; i < hash->entries.size(); i++){
+    if (hash->entries[i].live){
+      rb_gc_mark(hash->entries[i].obj);
+    }
+  }
+}
+
+static void unload_spatial_hash(void * vp){
+  delete (RugSpatialHash *)vp;
+}
+
+/*
+ * Creates a spatial hash. Objects are sorted into square cells that are
+ * _cell_size_ pixels across, so this should be around the size of a
+ * typical body.
+ */
+static VALUE RugCreateSpatialHash(int argc, VALUE * argv, VALUE klass){
+  VALUE cellSize;
+  rb_scan_args(argc, argv, "01", &cellSize);
+
+  RugSpatialHash * hash = new RugSpatialHash;
+
+  hash->cellSize = (cellSize == Qnil) ? 64.0 : NUM2DBL(cellSize);
+  if (hash->cellSize <= 0.0){
+    delete hash;
+    rb_raise(rb_eArgError, "cell size must be positive");
+  }
+
+  hash->buckets.resize(NUM_BUCKETS);
+  hash->nextOrder = 0;
+  hash->stamp = 0;
+
+  return Data_Wrap_Struct(cRugSpatialHash, mark_spatial_hash, unload_spatial_hash, hash);
+}
+
+/*
+ * Sets the bounding box of _obj_, adding it to the hash if it is not
+ * already there. Objects that stay within the same cells are not
+ * re-bucketed, so this is cheap to call every time something moves.
+ */
+static VALUE RugSpatialHashUpdate(VALUE self, VALUE obj, VALUE rx, VALUE ry, VALUE rw, VALUE rh){
+  RugSpatialHash * hash;
+  Data_Get_Struct(self, RugSpatialHash, hash);
+
+  double x = NUM2DBL(rx), y = NUM2DBL(ry);
+  double w = NUM2DBL(rw), h = NUM2DBL(rh);
+
+  int cx0 = CellCoord(hash, x), cx1 = CellCoord(hash, x + w);
+  int cy0 = CellCoord(hash, y), cy1 = CellCoord(hash, y + h);
+
+  map<VALUE, int>::iterator it = hash->index.find(obj);
+  int id;
+
+  if (it == hash->index.end()){
+    if (hash->freeEntries.empty()){
+      id = hash->entries.size();
+      hash->entries.push_back(SpatialEntry());
+    }else{
+      id = hash->freeEntries.back();
+      hash->freeEntries.pop_back();
+    }
+
+    SpatialEntry & e = hash->entries[id];
+    e.obj   = obj;
+    e.order = hash->nextOrder++;
+    e.stamp = 0;
+    e.live  = true;
+    e.cx0 = cx0; e.cy0 = cy0; e.cx1 = cx1; e.cy1 = cy1;
+
+    hash->index[obj] = id;
+    LinkEntry(hash, id);
+  }else{
+    id = it->second;
+    SpatialEntry & e = hash->entries[id];
+
+    if (e.cx0 != cx0 || e.cy0 != cy0 || e.cx1 != cx1 || e.cy1 != cy1){
+      UnlinkEntry(hash, id);
+      e.cx0 = cx0; e.cy0 = cy0; e.cx1 = cx1; e.cy1 = cy1;
+      LinkEntry(hash, id);
+    }
+  }
+
+  SpatialEntry & e = hash->entries[id];
+  e.x = x; e.y = y; e.w = w; e.h = h;
+
+  return obj;
+}
+
+/*
+ * Removes _obj_ from the hash. Does nothing if it isn't in there.
+ */
+static VALUE RugSpatialHashRemove(VALUE self, VALUE obj){
+  RugSpatialHash * hash;
+  Data_Get_Struct(self, RugSpatialHash, hash);
+
+  map<VALUE, int>::iterator it = hash->index.find(obj);
+  if (it == hash->index.end()){
+    return Qnil;
+  }
+
+  int id = it->second;
+  UnlinkEntry(hash, id);
+  hash->entries[id].live = false;
+  hash->entries[id].obj = Qnil;
+  hash->freeEntries.push_back(id);
+  hash->index.erase(it);
+
+  return obj;
+}
+
+/*
+ * Returns all the objects whose bounding boxes overlap the box at _x_, _y_
+ * with width _w_ and height _h_. Objects are returned in the order that
+ * they were added.
+ */
+static VALUE RugSpatialHashQuery(VALUE self, VALUE x, VALUE y, VALUE w, VALUE h){
+  RugSpatialHash * hash;
+  Data_Get_Struct(self, RugSpatialHash, hash);
+
+  vector<SpatialEntry *> found;
+  QueryBox(hash, NUM2DBL(x), NUM2DBL(y), NUM2DBL(w), NUM2DBL(h), -1, found);
+
+  return FoundToArray(found);
+}
+
+/*
+ * Returns all the objects whose bounding boxes overlap the bounding box
+ * of _obj_, not including _obj_ itself. These are the only objects that
+ * _obj_ can possibly be colliding with.
+ */
+static VALUE RugSpatialHashCandidates(VALUE self, VALUE obj){
+  RugSpatialHash * hash;
+  Data_Get_Struct(self, RugSpatialHash, hash);
+
+  map<VALUE, int>::iterator it = hash->index.find(obj);
+  if (it == hash->index.end()){
+    return rb_ary_new();
+  }
+
+  SpatialEntry & e = hash->entries[it->second];
+
+  vector<SpatialEntry *> found;
+  QueryBox(hash, e.x, e.y, e.w, e.h, it->second, found);
+
+  return FoundToArray(found);
+}
+
+/*
+ * Gets the number of objects in the hash.
+ */
+static VALUE RugSpatialHashSize(VALUE self){
+  RugSpatialHash * hash;
+  Data_Get_Struct(self, RugSpatialHash, hash);
+  return INT2FIX(hash->index.size());
+}
+
+void LoadSpatial(VALUE mRug){
+  VALUE mPhysics = rb_define_module_under(mRug, "Physics");
+
+  cRugSpatialHash = rb_define_class_under(mPhysics, "SpatialHash", rb_cObject);
+
+  rb_define_singleton_method(cRugSpatialHash, "new", (VALUE (*)(...))RugCreateSpatialHash, -1);
+  rb_define_method(cRugSpatialHash, "update",     (VALUE (*)(...))RugSpatialHashUpdate,     5);
+  rb_define_method(cRugSpatialHash, "remove",     (VALUE (*)(...))RugSpatialHashRemove,     1);
+  rb_define_method(cRugSpatialHash, "query",      (VALUE (*)(...))RugSpatialHashQuery,      4);
+  rb_define_method(cRugSpatialHash, "candidates", (VALUE (*)(...))RugSpatialHashCandidates, 1);
+  rb_define_method(cRugSpatialHash, "size",       (VALUE (*)(...))RugSpatialHashSize,       0);
+}
@@ -0,0 +1,8 @@
+#ifndef RUG_SPATIAL_H
+#define RUG_SPATIAL_H
+
+#include "ruby.h"
+
+void LoadSpatial(VALUE);
+
+#endif //RUG_SPATIAL_H
@@ -0,0 +1,204 @@
+#include "sweep.h"
+
+#include <math.h>
+#include <algorithm>
+
+using namespace std;
+
+typedef struct {
+  double toi, nx, ny;
+} SweepHit;
+
+static VALUE HitToArray(const SweepHit & hit){
+  return rb_ary_new3(3, rb_float_new(hit.toi), rb_float_new(hit.nx), rb_float_new(hit.ny));
+}
+
+// Finds when a point moving by (dx, dy) first enters the box, using the
+// slab method. Points already inside are not hits, callers check that.
+static bool SweepPointBox(double px, double py, double dx, double dy,
+                          double x0, double y0, double x1, double y1, SweepHit & hit){
+  double enter = -HUGE_VAL, leave = HUGE_VAL;
+  hit.nx = hit.ny = 0;
+
+  if (dx == 0){
+    if (px <= x0 || px >= x1){
+      return false;
+    }
+  }else{
+    double t0 = ((dx > 0 ? x0 : x1) - px) / dx;
+    double t1 = ((dx > 0 ? x1 : x0) - px) / dx;
+    if (t0 > enter){
+      enter = t0;
+      hit.nx = dx > 0 ? -1 : 1;
+    }
+    leave = min(leave, t1);
+  }
+
+  if (dy == 0){
+    if (py <= y0 || py >= y1){
+      return false;
+    }
+  }else{
+    double t0 = ((dy > 0 ? y0 : y1) - py) / dy;
+    double t1 = ((dy > 0 ? y1 : y0) - py) / dy;
+    if (t0 > enter){
+      enter = t0;
+      hit.nx = 0;
+      hit.ny = dy > 0 ? -1 : 1;
+    }
+    leave = min(leave, t1);
+  }
+
+  if (enter > leave || enter < 0 || enter > 1){
+    return false;
+  }
+
+  hit.toi = enter;
+  return true;
+}
+
+// Finds when a point moving by (dx, dy) first comes within r of (cx, cy)
+static bool SweepPointCircle(double px, double py, double dx, double dy,
+                             double cx, double cy, double r, SweepHit & hit){
+  double fx = px - cx, fy = py - cy;
+
+  double a = dx * dx + dy * dy;
+  double b = fx * dx + fy * dy;
+  double c = fx * fx + fy * fy - r * r;
+
+  // not moving, or moving away
+  if (a == 0 || b >= 0){
+    return false;
+  }
+
+  double disc = b * b - a * c;
+  if (disc < 0){
+    return false;
+  }
+
+  double t = (-b - sqrt(disc)) / a;
+  if (t < 0 || t > 1){
+    return false;
+  }
+
+  hit.toi = t;
+  hit.nx = (fx + dx * t) / r;
+  hit.ny = (fy + dy * t) / r;
+  return true;
+}
+
+/*
+ * Sweeps a rectangle at _x1_, _y1_ of size _w1_ x _h1_ by _dx_, _dy_
+ * against a still rectangle at _x2_, _y2_ of size _w2_ x _h2_.
+ *
+ * Returns nil if they don't touch during the move, otherwise an array of
+ * the time of impact from 0 to 1 and the x and y of the contact normal,
+ * which points back towards the moving rectangle. If they already overlap
+ * the time of impact is 0 and the normal is 0, 0.
+ */
+static VALUE RugSweepRectRect(VALUE klass, VALUE x1, VALUE y1, VALUE w1, VALUE h1,
+                              VALUE dx, VALUE dy, VALUE x2, VALUE y2, VALUE w2, VALUE h2){
+  double ax = NUM2DBL(x1), ay = NUM2DBL(y1), aw = NUM2DBL(w1), ah = NUM2DBL(h1);
+  double bx = NUM2DBL(x2), by = NUM2DBL(y2), bw = NUM2DBL(w2), bh = NUM2DBL(h2);
+
+  SweepHit hit;
+
+  if (ax < bx + bw && ax + aw > bx && ay < by + bh && ay + ah > by){
+    hit.toi = hit.nx = hit.ny = 0;
+    return HitToArray(hit);
+  }
+
+  // sweep the top left corner against the second rectangle grown by the first
+  if (!SweepPointBox(ax, ay, NUM2DBL(dx), NUM2DBL(dy), bx - aw, by - ah, bx + bw, by + bh, hit)){
+    return Qnil;
+  }
+
+  return HitToArray(hit);
+}
+
+/*
+ * Sweeps a circle centred on _x1_, _y1_ with radius _r1_ by _dx_, _dy_
+ * against a still circle centred on _x2_, _y2_ with radius _r2_. Returns
+ * the same as Rug::Physics.sweep_rect_rect.
+ */
+static VALUE RugSweepCircleCircle(VALUE klass, VALUE x1, VALUE y1, VALUE r1,
+                                  VALUE dx, VALUE dy, VALUE x2, VALUE y2, VALUE r2){
+  double ax = NUM2DBL(x1), ay = NUM2DBL(y1);
+  double bx = NUM2DBL(x2), by = NUM2DBL(y2);
+  double r = NUM2DBL(r1) + NUM2DBL(r2);
+
+  SweepHit hit;
+
+  double fx = ax - bx, fy = ay - by;
+  if (fx * fx + fy * fy < r * r){
+    hit.toi = hit.nx = hit.ny = 0;
+    return HitToArray(hit);
+  }
+
+  if (!SweepPointCircle(ax, ay, NUM2DBL(dx), NUM2DBL(dy), bx, by, r, hit)){
+    return Qnil;
+  }
+
+  return HitToArray(hit);
+}
+
+/*
+ * Sweeps a circle centred on _cx_, _cy_ with radius _r_ by _dx_, _dy_
+ * against a still rectangle at _x_, _y_ of size _w_ x _h_. Returns the
+ * same as Rug::Physics.sweep_rect_rect.
+ */
+static VALUE RugSweepCircleRect(VALUE klass, VALUE cx, VALUE cy, VALUE radius,
+                                VALUE rdx, VALUE rdy, VALUE x, VALUE y, VALUE w, VALUE h){
+  double px = NUM2DBL(cx), py = NUM2DBL(cy), r = NUM2DBL(radius);
+  double dx = NUM2DBL(rdx), dy = NUM2DBL(rdy);
+  double x0 = NUM2DBL(x), y0 = NUM2DBL(y);
+  double x1 = x0 + NUM2DBL(w), y1 = y0 + NUM2DBL(h);
+
+  SweepHit hit;
+
+  double closestX = max(x0, min(px, x1)), closestY = max(y0, min(py, y1));
+  double fx = px - closestX, fy = py - closestY;
+  if (fx * fx + fy * fy < r * r){
+    hit.toi = hit.nx = hit.ny = 0;
+    return HitToArray(hit);
+  }
+
+  // The centre against the rectangle grown by the radius, with rounded
+  // corners. That's two slabs, one grown across and one grown down, and a
+  // circle on each corner, and the first of them to be hit is the contact.
+  // Missing a corner circle doesn't mean missing the shape, since the path
+  // can go on to cross one of the slabs.
+  SweepHit part;
+  bool found = false;
+
+  if (SweepPointBox(px, py, dx, dy, x0 - r, y0, x1 + r, y1, part)){
+    hit = part;
+    found = true;
+  }
+  if (SweepPointBox(px, py, dx, dy, x0, y0 - r, x1, y1 + r, part) && (!found || part.toi < hit.toi)){
+    hit = part;
+    found = true;
+  }
+
+  double cornersX[2] = { x0, x1 }, cornersY[2] = { y0, y1 };
+  for (int i = 0; i < 4; i++){
+    if (SweepPointCircle(px, py, dx, dy, cornersX[i & 1], cornersY[i >> 1], r, part) && (!found || part.toi < hit.toi)){
+      hit = part;
+      found = true;
+    }
+  }
+
+  if (!found){
+    return Qnil;
+  }
+
+  return HitToArray(hit);
+}
+
+void LoadSweep(VALUE mRug){
+  VALUE mPhysics = rb_define_module_under(mRug, "Physics");
+
+  rb_define_singleton_method(mPhysics, "sweep_rect_rect",     (VALUE (*)(...))RugSweepRectRect,     10);
+  rb_define_singleton_method(mPhysics, "sweep_circle_circle", (VALUE (*)(...))RugSweepCircleCircle,  8);
+  rb_define_singleton_method(mPhysics, "sweep_circle_rect",   (VALUE (*)(...))RugSweepCircleRect,    9);
+}
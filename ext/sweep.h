@@ -0,0 +1,8 @@
+#ifndef RUG_SWEEP_H
+#define RUG_SWEEP_H
+
+#include "ruby.h"
+
+void LoadSweep(VALUE);
+
+#endif //RUG_SWEEP_H
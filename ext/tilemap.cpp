@@ -0,0 +1,404 @@
+#include "tilemap.h"
+#include "image.h"
+#include "graphics.h"
+#include "compositor.h"
+#include "conf.h"
+
+#include <SDL/SDL.h>
+#include <map>
+#include <vector>
+
+using namespace std;
+
+VALUE cRugTilemap;
+
+extern SDL_Surface * mainWnd;
+
+typedef struct {
+  vector<Uint16> frames;
+  int delay;
+} RugTileAnimation;
+
+// Cells hold 1 + the index of the tile in the tileset, counting left to
+// right and then top to bottom, or 0 if they are empty
+typedef struct {
+  VALUE tileset;
+  int tileWidth, tileHeight;
+  int columns, rows;
+  vector< vector<Uint16> > layers;
+  map<Uint16, RugTileAnimation> animations;
+  vector<Uint16> frameOf; // what each tile looks like, kept between draws
+} RugTilemap;
+
+static void mark_tilemap(void * vp){
+  rb_gc_mark(((RugTilemap *)vp)->tileset);
+}
+
+static void unload_tilemap(void * vp){
+  delete (RugTilemap *)vp;
+}
+
+static RugTilemap * GetTilemap(VALUE self){
+  RugTilemap * tilemap;
+  Data_Get_Struct(self, RugTilemap, tilemap);
+  return tilemap;
+}
+
+static Uint16 & GetCell(RugTilemap * tilemap, VALUE rcol, VALUE rrow, VALUE rlayer){
+  int col = NUM2INT(rcol), row = NUM2INT(rrow);
+  int layer = (rlayer == Qnil) ? 0 : NUM2INT(rlayer);
+
+  if (col < 0 || col >= tilemap->columns || row < 0 || row >= tilemap->rows){
+    rb_raise(rb_eIndexError, "cell %d, %d is outside the tilemap", col, row);
+  }
+  if (layer < 0 || layer >= (int)tilemap->layers.size()){
+    rb_raise(rb_eIndexError, "the tilemap has no layer %d", layer);
+  }
+
+  return tilemap->layers[layer][row * tilemap->columns + col];
+}
+
+// Cells only have room for tiles up to 65535
+static Uint16 GetTile(VALUE rtile){
+  int tile = NUM2INT(rtile);
+  if (tile < 0 || tile > 65535){
+    rb_raise(rb_eArgError, "tile %d is outside of 0..65535", tile);
+  }
+  return tile;
+}
+
+/*
+ * Creates a tilemap _columns_ by _rows_ tiles in size, drawn with tiles
+ * from _tileset_, a Rug::Image cut up into _tile_width_ by _tile_height_
+ * tiles. The map can have several layers, which are drawn on top of each
+ * other. Only the tiles that can be seen are drawn, so a tilemap can be
+ * much bigger than a Rug::Layer could be.
+ *
+ * Tiles are numbered from 1, left to right and then top to bottom in the
+ * tileset. Cells set to 0 are empty.
+ *
+ * Usage:
+ *
+ *    map = Rug::Tilemap.new Rug::Image.new("tiles.png"), 32, 32, 500, 100, 2
+ *    map[0, 0] = 5
+ *    map.set 0, 0, 12, 1  # puts tile 12 in the top left cell of layer 1
+ */
+static VALUE RugCreateTilemap(int argc, VALUE * argv, VALUE klass){
+  VALUE tileset, tileWidth, tileHeight, columns, rows, layers;
+  rb_scan_args(argc, argv, "51", &tileset, &tileWidth, &tileHeight, &columns, &rows, &layers);
+
+  if (!rb_obj_is_kind_of(tileset, cRugImage)){
+    rb_raise(rb_eTypeError, "the tileset must be a Rug::Image");
+  }
+
+  RugTilemap * tilemap = new RugTilemap;
+  tilemap->tileset    = tileset;
+  tilemap->tileWidth  = NUM2INT(tileWidth);
+  tilemap->tileHeight = NUM2INT(tileHeight);
+  tilemap->columns    = NUM2INT(columns);
+  tilemap->rows       = NUM2INT(rows);
+
+  if (tilemap->tileWidth <= 0 || tilemap->tileHeight <= 0 || tilemap->columns < 0 || tilemap->rows < 0){
+    delete tilemap;
+    rb_raise(rb_eArgError, "tilemap sizes must be positive");
+  }
+
+  int numLayers = (layers == Qnil) ? 1 : NUM2INT(layers);
+  if (numLayers < 1){
+    numLayers = 1;
+  }
+  tilemap->layers.resize(numLayers, vector<Uint16>(tilemap->columns * tilemap->rows, 0));
+
+  return Data_Wrap_Struct(cRugTilemap, mark_tilemap, unload_tilemap, tilemap);
+}
+
+/*
+ * Gets the tile in a cell of layer 0.
+ */
+static VALUE RugTilemapGet(VALUE self, VALUE col, VALUE row){
+  return INT2FIX(GetCell(GetTilemap(self), col, row, Qnil));
+}
+
+/*
+ * Sets the tile in a cell of layer 0.
+ */
+static VALUE RugTilemapSet(VALUE self, VALUE col, VALUE row, VALUE tile){
+  Uint16 value = GetTile(tile);
+  GetCell(GetTilemap(self), col, row, Qnil) = value;
+  return tile;
+}
+
+/*
+ * Gets the tile in a cell of any layer.
+ */
+static VALUE RugTilemapGetLayer(int argc, VALUE * argv, VALUE self){
+  VALUE col, row, layer;
+  rb_scan_args(argc, argv, "21", &col, &row, &layer);
+  return INT2FIX(GetCell(GetTilemap(self), col, row, layer));
+}
+
+/*
+ * Sets the tile in a cell of any layer.
+ */
+static VALUE RugTilemapSetLayer(int argc, VALUE * argv, VALUE self){
+  VALUE col, row, tile, layer;
+  rb_scan_args(argc, argv, "31", &col, &row, &tile, &layer);
+  Uint16 value = GetTile(tile);
+  GetCell(GetTilemap(self), col, row, layer) = value;
+  return tile;
+}
+
+/*
+ * Sets every cell of a layer at once from an array of tiles, going left
+ * to right and then top to bottom. The array can also be an array of
+ * rows.
+ */
+static VALUE RugTilemapLoadLayer(VALUE self, VALUE rlayer, VALUE tiles){
+  RugTilemap * tilemap = GetTilemap(self);
+
+  int layer = NUM2INT(rlayer);
+  if (layer < 0 || layer >= (int)tilemap->layers.size()){
+    rb_raise(rb_eIndexError, "the tilemap has no layer %d", layer);
+  }
+
+  VALUE flat = rb_funcall(tiles, rb_intern("flatten"), 0);
+  long count = RARRAY_LEN(flat);
+  if (count != (long)tilemap->layers[layer].size()){
+    rb_raise(rb_eArgError, "expected %d tiles, got %ld", tilemap->columns * tilemap->rows, count);
+  }
+
+  // checked before any are set, so a bad tile leaves the layer as it was
+  vector<Uint16> cells(count);
+  for (long i = 0; i < count; i++){
+    cells[i] = GetTile(rb_ary_entry(flat, i));
+  }
+  tilemap->layers[layer].swap(cells);
+
+  return self;
+}
+
+/*
+ * Animates a tile: wherever _tile_ is used, the tiles in _frames_ are
+ * shown in turn, each one for _delay_ milliseconds.
+ */
+static VALUE RugTilemapAnimate(VALUE self, VALUE tile, VALUE frames, VALUE delay){
+  RugTilemap * tilemap = GetTilemap(self);
+
+  Check_Type(frames, T_ARRAY);
+
+  Uint16 key = GetTile(tile);
+  vector<Uint16> shown;
+  for (long i = 0; i < RARRAY_LEN(frames); i++){
+    shown.push_back(GetTile(rb_ary_entry(frames, i)));
+  }
+
+  int ms = NUM2INT(delay);
+
+  RugTileAnimation & anim = tilemap->animations[key];
+  anim.frames.swap(shown);
+  anim.delay = ms;
+
+  if (anim.frames.empty() || anim.delay <= 0){
+    tilemap->animations.erase(key);
+  }
+
+  return self;
+}
+
+/*
+ * Draws the tilemap, taking the same arguments as Rug::Layer#draw, so it
+ * can be used as the backing store of a Rug::ScrollView. Only the tiles
+ * that are inside the area being drawn are blitted.
+ *
+ * Usage:
+ *
+ *    map.draw                        # draws the map at 0, 0
+ *    map.draw 0, 0, 800, 600, sx, sy # draws the 800x600 part of the map
+ *                                    # starting at sx, sy
+ */
+static VALUE RugTilemapDraw(int argc, VALUE * argv, VALUE self){
+  if (mainWnd == NULL){
+    return Qnil;
+  }
+
+  VALUE x, y, width, height, sx, sy, targetLayer;
+  rb_scan_args(argc, argv, "07", &x, &y, &width, &height, &sx, &sy, &targetLayer);
+
+  if (TYPE(width) != T_FIXNUM && TYPE(width) != T_BIGNUM){
+    targetLayer = width;
+    width = Qnil;
+  }
+
+  RugTilemap * tilemap = GetTilemap(self);
+
+  SDL_Surface * target = TargetSurface(targetLayer);
+  if (target != mainWnd){
+    FlushComposite();
+  }
+
+  RugImage * tileset;
+  Data_Get_Struct(tilemap->tileset, RugImage, tileset);
+  SDL_Surface * tiles = tileset->image;
+
+  int tilesAcross = tiles->w / tilemap->tileWidth;
+  int numTiles = tilesAcross * (tiles->h / tilemap->tileHeight);
+  if (numTiles == 0){
+    return Qnil;
+  }
+
+  // where the map is drawn, and the part of it that goes there
+  int vx = (x == Qnil) ? 0 : NUM2INT(x);
+  int vy = (y == Qnil) ? 0 : NUM2INT(y);
+  int left = 0, top = 0;
+  int w = tilemap->columns * tilemap->tileWidth, h = tilemap->rows * tilemap->tileHeight;
+
+  if (width != Qnil){
+    left = (sx == Qnil) ? 0 : NUM2INT(sx);
+    top  = (sy == Qnil) ? 0 : NUM2INT(sy);
+    w = NUM2INT(width);
+    h = (height == Qnil) ? w : NUM2INT(height);
+  }
+
+  // only what is inside the target's clip rectangle is drawn. This is
+  // worked out in ints, big maps don't fit in an SDL_Rect.
+  SDL_Rect oldClip;
+  SDL_GetClipRect(target, &oldClip);
+
+  int cx = max(vx, (int)oldClip.x);
+  int cy = max(vy, (int)oldClip.y);
+  int cw = min(vx + w, oldClip.x + oldClip.w) - cx;
+  int ch = min(vy + h, oldClip.y + oldClip.h) - cy;
+  if (cw <= 0 || ch <= 0){
+    return Qnil;
+  }
+
+  left += cx - vx;
+  top  += cy - vy;
+  w = cw;
+  h = ch;
+
+  SDL_Rect view;
+  view.x = cx;
+  view.y = cy;
+  view.w = cw;
+  view.h = ch;
+
+  // partly visible tiles at the edges are cut off by the clip rectangle
+  SDL_SetClipRect(target, &view);
+
+  // what each tile looks like right now
+  vector<Uint16> & frameOf = tilemap->frameOf;
+  frameOf.resize(numTiles + 1);
+  for (int i = 0; i <= numTiles; i++){
+    frameOf[i] = i;
+  }
+
+  Uint32 now = RugGetTicks();
+  for (map<Uint16, RugTileAnimation>::iterator it = tilemap->animations.begin(); it != tilemap->animations.end(); it++){
+    if (it->first <= numTiles){
+      RugTileAnimation & anim = it->second;
+      frameOf[it->first] = anim.frames[(now / anim.delay) % anim.frames.size()];
+    }
+  }
+
+  int firstCol = max(0, left / tilemap->tileWidth);
+  int firstRow = max(0, top / tilemap->tileHeight);
+  int lastCol  = min(tilemap->columns - 1, (left + w - 1) / tilemap->tileWidth);
+  int lastRow  = min(tilemap->rows - 1, (top + h - 1) / tilemap->tileHeight);
+
+  SDL_Rect src;
+  src.w = tilemap->tileWidth;
+  src.h = tilemap->tileHeight;
+
+  for (size_t l = 0; l < tilemap->layers.size(); l++){
+    vector<Uint16> & cells = tilemap->layers[l];
+
+    for (int row = firstRow; row <= lastRow; row++){
+      int ty = view.y + row * tilemap->tileHeight - top;
+
+      for (int col = firstCol; col <= lastCol; col++){
+        Uint16 tile = cells[row * tilemap->columns + col];
+        if (tile == 0 || tile > numTiles){
+          continue;
+        }
+
+        tile = frameOf[tile];
+        if (tile == 0 || tile > numTiles){
+          continue;
+        }
+
+        src.x = ((tile - 1) % tilesAcross) * tilemap->tileWidth;
+        src.y = ((tile - 1) / tilesAcross) * tilemap->tileHeight;
+
+        SDL_Rect dst;
+        dst.x = view.x + col * tilemap->tileWidth - left;
+        dst.y = ty;
+        BlitOnto(tiles, &src, dst, target);
+      }
+    }
+  }
+
+  SDL_SetClipRect(target, &oldClip);
+
+  if (target == mainWnd){
+    MarkDirty(view);
+  }
+
+  return Qnil;
+}
+
+/*
+ * Gets the width of the map in pixels.
+ */
+static VALUE RugTilemapWidth(VALUE self){
+  RugTilemap * tilemap = GetTilemap(self);
+  return INT2FIX(tilemap->columns * tilemap->tileWidth);
+}
+
+/*
+ * Gets the height of the map in pixels.
+ */
+static VALUE RugTilemapHeight(VALUE self){
+  RugTilemap * tilemap = GetTilemap(self);
+  return INT2FIX(tilemap->rows * tilemap->tileHeight);
+}
+
+/*
+ * Gets the number of columns of tiles.
+ */
+static VALUE RugTilemapColumns(VALUE self){
+  return INT2FIX(GetTilemap(self)->columns);
+}
+
+/*
+ * Gets the number of rows of tiles.
+ */
+static VALUE RugTilemapRows(VALUE self){
+  return INT2FIX(GetTilemap(self)->rows);
+}
+
+/*
+ * Gets the number of layers.
+ */
+static VALUE RugTilemapLayers(VALUE self){
+  return INT2FIX(GetTilemap(self)->layers.size());
+}
+
+void LoadTilemap(VALUE mRug){
+  cRugTilemap = rb_define_class_under(mRug, "Tilemap", rb_cObject);
+
+  rb_define_singleton_method(cRugTilemap, "new", (VALUE (*)(...))RugCreateTilemap, -1);
+
+  rb_define_method(cRugTilemap, "[]",         (VALUE (*)(...))RugTilemapGet,       2);
+  rb_define_method(cRugTilemap, "[]=",        (VALUE (*)(...))RugTilemapSet,       3);
+  rb_define_method(cRugTilemap, "get",        (VALUE (*)(...))RugTilemapGetLayer, -1);
+  rb_define_method(cRugTilemap, "set",        (VALUE (*)(...))RugTilemapSetLayer, -1);
+  rb_define_method(cRugTilemap, "load_layer", (VALUE (*)(...))RugTilemapLoadLayer, 2);
+  rb_define_method(cRugTilemap, "animate",    (VALUE (*)(...))RugTilemapAnimate,   3);
+  rb_define_method(cRugTilemap, "draw",       (VALUE (*)(...))RugTilemapDraw,     -1);
+  rb_define_method(cRugTilemap, "width",      (VALUE (*)(...))RugTilemapWidth,     0);
+  rb_define_method(cRugTilemap, "height",     (VALUE (*)(...))RugTilemapHeight,    0);
+  rb_define_method(cRugTilemap, "columns",    (VALUE (*)(...))RugTilemapColumns,   0);
+  rb_define_method(cRugTilemap, "rows",       (VALUE (*)(...))RugTilemapRows,      0);
+  rb_define_method(cRugTilemap, "layers",     (VALUE (*)(...))RugTilemapLayers,    0);
+}
@@ -0,0 +1,8 @@
+#ifndef RUG_TILEMAP_H
+#define RUG_TILEMAP_H
+
+#include "ruby.h"
+
+void LoadTilemap(VALUE);
+
+#endif //RUG_TILEMAP_H
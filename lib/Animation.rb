@@ -27,66 +27,29 @@ module Rug
       end
     end
 
+    # The frames and their timing are kept in ext/animation.cpp, which
+    # advances every animation once a frame from the main loop
     def initialize animations = {}
-      @framesets = {}
       default = :idle
       animations.each do |name, data|
-        img = Rug::Image.new data[:filename]
+        # frames can come packed in a Rug::Atlas instead of their own file
+        img = data[:image] || Rug::Image.new(data[:filename])
 
-        @framesets[name] = Frameset.new(
+        frameset = Frameset.new(
           :image => img,
           :num_frames => data[:num_frames],
           :timing => data[:timing]
         )
+        add_frameset name, frameset.image, frameset.timing
 
         if data[:default] == true
           default = name
         end
       end
 
-      raise "No default animation set!" if !@framesets.key?(default)
+      raise "No default animation set!" if !animations.key?(default)
 
-      @current_frameset = @framesets[default]
-      @current_frame = 0
-      @last_update = Rug.get_time
-    end
-
-    def update
-      now = Rug.get_time
-      if @last_update + @current_frameset.timing[@current_frame] < now
-        @last_update = now
-        @current_frame = (@current_frame + 1) % @current_frameset.num_frames
-      end
-    end
-
-    def animation= which
-      if @framesets.key? which
-        @current_frameset = @framesets[which]
-        @current_frame = 0
-      else
-        raise "No frameset named #{which}!"
-      end
-    end
-
-    def draw x, y, layer = nil
-      # if a block is passed, transform the image
-      img = 
-        if block_given?
-          yield @current_frameset.image
-        else
-          @current_frameset.image
-        end
-
-      img.draw x, y, @current_frameset.frame_width, img.height,
-        @current_frameset.frame_width * @current_frame, 0, layer
-    end
-
-    def width
-      @current_frameset.frame_width
-    end
-
-    def height
-      @current_frameset.height
+      self.animation = default
     end
   end
 end
@@ -1,9 +1,11 @@
 module Rug
   module HasAnimation
     def draw x_offset = 0.0, y_offset = 0.0, layer = nil, &custom_render
-      @animation.draw @x + x_offset, @y + y_offset, layer, &custom_render
+      @animation.draw x + x_offset, y + y_offset, layer, &custom_render
     end
 
+    # Rug::Animation is advanced by the main loop, but images and other
+    # things used as an animation may still want to know about the update
     def update_animation dt
       @animation.update
     end
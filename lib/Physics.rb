@@ -81,6 +81,43 @@ module Rug
       end
     end
 
+    # Sweeps shapes _a_ and _b_ from where their bodies were at the start of
+    # the step to where they are now, using the native swept tests. Only
+    # the motion of _a_ relative to _b_ matters, so _b_ is held still at
+    # its start and _a_ moves by the difference. Returns nil if they don't
+    # touch, otherwise an array of the time of impact from 0 to 1 and the
+    # contact normal pointing back towards _a_. The normal for _b_ is the
+    # same one turned around.
+    def self.sweep a, b
+      return nil unless respond_to? :sweep_rect_rect
+
+      adx, ady = moved a.body
+      bdx, bdy = moved b.body
+      dx, dy = adx - bdx, ady - bdy
+
+      # shapes are swept from where they started
+      ax, ay = a.x - adx, a.y - ady
+      bx, by = b.x - bdx, b.y - bdy
+
+      if a.is_a? Circle and b.is_a? Circle
+        sweep_circle_circle ax, ay, a.radius, dx, dy, bx, by, b.radius
+      elsif a.is_a? Circle and b.is_a? Rectangle
+        sweep_circle_rect ax, ay, a.radius, dx, dy, bx, by, b.w, b.h
+      elsif a.is_a? Rectangle and b.is_a? Circle
+        # sweep the circle the other way against the rectangle
+        hit = sweep_circle_rect bx, by, b.radius, -dx, -dy, ax, ay, a.w, a.h
+        hit and [hit[0], -hit[1], -hit[2]]
+      elsif a.is_a? Rectangle and b.is_a? Rectangle
+        sweep_rect_rect ax, ay, a.w, a.h, dx, dy, bx, by, b.w, b.h
+      end
+    end
+
+    # How far a body has moved this step
+    def self.moved body
+      return 0.0, 0.0 if body.last_x.nil?
+      return body.x - body.last_x, body.y - body.last_y
+    end
+
     # This is a base class used for collision detection.
     class Shape
       attr_accessor :body
@@ -162,26 +199,62 @@ module Rug
       def height; @h; end
     end
 
+    # The world finds collisions but doesn't resolve them. For the length of
+    # each body's collide call, Body#contact holds the time of impact and
+    # normal from Rug::Physics.sweep. It is up to the handlers to act on
+    # them, for example with Body#revert_position.
     class World
       attr_accessor :gravity, :collide_with_window
 
-      def initialize
-        # TODO: use a better data structure for objects like a quadtree
+      # _cell_size_ is the size of the cells used by the broadphase, which
+      # should be around the size of a typical body.
+      #
+      # If _native_ is set then the position, velocity and mass of every
+      # body are kept in a native store, and the world moves all of them in
+      # one pass before calling each body's update. Body#update_body then
+      # only checks for collisions. The store is read and written through
+      # the x, y, vx, vy and mass accessors, so bodies in a native world
+      # have to use those. Setting @x, @vy and so on directly, as in
+      # <tt>@vy = -@vy</tt>, only changes an instance variable that the
+      # world never looks at; write <tt>self.vy = -vy</tt> instead.
+      # HasAnimation#draw and the examples use the accessors, so they work
+      # with either kind of world.
+      def initialize cell_size = 64, native = false
         @objects = Array.new
         @gravity = 200.0
         @collide_with_window = true
+
+        # the native broadphase is only available when the extension is loaded
+        @broadphase = SpatialHash.new cell_size if defined? SpatialHash
+        @bodies = BodyStore.new if native and defined? BodyStore
       end
 
       def << obj
         @objects << obj
         obj.world = self
+        @bodies.add obj if @bodies
+        refresh obj
       end
 
       def update dt
-        @objects.each do |obj|
-          obj.update dt
+        if @bodies
+          @bodies.integrate dt
 
-          obj.apply_force 0, @gravity * obj.mass * dt / 1000.0
+          # everything has moved, so file every body under its new cells
+          # before any of them look for collisions
+          @objects.each { |obj| refresh obj }
+
+          @objects.each { |obj| obj.update dt }
+          @bodies.apply_gravity @gravity, dt
+        else
+          # bodies that haven't had their turn yet are still this step
+          @objects.each { |obj| obj.start_step }
+
+          @objects.each do |obj|
+            obj.update dt
+
+            obj.apply_force 0, @gravity * obj.mass * dt / 1000.0
+          end
         end
       end
 
@@ -190,31 +263,120 @@ module Rug
       end
 
       def check_for_collision which
-        obj = @objects.find do |o|
-          o != which and o.overlap? which
-        end
+        obj =
+          if @broadphase
+            refresh which
+            @broadphase.candidates(which).find { |o| o.overlap? which }
+          else
+            @objects.find do |o|
+              o != which and o.overlap? which
+            end
+          end
+
+        # a fast body can pass right through another in one update
+        obj = first_contact which if obj.nil? and which.shape
 
         if obj
+          # so that revert_position goes back to the point of contact. Both
+          # bodies get the same time of impact.
+          hit = Physics.sweep which.shape, obj.shape
+          which.contact = hit
+          obj.contact = hit && [hit[0], -hit[1], -hit[2]]
+
           obj.collide which
           which.collide obj
+
+          # the contact is only for these handlers
+          which.contact = obj.contact = nil
+
+          # the collision handlers may have moved things around
+          if @broadphase
+            refresh obj
+            refresh which
+          end
         elsif @collide_with_window
           edge = which.shape.check_edge
-          which.collide edge if edge
+          if edge
+            which.contact = nil
+            which.collide edge
+          end
         end
       end
 
       def remove body
         @objects.delete body
+        @broadphase.remove body if @broadphase
+        @bodies.remove body if @bodies
+      end
+
+      # Finds the first body that _which_ hits on the way from its last
+      # position to where it is now. A body that moved less than its own
+      # size can't have passed through anything, so this is skipped for it
+      # and only fast bodies pay for the sweeps.
+      def first_contact which
+        return nil if which.last_x.nil?
+        return nil if (which.x - which.last_x).abs <= which.width and (which.y - which.last_y).abs <= which.height
+
+        x0, x1 = [which.last_x, which.x].minmax
+        y0, y1 = [which.last_y, which.y].minmax
+
+        candidates =
+          if @broadphase
+            @broadphase.query x0, y0, x1 - x0 + which.width, y1 - y0 + which.height
+          else
+            @objects
+          end
+
+        first, toi = nil, nil
+        candidates.each do |o|
+          next if o == which or o.shape.nil?
+
+          # bodies that started overlapping and are moving apart aren't hits
+          hit = Physics.sweep which.shape, o.shape
+          next if hit.nil? or (hit[1] == 0 and hit[2] == 0)
+
+          first, toi = o, hit[0] if toi.nil? or hit[0] < toi
+        end
+
+        first
+      end
+
+      # Files a body in the broadphase under where it is now. A body is
+      # refreshed when check_for_collision is called for it, on both bodies
+      # after their collide handlers run, and for every body after a native
+      # world integrates. A body moved by hand anywhere else is found in the
+      # wrong place until this is called.
+      def refresh body
+        return if @broadphase.nil?
+
+        if body.shape
+          @broadphase.update body, body.x, body.y, body.width, body.height
+        else
+          @broadphase.remove body
+        end
       end
     end
 
     module Body
       attr_accessor :world, :shape, :mass, :x, :y, :vx, :vy
 
+      # Where the body was at the start of the last step
+      attr_reader :last_x, :last_y
+
+      # The time of impact and normal of the collision being handled, from
+      # Rug::Physics.sweep. It is nil outside of collide, and inside it if
+      # the contact isn't known.
+      attr_accessor :contact
+
       def initialize x = 0.0, y = 0.0, vx = 0.0, vy = 0.0, mass = 0.0
         @x, @y, @vx, @vy, @mass = x, y, vx, vy, mass
       end
 
+      # Marks where the body is before anything moves in a step
+      def start_step
+        @last_x, @last_y = @x, @y
+      end
+
       def update_body dt
         @last_x, @last_y = @x, @y
         @x += @vx * dt / 1000.0
@@ -259,17 +421,25 @@ module Rug
         update_body dt
       end
 
+      # Moves the body back to where it touched the body it collided with, or
+      # to where it was before it moved if the contact isn't known, such as
+      # when it hit the edge of the window. Only the time of impact is used,
+      # so the body is moved back along its path rather than pushed out
+      # along the contact normal.
       def revert_position which = nil
-        # TODO: right now this just moves the object back to where it was, but for
-        # high velocities this causes the object to stop a visible distance from
-        # the other object - need to have a "partial" movement
+        return if last_x.nil?
+
+        t = @contact ? @contact[0] : 0.0
+        cx = last_x + (x - last_x) * t
+        cy = last_y + (y - last_y) * t
+
         case which
         when :x
-          @x = @last_x
+          self.x = cx
         when :y
-          @y = @last_y
+          self.y = cy
         else
-          @x, @y = @last_x, @last_y
+          self.x, self.y = cx, cy
         end
       end
     end
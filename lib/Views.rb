@@ -7,20 +7,28 @@ module Rug
     attr_reader :layer
     attr_accessor :x, :y, :scroll_speed
 
-    # Two overloads:
+    # Three overloads:
     # initialize(width, height, auto_inputs = true)
     # initialize(filename, auto_inputs = true)
+    # initialize(backing, auto_inputs = true)
     #
     # If a filename is passed, it is used as a background image. The width and height
-    # of the view will be the size of the background image.
+    # of the view will be the size of the background image. Files made with
+    # Rug::ChunkedImage.build (ending in .chunks) are only read in as they scroll
+    # into view.
+    #
+    # The backing can be anything that draws like a Rug::Layer and has a width and
+    # height, such as a Rug::Tilemap.
     #
     # If auto_inputs is true, then the view will automatically register key-handling
     # behaviour.
     def initialize arg1, arg2 = nil, arg3 = nil
       width, height, auto_inputs, background_image =
         if arg1.is_a? String
-          img = Rug::Image.new arg1
+          img = arg1 =~ /\.chunks$/ ? Rug::ChunkedImage.new(arg1) : Rug::Image.new(arg1)
           [img.width, img.height, arg2 != false, img]
+        elsif arg1.respond_to? :draw
+          [arg1.width, arg1.height, arg2 != false, arg1]
         else
           [arg1, arg2, arg3 != false, nil]
         end
@@ -58,9 +66,10 @@ module Rug
   end
 
   class WatcherView < ScrollView
-    # There are two overloads here:
+    # There are three overloads here:
     # initialize(body, width, height)
     # initialize(body, background_image)
+    # initialize(body, backing)
     def initialize body, arg1, arg2 = nil
       @body = body
 
@@ -0,0 +1,183 @@
+// Checks the blend kernels in ext/blit.cpp. BlendBlit and the scalar
+// kernel have to give exactly what SDL_gfxBlitRGBA does, and the SSE2 and
+// AVX2 kernels exactly what the scalar one does, down to the last byte.
+// Every source and target channel value is tried at every alpha, then
+// surfaces full of random pixels.
+//
+//   rake test:blit
+
+#include "../ext/blit.cpp"
+#include "../ext/cpu.cpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using namespace std;
+
+typedef struct {
+  const char * name;
+  Uint32 r, g, b, a;
+} Masks;
+
+static const Masks SOURCES[] = {
+  { "ARGB", 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000 },
+  { "ABGR", 0x000000FF, 0x0000FF00, 0x00FF0000, 0xFF000000 },
+  { "RGBA", 0xFF000000, 0x00FF0000, 0x0000FF00, 0x000000FF },
+};
+
+// XRGB has no kernel and goes straight to SDL_gfx. The others have blue,
+// red and alpha in the lowest byte, where SDL_gfx's carry shows.
+static const Masks TARGETS[] = {
+  { "XRGB", 0x00FF0000, 0x0000FF00, 0x000000FF, 0 },
+  { "ARGB", 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000 },
+  { "ABGR", 0x000000FF, 0x0000FF00, 0x00FF0000, 0xFF000000 },
+  { "RGBA", 0xFF000000, 0x00FF0000, 0x0000FF00, 0x000000FF },
+};
+
+static const int RANDOM_ROUNDS = 16;
+
+static SDL_Surface * NewSurface(const Masks & m){
+  return SDL_CreateRGBSurface(SDL_SWSURFACE, 256, 256, 32, m.r, m.g, m.b, m.a);
+}
+
+static Uint32 * Row(SDL_Surface * s, int y){
+  return (Uint32 *)((Uint8 *)s->pixels + y * s->pitch);
+}
+
+// Every pairing of source and target channel value: the source value is
+// the column and the target value is the row, in all three channels
+static void Fill(SDL_Surface * src, SDL_Surface * dst, int alpha){
+  for (int y = 0; y < 256; y++){
+    for (int x = 0; x < 256; x++){
+      Row(src, y)[x] = SDL_MapRGBA(src->format, x, 255 - x, x ^ 0x5A, alpha);
+      Row(dst, y)[x] = SDL_MapRGBA(dst->format, y, y ^ 0xA5, 255 - y, (x + y) & 0xFF);
+    }
+  }
+}
+
+static Uint32 RandomPixel(){
+  return ((Uint32)(rand() & 0xFFFF) << 16) | (rand() & 0xFFFF);
+}
+
+static void FillRandom(SDL_Surface * src, SDL_Surface * dst){
+  for (int y = 0; y < 256; y++){
+    for (int x = 0; x < 256; x++){
+      Row(src, y)[x] = RandomPixel();
+      Row(dst, y)[x] = RandomPixel();
+    }
+  }
+}
+
+static void RunKernel(BlendRowFunc kernel, SDL_Surface * src, SDL_Surface * dst, const BlendFormat & f){
+  for (int y = 0; y < 256; y++){
+    kernel(Row(src, y), Row(dst, y), 256, f);
+  }
+}
+
+// SDL_BlitSurface would blend surfaces with alpha rather than copy them
+static void Copy(SDL_Surface * from, SDL_Surface * to){
+  for (int y = 0; y < 256; y++){
+    memcpy(Row(to, y), Row(from, y), 256 * 4);
+  }
+}
+
+// Prints the first pixel that differs
+static bool SamePixels(SDL_Surface * src, SDL_Surface * dst, SDL_Surface * want, SDL_Surface * got){
+  for (int y = 0; y < 256; y++){
+    for (int x = 0; x < 256; x++){
+      if (Row(want, y)[x] != Row(got, y)[x]){
+        printf("  at %d,%d: %08X over %08X gives %08X, not %08X\n", x, y,
+               Row(src, y)[x], Row(dst, y)[x], Row(got, y)[x], Row(want, y)[x]);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+int main(){
+  vector< pair<const char *, BlendRowFunc> > kernels;
+#if defined(__SSE2__)
+  kernels.push_back(make_pair("SSE2", (BlendRowFunc)BlendRowSSE2));
+#endif
+#ifdef RUG_HAVE_AVX2_KERNEL
+  if (CpuHasAVX2()){
+    kernels.push_back(make_pair("AVX2", (BlendRowFunc)BlendRowAVX2));
+  }
+#endif
+
+  int failures = 0;
+  srand(1);
+
+  for (size_t si = 0; si < sizeof(SOURCES) / sizeof(SOURCES[0]); si++){
+    for (size_t di = 0; di < sizeof(TARGETS) / sizeof(TARGETS[0]); di++){
+      const char * from = SOURCES[si].name;
+      const char * onto = TARGETS[di].name;
+
+      SDL_Surface * src = NewSurface(SOURCES[si]);
+      SDL_Surface * dst = NewSurface(TARGETS[di]);
+      SDL_Surface * gfx = NewSurface(TARGETS[di]);
+      SDL_Surface * scalar = NewSurface(TARGETS[di]);
+      SDL_Surface * simd = NewSurface(TARGETS[di]);
+
+      BlendFormat f;
+      bool hasKernel = GetBlendFormat(src, dst, f);
+      if (!hasKernel && TARGETS[di].a != 0){
+        printf("%s onto %s: no kernel for this format\n", from, onto);
+        failures++;
+      }
+
+      // alphas 0 to 255 over every channel value, then random pixels
+      for (int round = 0; round < 256 + RANDOM_ROUNDS; round++){
+        if (round < 256){
+          Fill(src, dst, round);
+        } else {
+          FillRandom(src, dst);
+        }
+
+        Copy(dst, gfx);
+        SDL_gfxBlitRGBA(src, NULL, gfx, NULL);
+
+        Copy(dst, simd);
+        BlendBlit(src, NULL, simd, NULL);
+        if (!SamePixels(src, dst, gfx, simd)){
+          printf("%s onto %s: BlendBlit differs from SDL_gfxBlitRGBA in round %d\n", from, onto, round);
+          failures++;
+        }
+
+        if (!hasKernel){
+          continue;
+        }
+
+        Copy(dst, scalar);
+        RunKernel(BlendRow, src, scalar, f);
+        if (!SamePixels(src, dst, gfx, scalar)){
+          printf("%s onto %s: scalar differs from SDL_gfxBlitRGBA in round %d\n", from, onto, round);
+          failures++;
+        }
+
+        for (size_t k = 0; k < kernels.size(); k++){
+          Copy(dst, simd);
+          RunKernel(kernels[k].second, src, simd, f);
+          if (!SamePixels(src, dst, scalar, simd)){
+            printf("%s onto %s: %s differs from scalar in round %d\n", from, onto, kernels[k].first, round);
+            failures++;
+          }
+        }
+      }
+
+      printf("%s onto %s: checked %s\n", from, onto, hasKernel ? "kernels" : "SDL_gfx fallback");
+
+      SDL_FreeSurface(src);
+      SDL_FreeSurface(dst);
+      SDL_FreeSurface(gfx);
+      SDL_FreeSurface(scalar);
+      SDL_FreeSurface(simd);
+    }
+  }
+
+  printf(failures ? "FAILED\n" : "OK\n");
+  return failures ? 1 : 0;
+}
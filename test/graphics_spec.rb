@@ -0,0 +1,169 @@
+# These need the extension and SDL, and run a headless game. Rug.start
+# can only be called once, so every check registers a frame with
+# HeadlessRun and the whole game is run before the first example. Each
+# frame's block runs inside the draw block, so blits onto the screen are
+# deferred when there is more than one composite thread.
+begin
+  require File.dirname(__FILE__) + '/../lib/Rug'
+rescue LoadError
+end
+
+BEAR = File.dirname(__FILE__) + '/../examples/side-scroller/bear_idle.png'
+
+module HeadlessRun
+  @frames = []
+  @results = {}
+
+  class << self
+    attr_reader :results, :checksums
+
+    def frame name, &block
+      @frames << [name, block]
+    end
+
+    def checksum name
+      @checksums[@frames.map { |n, block| n }.index(name)]
+    end
+
+    def run
+      return if @ran
+      @ran = true
+
+      queued = @frames
+      results = @results
+
+      Rug.conf do
+        headless true
+        gui false
+        width 320
+        height 240
+        composite_threads 2
+        checksums true
+        frames queued.size
+      end
+
+      i = 0
+      Rug.draw do
+        if i < queued.size
+          name, block = queued[i]
+          results[name] = block.call
+          i += 1
+        end
+      end
+
+      # one checksum per frame, in the order they were registered
+      @checksums = Rug.start
+    end
+  end
+end
+
+# the image is made in a method so nothing on this frame's stack keeps it
+def draw_and_forget filename
+  Rug::Image.new(filename).draw 0, 0
+  nil
+end
+
+# Draws what tilemap.draw x, y, w, h, sx, sy should with 8x8 tiles, one
+# tile at a time, each cut down to the view and the 320x240 screen
+def draw_tiles tileset, cells, x, y, w, h, sx, sy
+  across = tileset.width / 8
+  left, top = [x, 0].max, [y, 0].max
+  right, bottom = [x + w, 320].min, [y + h, 240].min
+
+  cells.each_with_index do |row, j|
+    row.each_with_index do |tile, i|
+      tx, ty = x + i * 8 - sx, y + j * 8 - sy
+      cx, cy = [tx, left].max, [ty, top].max
+      cw, ch = [tx + 8, right].min - cx, [ty + 8, bottom].min - cy
+      next if cw <= 0 or ch <= 0
+
+      tileset.draw cx, cy, cw, ch, (tile - 1) % across * 8 + cx - tx, (tile - 1) / across * 8 + cy - ty
+    end
+  end
+end
+
+if defined? Rug::Image
+  pixels = nil
+
+  HeadlessRun.frame :load do
+    pixels = Rug::Image.new(BEAR).get_pixels
+    GC.start
+  end
+
+  # the only image using the file is collected while the compositor still
+  # has its surface, which is freed when the frame is flushed
+  HeadlessRun.frame :collect_while_deferred do
+    draw_and_forget BEAR
+    GC.start
+  end
+
+  HeadlessRun.frame :reload do
+    Rug::Image.new(BEAR).get_pixels == pixels
+  end
+
+  HeadlessRun.frame :modify_shared do
+    changed = Rug::Image.new BEAR
+    other = Rug::Image.new BEAR
+    changed.fill_rect 0, 0, 9, 9
+
+    [changed.get_pixels != pixels, other.get_pixels == pixels, Rug::Image.new(BEAR).get_pixels == pixels]
+  end
+
+  HeadlessRun.frame :modify_only do
+    GC.start
+    changed = Rug::Image.new BEAR
+    changed.fill_rect 0, 0, 9, 9
+
+    [changed.get_pixels != pixels, Rug::Image.new(BEAR).get_pixels == pixels]
+  end
+
+  # the tileset is loaded after the image cache checks so it doesn't share
+  # their surface
+  tileset = tilemap = nil
+  cells = (0...40).map { |j| (0...60).map { |i| (i * 7 + j * 3) % 256 + 1 } }
+
+  HeadlessRun.frame :tilemap_offset do
+    tileset = Rug::Image.new BEAR
+    tilemap = Rug::Tilemap.new tileset, 8, 8, 60, 40
+    tilemap.load_layer 0, cells
+    tilemap.draw 30, 40, 200, 150, 45, 37
+  end
+
+  HeadlessRun.frame(:tiles_offset) { draw_tiles tileset, cells, 30, 40, 200, 150, 45, 37 }
+
+  # hangs off the top left of the screen, and is wider than an SDL_Rect
+  HeadlessRun.frame(:tilemap_off_screen) { tilemap.draw(-20, -12, 70000, 300, 45, 37) }
+  HeadlessRun.frame(:tiles_off_screen) { draw_tiles(tileset, cells, -20, -12, 70000, 300, 45, 37) }
+end
+
+describe "Image cache" do
+  before :all do
+    HeadlessRun.run
+  end
+
+  it "doesn't hand out a surface freed after a deferred draw" do
+    HeadlessRun.results[:reload].should == true
+  end
+
+  it "copies a shared image before drawing on it" do
+    HeadlessRun.results[:modify_shared].should == [true, true, true]
+  end
+
+  it "stops handing out an image for its file once it is drawn on" do
+    HeadlessRun.results[:modify_only].should == [true, true]
+  end
+end if defined? Rug::Image
+
+describe "Tilemap" do
+  before :all do
+    HeadlessRun.run
+  end
+
+  it "draws part of the map at an offset" do
+    HeadlessRun.checksum(:tilemap_offset).should == HeadlessRun.checksum(:tiles_offset)
+  end
+
+  it "draws only what is on the screen" do
+    HeadlessRun.checksum(:tilemap_off_screen).should == HeadlessRun.checksum(:tiles_off_screen)
+  end
+end if defined? Rug::Tilemap
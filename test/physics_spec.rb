@@ -1,5 +1,11 @@
 require File.dirname(__FILE__) + '/../lib/Physics'
 
+# the native parts of Physics are only there when the extension is built
+begin
+  require File.dirname(__FILE__) + '/../ext/Rug'
+rescue LoadError
+end
+
 include Rug
 include Rug::Physics
 
@@ -118,3 +124,278 @@ describe "Gravity" do
     body.vy.should == 0.0
   end
 end
+
+describe "Broadphase" do
+  before :each do
+    srand 7
+    @world = World.new 32
+    @world.collide_with_window = false
+
+    @bodies = (1..200).map do
+      body = BodyWrapper.new rand * 500, rand * 500
+      body.shape = rand < 0.5 ? Rectangle.new(rand * 40 + 1, rand * 40 + 1) : Circle.new(rand * 20 + 1)
+      @world << body
+      body
+    end
+
+    @hash = @world.instance_variable_get :@broadphase
+  end
+
+  def boxes_overlap? a, x, y, w, h
+    a.x <= x + w and x <= a.x + a.width and a.y <= y + h and y <= a.y + a.height
+  end
+
+  it "should find the same candidates as checking every body" do
+    @bodies.each do |body|
+      brute = @bodies.select { |o| o != body and boxes_overlap?(o, body.x, body.y, body.width, body.height) }
+      @hash.candidates(body).should == brute
+    end
+  end
+
+  it "should find the same bodies in a box as checking every body" do
+    50.times do
+      x, y, w, h = rand * 500 - 50, rand * 500 - 50, rand * 200, rand * 200
+      brute = @bodies.select { |o| boxes_overlap? o, x, y, w, h }
+      @hash.query(x, y, w, h).should == brute
+    end
+  end
+
+  it "should follow bodies that move" do
+    @bodies.each do |body|
+      body.x, body.y = rand * 500, rand * 500
+      @world.refresh body
+    end
+
+    @bodies.each do |body|
+      brute = @bodies.select { |o| o != body and boxes_overlap?(o, body.x, body.y, body.width, body.height) }
+      @hash.candidates(body).should == brute
+    end
+  end
+end if defined? SpatialHash
+
+class CountingBody < BodyWrapper
+  attr_reader :hits
+
+  def initialize x, y, vx, vy, mass
+    super x, y, mass
+    self.vx, self.vy = vx, vy
+    @hits = []
+  end
+
+  def collide other
+    @hits << other
+  end
+end
+
+describe "Native bodies" do
+  def make_world native
+    srand 11
+    world = World.new 64, native
+    world.collide_with_window = false
+
+    bodies = (0...50).map do |i|
+      # far enough apart that they never touch
+      body = CountingBody.new i * 1000.0, rand * 100, rand * 200 - 100, rand * 200 - 100, rand < 0.2 ? 0.0 : 1.0
+      body.shape = Rectangle.new 10, 10
+      world << body
+      body
+    end
+
+    [world, bodies]
+  end
+
+  it "should move bodies the same as Ruby does" do
+    ruby, ruby_bodies = make_world false
+    native, native_bodies = make_world true
+
+    60.times do
+      ruby.update 16
+      native.update 16
+    end
+
+    ruby_bodies.zip(native_bodies).each do |a, b|
+      (a.x - b.x).abs.should < 1e-6
+      (a.y - b.y).abs.should < 1e-6
+      (a.vx - b.vx).abs.should < 1e-6
+      (a.vy - b.vy).abs.should < 1e-6
+      (a.last_x - b.last_x).abs.should < 1e-6
+      (a.last_y - b.last_y).abs.should < 1e-6
+    end
+  end
+
+  it "should find collisions between bodies that are both moving" do
+    [false, true].each do |native|
+      world = World.new 64, native
+      world.gravity = 0
+      world.collide_with_window = false
+
+      a = CountingBody.new 0.0, 0.0, 200.0, 0.0, 1.0
+      b = CountingBody.new 500.0, 0.0, -200.0, 0.0, 1.0
+      a.shape = Rectangle.new 10, 10
+      b.shape = Rectangle.new 10, 10
+      world << a
+      world << b
+
+      # they meet in the middle after about 1.2 seconds
+      100.times { world.update 16 }
+
+      a.hits.include?(b).should == true
+      b.hits.include?(a).should == true
+    end
+  end
+
+  it "should see every body where it is now when checking for collisions" do
+    world = World.new 16, true
+    world.gravity = 0
+    world.collide_with_window = false
+
+    # the first body to update is still, the second lands on it from well
+    # outside its cells in one step
+    still = CountingBody.new 100.0, 100.0, 0.0, 0.0, 1.0
+    mover = CountingBody.new 100.0, 200.0, 0.0, -6250.0, 1.0
+    still.shape = Rectangle.new 10, 10
+    mover.shape = Rectangle.new 10, 10
+    world << still
+    world << mover
+
+    def still.update dt
+      before = hits.size
+      super
+      @found_itself = hits.size > before
+    end
+
+    world.update 16
+    still.instance_variable_get(:@found_itself).should == true
+  end
+end if defined? BodyStore
+
+class Bullet < CountingBody
+  attr_reader :contacts
+
+  def collide other
+    super
+    (@contacts ||= []) << contact
+    revert_position
+  end
+end
+
+describe "Swept collisions" do
+  def close hit, expected
+    hit.size.should == 3
+    hit.zip(expected).each { |a, b| (a - b).abs.should < 1e-6 }
+  end
+
+  it "should sweep rectangles against rectangles" do
+    close Physics.sweep_rect_rect(0, 0, 10, 10, 100, 0, 50, 0, 10, 10), [0.4, -1, 0]
+    close Physics.sweep_rect_rect(0, 0, 10, 10, 0, -100, 0, -60, 10, 10), [0.5, 0, 1]
+    Physics.sweep_rect_rect(0, 0, 10, 10, 100, 0, 50, 50, 10, 10).should == nil
+    Physics.sweep_rect_rect(0, 0, 10, 10, 100, 0, 5, 5, 10, 10).should == [0, 0, 0]
+  end
+
+  it "should sweep circles against circles" do
+    close Physics.sweep_circle_circle(0, 0, 5, 100, 0, 50, 0, 5), [0.4, -1, 0]
+    Physics.sweep_circle_circle(0, 0, 5, 100, 0, 50, 20, 5).should == nil
+    Physics.sweep_circle_circle(0, 0, 5, 100, 0, 8, 0, 5).should == [0, 0, 0]
+  end
+
+  it "should sweep circles against rectangles" do
+    close Physics.sweep_circle_rect(0, 5, 5, 100, 0, 50, 0, 10, 10), [0.45, -1, 0]
+
+    # over the rounded corner
+    d = Math.sqrt(0.5)
+    close Physics.sweep_circle_rect(-20, -20, 5, 40, 40, 0, 0, 10, 10), [(20 - 5 * d) / 40, -d, -d]
+
+    # close to the corner but missing it
+    Physics.sweep_circle_rect(-20, -20, 5, 40, 0, 0, 0, 10, 10).should == nil
+
+    # past the corner square and onto a face
+    close Physics.sweep_circle_rect(-4, -20, 5, 16, 40, 0, 0, 10, 10), [0.375, 0, -1]
+
+    Physics.sweep_circle_rect(0, 0, 5, 100, 0, 2, 2, 10, 10).should == [0, 0, 0]
+  end
+
+  it "should sweep shapes along their bodies' last move" do
+    a = BodyWrapper.new 0.0, 0.0
+    a.shape = Rectangle.new 10, 10
+    b = BodyWrapper.new -50.0, 0.0
+    b.shape = Circle.new 5
+
+    a.instance_variable_set :@last_x, -100.0
+    a.instance_variable_set :@last_y, 0.0
+
+    # a's right edge meets the left of the circle at x = -50
+    close Physics.sweep(a.shape, b.shape), [0.4, -1, 0]
+  end
+
+  it "should stop a fast body at the first thing in its way" do
+    world = World.new
+    world.gravity = 0
+    world.collide_with_window = false
+
+    wall = CountingBody.new 500.0, 0.0, 0.0, 0.0, 0.0
+    wall.shape = Rectangle.new 10, 100
+    world << wall
+
+    # moves 960 pixels in one update, right through the wall
+    bullet = Bullet.new 0.0, 50.0, 60000.0, 0.0, 0.0
+    bullet.shape = Rectangle.new 4, 4
+    world << bullet
+
+    world.update 16
+
+    bullet.hits.should == [wall]
+    close bullet.contacts.first, [(500 - 4) / 960.0, -1, 0]
+    (bullet.x - 496).abs.should < 1e-6
+    bullet.contact.should == nil
+    wall.contact.should == nil
+  end
+
+  it "should sweep two moving bodies against each other" do
+    world = World.new
+    world.gravity = 0
+    world.collide_with_window = false
+
+    # they pass right through each other in one update
+    left = Bullet.new 0.0, 50.0, 60000.0, 0.0, 0.0
+    left.shape = Rectangle.new 4, 4
+    world << left
+
+    right = Bullet.new 1000.0, 50.0, -60000.0, 0.0, 0.0
+    right.shape = Rectangle.new 4, 4
+    world << right
+
+    world.update 16
+
+    # they close 996 pixels at 1920 pixels an update
+    left.contacts.size.should == 1
+    close left.contacts.first, [996 / 1920.0, -1, 0]
+    close right.contacts.first, [996 / 1920.0, 1, 0]
+    (right.x - left.x - 4).abs.should < 1e-6
+  end
+
+  it "should revert to the contact if there is one" do
+    body = BodyWrapper.new 0.0, 0.0
+    body.shape = Rectangle.new 10, 10
+    body.instance_variable_set :@last_x, -100.0
+    body.instance_variable_set :@last_y, -50.0
+
+    body.contact = [0.25, -1, 0]
+    body.revert_position
+    body.x.should == -75.0
+    body.y.should == -37.5
+  end
+
+  it "should revert to where it was without a contact" do
+    body = BodyWrapper.new 0.0, 0.0
+    body.shape = Rectangle.new 10, 10
+    body.instance_variable_set :@last_x, -100.0
+    body.instance_variable_set :@last_y, -50.0
+
+    body.revert_position :x
+    body.x.should == -100.0
+    body.y.should == 0.0
+
+    body.revert_position
+    body.y.should == -50.0
+  end
+end if defined? Physics.sweep_rect_rect